@@ -1,5 +1,16 @@
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <mutex>
+#include <atomic>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <time.h>
 
 // Define the _DEBUG_NEW_ macro here
 // So that the new operator is no longer overloaded in
@@ -7,58 +18,207 @@
 // So as to prevent compilation conflicts
 #define __NEW_OVERLOAD_IMPLEMENTATION__
 #include "LeakDetector.hpp"
+#include "LeakReport.hpp"
 
 typedef struct _MemoryList {
     struct  _MemoryList *next, *prev;
     size_t  size;           // Size for applying memory
-    bool    isArray;        // Is or not applying array
     char    *file;          // Store the current file
+    unsigned long sequence; // Sequence number of this applying, used by snapshots
     unsigned int line;      // Store the current line
+    bool    isArray;        // Is or not applying array
+    unsigned char alignShift;   // log2 of the alignment for over-aligned applying, 0 otherwise
+    unsigned char guard;        // Overflow checking of this block, a '_leak_detector::GuardMode'
 } _MemoryList;
 
 static unsigned long _memory_allocated = 0;     // Store the size of unreleasing memory
+static unsigned long _memory_blocks = 0;        // Store the number of unreleasing blocks
+static unsigned long _memory_sequence = 0;      // Sequence number of the last applying
+
+// Protect '_root' and the counters above, so that the program under checking
+// can apply memory from several threads and take snapshots while running
+static std::mutex _memory_lock;
 
 static _MemoryList _root = {
     &_root, &_root,     // The first element's next and prev pointers are pointing itself
     0,                  
-    false,
     NULL,
+    0,
+    0,
+    false,
+    0,
     0
 }; 
 
 unsigned int _leak_detector::callCount = 0;
 
+/*
+ * Every block starts right after its '_MemoryList', so the list must keep the
+ * alignment which malloc gives to the memory behind it
+*/
+static_assert(sizeof(_MemoryList) % alignof(std::max_align_t) == 0,
+              "_MemoryList must keep the alignment of malloc");
+
+static const size_t _unknown_size = (size_t)-1;
+
+/*
+ * Distance from the begin of the applied memory to the block. For over-aligned
+ * applying the '_MemoryList' is pushed forward, so that it still ends right
+ * before the block
+*/
+static size_t HeaderOffset(unsigned char _alignShift) {
+    if (!_alignShift) return sizeof(_MemoryList);
+    size_t align = (size_t)1 << _alignShift;
+    return (sizeof(_MemoryList) + align - 1) & ~(align - 1);
+}
+
+static unsigned char AlignShift(size_t _align) {
+    unsigned char shift = 0;
+    if (_align <= alignof(std::max_align_t)) return 0;
+    while (((size_t)1 << shift) < _align) ++shift;
+    return shift;
+}
+
+/*
+ * ---- Overflow guard ----
+ * GUARD_CANARY writes '_CANARY_BYTE' behind every block. GUARD_PAGE also puts
+ * blocks of at least '_guard_page_min' bytes at the end of their own pages,
+ * followed by a PROT_NONE page, and fills the gap up to it with the canary.
+ * The mode is read once per applying, so with GUARD_NONE nothing else is paid
+*/
+static const size_t _CANARY_SIZE = 8;
+static const unsigned char _CANARY_BYTE = 0xFD;
+static std::atomic<int> _guard_mode(_leak_detector::GUARD_NONE);
+static size_t _guard_page_min = 4096;
+
+static size_t PageSize() {
+    static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return pageSize;
+}
+
+// Number of canary bytes behind a block
+static size_t GuardLength(unsigned char _guard, size_t _size, unsigned char _alignShift) {
+    if (_guard == _leak_detector::GUARD_NONE) return 0;
+    if (_guard == _leak_detector::GUARD_CANARY) return _CANARY_SIZE;
+    // Only the padding up to the guard page that keeps the block aligned, none if the
+    // size is a multiple of the alignment
+    size_t unit = _alignShift ? (size_t)1 << _alignShift : alignof(std::max_align_t);
+    return (unit - _size % unit) % unit;
+}
+
+// Length of the pages holding a GUARD_PAGE block, without the guard page
+static size_t GuardMapLength(size_t _offset, size_t _size, size_t _tail) {
+    return (_offset + _size + _tail + PageSize() - 1) & ~(PageSize() - 1);
+}
+
+static bool CheckCanary(const _MemoryList *_elem) {
+    const unsigned char *tail = (const unsigned char*)_elem + sizeof(_MemoryList) + _elem->size;
+    size_t length = GuardLength(_elem->guard, _elem->size, _elem->alignShift);
+    for (size_t i = 0; i < length; ++i) {
+        if (tail[i] != _CANARY_BYTE) return false;
+    }
+    return true;
+}
+
+/*
+ * Reported through the allocation free report writer, since it may be called
+ * while '_memory_lock' is held
+*/
+static void ReportOverflow(const _MemoryList *_elem) {
+    _LeakReport report;
+    OpenReport(&report, STDERR_FILENO);
+    ReportAppend(&report, _elem->isArray ? "overflow[] 0x" : "overflow 0x");
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *begin = FormatNumber(end, (unsigned long)((const char*)_elem + sizeof(_MemoryList)), 16);
+    ReportAppend(&report, begin, (size_t)(end - begin));
+    ReportAppend(&report, " size ");
+    ReportNumber(&report, _elem->size);
+    if (_elem->file) {
+        ReportAppend(&report, " (located in ");
+        ReportAppend(&report, _elem->file);
+        ReportAppend(&report, " line ");
+        ReportNumber(&report, _elem->line);
+        ReportAppend(&report, ")\n");
+    } else {
+        ReportAppend(&report, " (Cannot find position)\n");
+    }
+    CloseReport(&report);
+}
+
 /*
  * Allocate the memory from the head of _MemoryList
+ * Returns NULL if the memory runs out, the caller decides to throw or not
 */
-void* AllocateMemory(size_t _size, bool _array, char *_file, unsigned _line) {
+void* AllocateMemory(size_t _size, bool _array, char *_file, unsigned _line, size_t _align = 0) {
+    unsigned char alignShift = AlignShift(_align);
+    size_t offset = HeaderOffset(alignShift);
+
+    unsigned char guardMode = (unsigned char)_guard_mode.load(std::memory_order_relaxed);
+    if (guardMode == _leak_detector::GUARD_PAGE &&
+        (_size < _guard_page_min || ((size_t)1 << alignShift) > PageSize()))
+        guardMode = _leak_detector::GUARD_CANARY;
+
     // Calculate the new memory size
-    size_t newSize = sizeof(_MemoryList) + _size;
+    if (_size > (size_t)-1 / 2 - offset) return NULL;
+    size_t tail = GuardLength(guardMode, _size, alignShift);
+    size_t newSize = offset + _size + tail;
 
     // We use the malloc to allocate the memory due to the new has been overloaded
-    _MemoryList *newElem = (_MemoryList*)malloc(newSize);
+    char *base = NULL;
+    if (guardMode == _leak_detector::GUARD_PAGE) {
+        // The block ends right before the guard page, so overflowing it crashes at once
+        size_t mapLength = GuardMapLength(offset, _size, tail);
+        void *mem = mmap(NULL, mapLength + PageSize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return NULL;
+        if (mprotect((char*)mem + mapLength, PageSize(), PROT_NONE) == 0) {
+            base = (char*)mem + mapLength - (_size + tail) - offset;
+        } else {
+            // Without the guard page, the block is only checked by its canary
+            munmap(mem, mapLength + PageSize());
+            guardMode = _leak_detector::GUARD_CANARY;
+            tail = GuardLength(guardMode, _size, alignShift);
+            newSize = offset + _size + tail;
+        }
+    }
+    if (base) {
+        // Mapped with its guard page
+    } else if (alignShift) {
+        if (posix_memalign((void**)&base, (size_t)1 << alignShift, newSize)) return NULL;
+    } else {
+        base = (char*)malloc(newSize);
+        if (!base) return NULL;
+    }
+    _MemoryList *newElem = (_MemoryList*)(base + offset - sizeof(_MemoryList));
 
-    newElem->next = _root.next;
-    newElem->prev = &_root;
     newElem->size = _size;
     newElem->isArray = _array;
+    newElem->alignShift = alignShift;
+    newElem->guard = guardMode;
     newElem->file = NULL;
+    if (tail) memset((char*)newElem + sizeof(_MemoryList) + _size, _CANARY_BYTE, tail);
 
     // Store the file if it exists
     if (_file) {
         newElem->file = (char *)malloc(strlen(_file) + 1);
-        strcpy(newElem->file, _file);
+        if (newElem->file) strcpy(newElem->file, _file);
     }
 
     // Store line
     newElem->line = _line;
 
+    std::lock_guard<std::mutex> guard(_memory_lock);
+
     // Update list
+    newElem->next = _root.next;
+    newElem->prev = &_root;
     _root.next->prev = newElem;
     _root.next = newElem;
 
     // Recode the unreleasing memory number
     _memory_allocated += _size;
+    ++_memory_blocks;
+    newElem->sequence = ++_memory_sequence;
 
     // Return the allocated memory
     // Transform the newElem to char* to control the pointer move 1 byte one time
@@ -67,37 +227,68 @@ void* AllocateMemory(size_t _size, bool _array, char *_file, unsigned _line) {
 
 /*
  * Delete
+ * A block released by the wrong form of delete (array or not, another
+ * size or alignment) is left in the list, so it is reported as a leak
+ * instead of corrupting the heap
 */
-void DeleteMemory(void *_ptr, bool _array) {
+void DeleteMemory(void *_ptr, bool _array, size_t _size = _unknown_size, size_t _align = 0) {
+    if (!_ptr) return;
+
     // Return the begin of MemoryList
     _MemoryList *currentElem = (_MemoryList*)((char*)_ptr - sizeof(_MemoryList));
 
     if (currentElem->isArray != _array) return;
+    if (_size != _unknown_size && currentElem->size != _size) return;
+    if (currentElem->alignShift != AlignShift(_align)) return;
+    if (currentElem->guard && !CheckCanary(currentElem)) ReportOverflow(currentElem);
 
-    // Update list
-    currentElem->prev->next = currentElem->next;
-    currentElem->next->prev = currentElem->prev;
-    _memory_allocated -= currentElem->size;
+    {
+        std::lock_guard<std::mutex> guard(_memory_lock);
+
+        // Update list
+        currentElem->prev->next = currentElem->next;
+        currentElem->next->prev = currentElem->prev;
+        _memory_allocated -= currentElem->size;
+        --_memory_blocks;
+    }
 
     // Release the memory for storing file 
     if (currentElem->file) free(currentElem->file);
-    free(currentElem);
+    if (currentElem->guard == _leak_detector::GUARD_PAGE) {
+        size_t tail = GuardLength(currentElem->guard, currentElem->size, currentElem->alignShift);
+        size_t mapLength = GuardMapLength(HeaderOffset(currentElem->alignShift), currentElem->size, tail);
+        munmap((char*)_ptr + currentElem->size + tail - mapLength, mapLength + PageSize());
+    } else {
+        free((char*)_ptr - HeaderOffset(currentElem->alignShift));
+    }
 }
 
 /*
  * Overloaded new and delete operation
 */
+static void* AllocateOrThrow(size_t _size, bool _array, char *_file, unsigned _line, size_t _align = 0) {
+    void *ptr = AllocateMemory(_size, _array, _file, _line, _align);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
 void* operator new(size_t _size) {
-    return AllocateMemory(_size, false, NULL, 0);
+    return AllocateOrThrow(_size, false, NULL, 0);
 }
 void* operator new[](size_t _size) {
+    return AllocateOrThrow(_size, true, NULL, 0);
+}
+void* operator new(size_t _size, const std::nothrow_t&) noexcept {
+    return AllocateMemory(_size, false, NULL, 0);
+}
+void* operator new[](size_t _size, const std::nothrow_t&) noexcept {
     return AllocateMemory(_size, true, NULL, 0);
 }
 void* operator new(size_t _size, char *_file, unsigned int _line) {
-    return AllocateMemory(_size, false, _file, _line);
+    return AllocateOrThrow(_size, false, _file, _line);
 }
 void* operator new[](size_t _size, char *_file, unsigned int _line) {
-    return AllocateMemory(_size, true, _file, _line);
+    return AllocateOrThrow(_size, true, _file, _line);
 }
 void operator delete(void *_ptr) noexcept {
     DeleteMemory(_ptr, false);
@@ -105,6 +296,376 @@ void operator delete(void *_ptr) noexcept {
 void operator delete[](void *_ptr) noexcept {
     DeleteMemory(_ptr, true);
 }
+void operator delete(void *_ptr, const std::nothrow_t&) noexcept {
+    DeleteMemory(_ptr, false);
+}
+void operator delete[](void *_ptr, const std::nothrow_t&) noexcept {
+    DeleteMemory(_ptr, true);
+}
+
+#ifdef __cpp_sized_deallocation
+/*
+ * C++14 sized delete, the compiler passes the size given to new
+*/
+void operator delete(void *_ptr, size_t _size) noexcept {
+    DeleteMemory(_ptr, false, _size);
+}
+void operator delete[](void *_ptr, size_t _size) noexcept {
+    DeleteMemory(_ptr, true, _size);
+}
+#endif
+
+#ifdef __cpp_aligned_new
+/*
+ * C++17 new and delete for over-aligned types
+*/
+void* operator new(size_t _size, std::align_val_t _align) {
+    return AllocateOrThrow(_size, false, NULL, 0, (size_t)_align);
+}
+void* operator new[](size_t _size, std::align_val_t _align) {
+    return AllocateOrThrow(_size, true, NULL, 0, (size_t)_align);
+}
+void* operator new(size_t _size, std::align_val_t _align, const std::nothrow_t&) noexcept {
+    return AllocateMemory(_size, false, NULL, 0, (size_t)_align);
+}
+void* operator new[](size_t _size, std::align_val_t _align, const std::nothrow_t&) noexcept {
+    return AllocateMemory(_size, true, NULL, 0, (size_t)_align);
+}
+void* operator new(size_t _size, std::align_val_t _align, char *_file, unsigned int _line) {
+    return AllocateOrThrow(_size, false, _file, _line, (size_t)_align);
+}
+void* operator new[](size_t _size, std::align_val_t _align, char *_file, unsigned int _line) {
+    return AllocateOrThrow(_size, true, _file, _line, (size_t)_align);
+}
+void operator delete(void *_ptr, std::align_val_t _align) noexcept {
+    DeleteMemory(_ptr, false, _unknown_size, (size_t)_align);
+}
+void operator delete[](void *_ptr, std::align_val_t _align) noexcept {
+    DeleteMemory(_ptr, true, _unknown_size, (size_t)_align);
+}
+void operator delete(void *_ptr, size_t _size, std::align_val_t _align) noexcept {
+    DeleteMemory(_ptr, false, _size, (size_t)_align);
+}
+void operator delete[](void *_ptr, size_t _size, std::align_val_t _align) noexcept {
+    DeleteMemory(_ptr, true, _size, (size_t)_align);
+}
+void operator delete(void *_ptr, std::align_val_t _align, const std::nothrow_t&) noexcept {
+    DeleteMemory(_ptr, false, _unknown_size, (size_t)_align);
+}
+void operator delete[](void *_ptr, std::align_val_t _align, const std::nothrow_t&) noexcept {
+    DeleteMemory(_ptr, true, _unknown_size, (size_t)_align);
+}
+#endif
+
+/*
+ * ---- Leak roots and cycles ----
+ * A conservative scan of the leaked blocks: every aligned word inside a block
+ * which points into another leaked block (interior pointers included) is an
+ * edge. The strongly connected components of this graph are cycles, such as
+ * two objects holding 'shared_ptr's to each other, and a component no other
+ * component points to is a root. Every other block is held by a root, so
+ * only the roots are reported
+*/
+static std::atomic<bool> _report_cycles(false);
+
+typedef struct _LeakNode {
+    _MemoryList     *elem;
+    const char      *begin;     // The block, [begin, end)
+    const char      *end;
+    size_t          firstEdge;  // Edges of this node are [firstEdge, next node's firstEdge)
+    unsigned int    component;
+    unsigned int    index;      // Tarjan's visiting order, 0 if not visited
+    unsigned int    low;
+    bool            onStack;
+} _LeakNode;
+
+static int CompareNodes(const void *_a, const void *_b) {
+    const char *a = ((const _LeakNode*)_a)->begin;
+    const char *b = ((const _LeakNode*)_b)->begin;
+    return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+// Binary search for the block containing the address, -1 if there is none
+static long FindNode(const _LeakNode *_nodes, size_t _n, const char *_address) {
+    size_t lo = 0, hi = _n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_nodes[mid].end <= _address) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < _n && _nodes[lo].begin <= _address && _address < _nodes[lo].end) return (long)lo;
+    return -1;
+}
+
+static bool PushEdge(unsigned int **_edges, size_t *_count, size_t *_capacity, unsigned int _to) {
+    if (*_count == *_capacity) {
+        size_t newCapacity = *_capacity ? *_capacity * 2 : 1024;
+        unsigned int *newEdges = (unsigned int*)realloc(*_edges, newCapacity * sizeof(unsigned int));
+        if (!newEdges) return false;
+        *_edges = newEdges;
+        *_capacity = newCapacity;
+    }
+    (*_edges)[(*_count)++] = _to;
+    return true;
+}
+
+/*
+ * Tarjan's algorithm without recursion, a leaked list can be far deeper than
+ * the stack. Returns the number of components
+*/
+static unsigned int FindComponents(_LeakNode *_nodes, size_t _n, const unsigned int *_edges, size_t _edgeCount) {
+    unsigned int *stack = (unsigned int*)malloc(_n * sizeof(unsigned int));
+    unsigned int *calls = (unsigned int*)malloc(_n * sizeof(unsigned int));
+    size_t *next = (size_t*)malloc(_n * sizeof(size_t));
+    if (!stack || !calls || !next) {
+        free(stack);
+        free(calls);
+        free(next);
+        return 0;
+    }
+    unsigned int order = 0, components = 0;
+    size_t stackSize = 0;
+    for (size_t start = 0; start < _n; ++start) {
+        if (_nodes[start].index) continue;
+        size_t depth = 0;
+        calls[depth++] = (unsigned int)start;
+        _nodes[start].index = _nodes[start].low = ++order;
+        _nodes[start].onStack = true;
+        stack[stackSize++] = (unsigned int)start;
+        next[start] = _nodes[start].firstEdge;
+        while (depth) {
+            unsigned int v = calls[depth - 1];
+            size_t last = v + 1 < _n ? _nodes[v + 1].firstEdge : _edgeCount;
+            if (next[v] < last) {
+                unsigned int w = _edges[next[v]++];
+                if (!_nodes[w].index) {
+                    _nodes[w].index = _nodes[w].low = ++order;
+                    _nodes[w].onStack = true;
+                    stack[stackSize++] = w;
+                    next[w] = _nodes[w].firstEdge;
+                    calls[depth++] = w;
+                } else if (_nodes[w].onStack && _nodes[w].index < _nodes[v].low) {
+                    _nodes[v].low = _nodes[w].index;
+                }
+                continue;
+            }
+            // All edges of v are done
+            if (_nodes[v].low == _nodes[v].index) {
+                unsigned int w;
+                do {
+                    w = stack[--stackSize];
+                    _nodes[w].onStack = false;
+                    _nodes[w].component = components;
+                } while (w != v);
+                ++components;
+            }
+            --depth;
+            if (depth && _nodes[v].low < _nodes[calls[depth - 1]].low)
+                _nodes[calls[depth - 1]].low = _nodes[v].low;
+        }
+    }
+    free(stack);
+    free(calls);
+    free(next);
+    return components;
+}
+
+typedef struct _LeakComponent {
+    unsigned long   count;      // Blocks in the component
+    unsigned long   size;
+    unsigned long   heldCount;  // Blocks held by the component, itself included
+    unsigned long   heldSize;
+    unsigned int    owner;      // Root holding this component
+    unsigned int    first;      // A node of the component, used for its position
+    bool            cyclic;
+    bool            root;
+    bool            visited;
+} _LeakComponent;
+
+/*
+ * One root as the report prints it, copied out of the scan so that the
+ * report is printed after '_memory_lock' is released
+*/
+typedef struct _LeakRoot {
+    unsigned long   count;      // Blocks in the root's component
+    unsigned long   size;
+    unsigned long   heldCount;  // Blocks held by the root, itself included
+    unsigned long   heldSize;
+    char            *file;      // Copy of the position of a block, NULL if it is unknown
+    unsigned int    line;
+    bool            cyclic;
+} _LeakRoot;
+
+typedef struct _LeakRootList {
+    _LeakRoot       *roots;
+    unsigned long   rootCount;
+    unsigned long   cycles;
+    unsigned long   blocks;     // All leaked blocks
+    unsigned long   size;
+} _LeakRootList;
+
+/*
+ * Find the roots of the leaked blocks, so that they are reported instead of
+ * every block. Called with '_memory_lock' held, only uses malloc. Returns
+ * false if the memory for the scan runs out
+*/
+static bool CollectRoots(_LeakRootList *_list) {
+    size_t n = _memory_blocks;
+    if (!n) return false;
+    _LeakNode *nodes = (_LeakNode*)calloc(n, sizeof(_LeakNode));
+    if (!nodes) return false;
+    size_t i = 0;
+    for (_MemoryList *ptr = _root.next; ptr != &_root && i < n; ptr = ptr->next, ++i) {
+        nodes[i].elem = ptr;
+        nodes[i].begin = (const char*)ptr + sizeof(_MemoryList);
+        // An empty block is still pointed to by its address
+        nodes[i].end = nodes[i].begin + (ptr->size ? ptr->size : 1);
+    }
+    n = i;
+    qsort(nodes, n, sizeof(_LeakNode), CompareNodes);
+
+    // Scan every block for pointers into the other blocks
+    unsigned int *edges = NULL;
+    size_t edgeCount = 0, edgeCapacity = 0;
+    bool complete = true;
+    for (i = 0; i < n && complete; ++i) {
+        nodes[i].firstEdge = edgeCount;
+        const char *word = nodes[i].begin;
+        for (; word + sizeof(void*) <= nodes[i].begin + nodes[i].elem->size; word += sizeof(void*)) {
+            const char *value;
+            memcpy(&value, word, sizeof(value));
+            long to = FindNode(nodes, n, value);
+            if (to < 0) continue;
+            // The same target twice in a row is common, e.g. the object and control block of a 'shared_ptr'
+            if (edgeCount > nodes[i].firstEdge && edges[edgeCount - 1] == (unsigned int)to) continue;
+            if (!PushEdge(&edges, &edgeCount, &edgeCapacity, (unsigned int)to)) complete = false;
+        }
+    }
+    unsigned int componentCount = complete ? FindComponents(nodes, n, edges, edgeCount) : 0;
+    _LeakComponent *components = componentCount ? (_LeakComponent*)calloc(componentCount, sizeof(_LeakComponent)) : NULL;
+    unsigned int *queue = components ? (unsigned int*)malloc(n * sizeof(unsigned int)) : NULL;
+    unsigned int *members = queue ? (unsigned int*)malloc(n * sizeof(unsigned int)) : NULL;
+    unsigned int *memberStart = members ? (unsigned int*)calloc(componentCount + 1, sizeof(unsigned int)) : NULL;
+    _LeakRoot *roots = memberStart ? (_LeakRoot*)calloc(componentCount, sizeof(_LeakRoot)) : NULL;
+    if (!roots) {
+        free(memberStart);
+        free(members);
+        free(queue);
+        free(components);
+        free(edges);
+        free(nodes);
+        return false;
+    }
+
+    for (i = 0; i < componentCount; ++i) components[i].root = true;
+    for (i = 0; i < n; ++i) {
+        _LeakComponent &c = components[nodes[i].component];
+        if (!c.count) c.first = (unsigned int)i;
+        ++c.count;
+        c.size += nodes[i].elem->size;
+        size_t last = i + 1 < n ? nodes[i + 1].firstEdge : edgeCount;
+        for (size_t e = nodes[i].firstEdge; e < last; ++e) {
+            unsigned int to = nodes[edges[e]].component;
+            if (to == nodes[i].component) c.cyclic = true;
+            else components[to].root = false;
+        }
+    }
+    for (i = 0; i < componentCount; ++i) {
+        if (components[i].count > 1) components[i].cyclic = true;
+    }
+    // Nodes grouped by component, those of component c are [memberStart[c], memberStart[c + 1])
+    for (i = 0; i < componentCount; ++i) memberStart[i + 1] = memberStart[i] + (unsigned int)components[i].count;
+    for (i = 0; i < n; ++i) members[memberStart[nodes[i].component] + components[nodes[i].component].heldCount++] = (unsigned int)i;
+    for (i = 0; i < componentCount; ++i) components[i].heldCount = 0;
+
+    // Every component is held by the first root reaching it, so each block is counted once
+    for (unsigned int r = 0; r < componentCount; ++r) {
+        if (!components[r].root) continue;
+        size_t head = 0, tail = 0;
+        for (i = memberStart[r]; i < memberStart[r + 1]; ++i) queue[tail++] = members[i];
+        components[r].visited = true;
+        while (head < tail) {
+            unsigned int v = queue[head++];
+            components[r].heldCount++;
+            components[r].heldSize += nodes[v].elem->size;
+            size_t last = v + 1 < n ? nodes[v + 1].firstEdge : edgeCount;
+            for (size_t e = nodes[v].firstEdge; e < last; ++e) {
+                unsigned int c = nodes[edges[e]].component;
+                if (components[c].visited) continue;
+                components[c].visited = true;
+                components[c].owner = r;
+                for (size_t k = memberStart[c]; k < memberStart[c + 1]; ++k) queue[tail++] = members[k];
+            }
+        }
+    }
+
+    _list->roots = roots;
+    _list->rootCount = _list->cycles = _list->size = 0;
+    _list->blocks = n;
+    for (unsigned int r = 0; r < componentCount; ++r) {
+        const _LeakComponent &c = components[r];
+        _list->size += c.size;
+        if (!c.root) continue;
+        if (c.cyclic) ++_list->cycles;
+        const _MemoryList *elem = nodes[c.first].elem;
+        _LeakRoot &root = roots[_list->rootCount++];
+        root.count = c.count;
+        root.size = c.size;
+        root.heldCount = c.heldCount;
+        root.heldSize = c.heldSize;
+        root.file = NULL;
+        if (elem->file) {
+            root.file = (char *)malloc(strlen(elem->file) + 1);
+            if (root.file) strcpy(root.file, elem->file);
+        }
+        root.line = elem->line;
+        root.cyclic = c.cyclic;
+    }
+
+    free(memberStart);
+    free(members);
+    free(queue);
+    free(components);
+    free(edges);
+    free(nodes);
+    return true;
+}
+
+/*
+ * Print the roots found by 'CollectRoots()' and release them. Called
+ * without '_memory_lock', the stream may apply memory itself
+*/
+static void PrintRoots(_LeakRootList *_list) {
+    for (unsigned long i = 0; i < _list->rootCount; ++i) {
+        const _LeakRoot &root = _list->roots[i];
+        std::cout << (root.cyclic ? "leak cycle " : "leak root ") << root.count << " blocks size " << root.size;
+        if (root.heldCount > root.count) std::cout << " holding " << root.heldCount << " blocks size " << root.heldSize;
+        if (root.file) std::cout << " (located in " << root.file << " line " << root.line << ")";
+        else std::cout << " (Cannot find position)";
+        std::cout << std::endl;
+        free(root.file);
+    }
+    std::cout << "Total " << _list->blocks << " leaks in " << _list->rootCount << " roots (" << _list->cycles
+              << " cycles), size is " << _list->size << " bytes." << std::endl;
+    free(_list->roots);
+    _list->roots = NULL;
+}
+
+void _leak_detector::reportCycles(bool enable) noexcept {
+    _report_cycles.store(enable);
+}
+
+/*
+ * One leaked block as the exit report prints it, copied out of '_root' so
+ * that the report is printed after '_memory_lock' is released
+*/
+typedef struct _LeakRecord {
+    const void      *address;
+    size_t          size;
+    char            *file;      // Copy of the file, NULL if position is unknown
+    unsigned int    line;
+    bool            isArray;
+} _LeakRecord;
 
 /*
  * '_leak_detector::LeakDetector()' will be called when destruct the 
@@ -114,23 +675,495 @@ void operator delete[](void *_ptr) noexcept {
  * we will get the result
 */
 unsigned int _leak_detector::LeakDetector(void) noexcept {
+    stopTimeline();
+    stopGuardSweep();
+    std::unique_lock<std::mutex> guard(_memory_lock);
     unsigned int count = 0;
+    const char *cycles = getenv("LEAK_DETECTOR_CYCLES");
+    if (cycles && *cycles && strcmp(cycles, "0") != 0) _report_cycles.store(true);
+    _LeakRootList roots;
+    // Fall back to every block if the scan could not run
+    if (_report_cycles.load() && _memory_blocks && CollectRoots(&roots)) {
+        guard.unlock();
+        PrintRoots(&roots);
+        const char *path = getenv(LEAK_REPORT_ENV);
+        if (path && *path) dump(path);
+        return (unsigned int)roots.blocks;
+    }
     // Traverse the whole list. If there exists the memory leaking, then
-    // '_LeakRoot' will always not point to itself
+    // '_LeakRoot' will always not point to itself. The blocks are copied
+    // with malloc under the lock, and printed outside of it, the stream may
+    // apply memory itself
+    unsigned long allocated = _memory_allocated;
+    size_t blocks = _memory_blocks;
+    _LeakRecord *records = blocks ? (_LeakRecord*)malloc(blocks * sizeof(_LeakRecord)) : NULL;
+    size_t copied = 0;
     _MemoryList *ptr = _root.next;
     while (ptr && ptr != &_root) {
+        if (records && copied < blocks) {
+            _LeakRecord &record = records[copied++];
+            record.address = ptr;
+            record.size = ptr->size;
+            record.file = NULL;
+            if (ptr->file) {
+                record.file = (char *)malloc(strlen(ptr->file) + 1);
+                if (record.file) strcpy(record.file, ptr->file);
+            }
+            record.line = ptr->line;
+            record.isArray = ptr->isArray;
+        }
+        ++count;
+        ptr = ptr->next;
+    }
+    guard.unlock();
+
+    for (size_t i = 0; i < copied; ++i) {
         // Print the message of the memory leaking, such as size or position
-        if (ptr->isArray) std::cout << "leak[] ";
+        const _LeakRecord &record = records[i];
+        if (record.isArray) std::cout << "leak[] ";
         else std::cout << "leak ";
-        std::cout << ptr << " size " << ptr->size;
-        if (ptr->file) std::cout << " (located in " << ptr->file << " line " << ptr->line << ")";
+        std::cout << record.address << " size " << record.size;
+        if (record.file) std::cout << " (located in " << record.file << " line " << record.line << ")";
         else std::cout << " (Cannot find position)";
         std::cout << std::endl;
-        ++count;
-        ptr = ptr->next;
+        free(record.file);
     }
+    free(records);
     if (count) {
-        std::cout << "Total " << count << " leaks, size is " << _memory_allocated << " bytes." << std::endl;
+        std::cout << "Total " << count << " leaks, size is " << allocated << " bytes." << std::endl;
     }
+
+    // Also leave the machine-readable report if it is asked for
+    const char *path = getenv(LEAK_REPORT_ENV);
+    if (path && *path) dump(path);
     return count;
-}
\ No newline at end of file
+}
+
+/*
+ * Blocks grouped by the position applying them, so that a report lists
+ * every position once instead of every block
+*/
+typedef struct _MemorySite {
+    char          *file;    // Copy of the file, NULL if position is unknown
+    unsigned int  line;
+    unsigned long count;    // Number of blocks applied here
+    unsigned long size;     // Total size of these blocks
+} _MemorySite;
+
+typedef struct _MemorySiteTable {
+    _MemorySite *sites;     // Open addressing hash table, capacity is a power of 2
+    size_t      capacity;
+    size_t      used;
+} _MemorySiteTable;
+
+static size_t HashSite(const char *_file, unsigned int _line) {
+    size_t hash = _line;
+    if (_file) {
+        for (const char *c = _file; *c; ++c) hash = hash * 31 + (unsigned char)*c;
+    }
+    return hash;
+}
+
+static bool SameSite(const _MemorySite *_site, const char *_file, unsigned int _line) {
+    if (_site->line != _line) return false;
+    if (!_site->file || !_file) return _site->file == _file;
+    return strcmp(_site->file, _file) == 0;
+}
+
+/*
+ * Find the site of the position in the table, insert it if it is not there.
+ * The table only uses malloc, so it can be filled while '_memory_lock' is held.
+ * Returns NULL if the memory runs out
+*/
+static _MemorySite* FindSite(_MemorySiteTable *_table, const char *_file, unsigned int _line) {
+    // Keep the table at most half full
+    if ((_table->used + 1) * 2 > _table->capacity) {
+        size_t newCapacity = _table->capacity ? _table->capacity * 2 : 64;
+        _MemorySite *newSites = (_MemorySite*)calloc(newCapacity, sizeof(_MemorySite));
+        if (!newSites) return NULL;
+        for (size_t i = 0; i < _table->capacity; ++i) {
+            _MemorySite *site = &_table->sites[i];
+            if (!site->count) continue;
+            size_t j = HashSite(site->file, site->line) & (newCapacity - 1);
+            while (newSites[j].count) j = (j + 1) & (newCapacity - 1);
+            newSites[j] = *site;
+        }
+        free(_table->sites);
+        _table->sites = newSites;
+        _table->capacity = newCapacity;
+    }
+
+    // Linear probing, an empty slot has no blocks
+    size_t i = HashSite(_file, _line) & (_table->capacity - 1);
+    while (_table->sites[i].count) {
+        if (SameSite(&_table->sites[i], _file, _line)) return &_table->sites[i];
+        i = (i + 1) & (_table->capacity - 1);
+    }
+
+    _MemorySite *site = &_table->sites[i];
+    site->file = NULL;
+    if (_file) {
+        site->file = (char *)malloc(strlen(_file) + 1);
+        if (!site->file) return NULL;
+        strcpy(site->file, _file);
+    }
+    site->line = _line;
+    ++_table->used;
+    return site;
+}
+
+static int CompareSites(const void *_a, const void *_b) {
+    const _MemorySite *a = (const _MemorySite*)_a;
+    const _MemorySite *b = (const _MemorySite*)_b;
+    if (a->size != b->size) return a->size > b->size ? -1 : 1;
+    return a->count > b->count ? -1 : (a->count < b->count ? 1 : 0);
+}
+
+/*
+ * Move the sites to the front of the table and sort them, the largest first.
+ * The table can no longer be searched afterwards. Returns the number of sites
+*/
+static size_t SortSites(_MemorySiteTable *_table) {
+    size_t n = 0;
+    for (size_t i = 0; i < _table->capacity; ++i) {
+        if (!_table->sites[i].count) continue;
+        _table->sites[n] = _table->sites[i];
+        if (i != n) _table->sites[i].count = 0;
+        ++n;
+    }
+    if (n) qsort(_table->sites, n, sizeof(_MemorySite), CompareSites);
+    return n;
+}
+
+static void FreeSites(_MemorySiteTable *_table) {
+    for (size_t i = 0; i < _table->capacity; ++i) {
+        if (_table->sites[i].count) free(_table->sites[i].file);
+    }
+    free(_table->sites);
+    _table->sites = NULL;
+    _table->capacity = _table->used = 0;
+}
+
+/*
+ * Group the unreleasing blocks whose sequence number falls in (_from, _to]
+ * by their position. Only the grouping happens under '_memory_lock', the
+ * formatting is left to the caller
+*/
+static void CollectSites(_MemorySiteTable *_table, unsigned long _from, unsigned long _to,
+                         unsigned long *_count, unsigned long *_size) {
+    std::lock_guard<std::mutex> guard(_memory_lock);
+    // The newest blocks are at the head of the list
+    for (_MemoryList *ptr = _root.next; ptr != &_root; ptr = ptr->next) {
+        if (ptr->sequence <= _from || ptr->sequence > _to) continue;
+        _MemorySite *site = FindSite(_table, ptr->file, ptr->line);
+        if (!site) continue;
+        ++site->count;
+        site->size += ptr->size;
+        ++*_count;
+        *_size += ptr->size;
+    }
+}
+
+/*
+ * Snapshot only records where the allocation history is. The blocks are
+ * not copied, so it is cheap enough to take one for every request
+*/
+_leak_snapshot _leak_detector::snapshot() noexcept {
+    std::lock_guard<std::mutex> guard(_memory_lock);
+    _leak_snapshot result = { _memory_sequence, _memory_allocated, _memory_blocks };
+    return result;
+}
+
+unsigned int _leak_detector::diff(const _leak_snapshot &a, const _leak_snapshot &b) noexcept {
+    return diff(a, b, std::cout);
+}
+
+/*
+ * Every block carries the sequence number of its applying, so the blocks
+ * applied between two snapshots are the ones whose sequence number falls in
+ * (a.sequence, b.sequence]. Blocks released before the diff are no longer
+ * in '_root', so only the growth is left
+*/
+unsigned int _leak_detector::diff(const _leak_snapshot &a, const _leak_snapshot &b, std::ostream &os) noexcept {
+    unsigned long from = a.sequence < b.sequence ? a.sequence : b.sequence;
+    unsigned long to = a.sequence < b.sequence ? b.sequence : a.sequence;
+    _MemorySiteTable table = { NULL, 0, 0 };
+    unsigned long count = 0, size = 0;
+    CollectSites(&table, from, to, &count, &size);
+
+    // Print outside of the lock, the stream may apply memory itself
+    size_t sites = SortSites(&table);
+    for (size_t i = 0; i < sites; ++i) {
+        const _MemorySite *site = &table.sites[i];
+        os << "growth " << site->count << " blocks size " << site->size;
+        if (site->file) os << " (located in " << site->file << " line " << site->line << ")";
+        else os << " (Cannot find position)";
+        os << std::endl;
+    }
+    if (count) {
+        os << "Total " << count << " new blocks in " << sites << " positions, size is " << size << " bytes." << std::endl;
+    }
+    FreeSites(&table);
+    return (unsigned int)count;
+}
+
+/*
+ * One JSON object per line: a summary, then one record for every position
+ * still holding memory, the largest first
+*/
+bool _leak_detector::dump(const char *path) noexcept {
+    _MemorySiteTable table = { NULL, 0, 0 };
+    unsigned long count = 0, size = 0;
+    CollectSites(&table, 0, (unsigned long)-1, &count, &size);
+    size_t sites = SortSites(&table);
+
+    _LeakReport report;
+    bool opened = OpenReport(&report, path);
+    if (opened) {
+        ReportAppend(&report, "{\"kind\":\"summary\",\"pid\":");
+        ReportNumber(&report, (unsigned long)getpid());
+        ReportAppend(&report, ",\"count\":");
+        ReportNumber(&report, count);
+        ReportAppend(&report, ",\"bytes\":");
+        ReportNumber(&report, size);
+        ReportAppend(&report, ",\"sites\":");
+        ReportNumber(&report, sites);
+        ReportAppend(&report, "}\n");
+        for (size_t i = 0; i < sites; ++i) {
+            const _MemorySite *site = &table.sites[i];
+            ReportAppend(&report, "{\"kind\":\"leak\",\"file\":");
+            ReportString(&report, site->file);
+            ReportAppend(&report, ",\"line\":");
+            ReportNumber(&report, site->line);
+            ReportAppend(&report, ",\"count\":");
+            ReportNumber(&report, site->count);
+            ReportAppend(&report, ",\"bytes\":");
+            ReportNumber(&report, site->size);
+            ReportAppend(&report, "}\n");
+        }
+        CloseReport(&report);
+    }
+    FreeSites(&table);
+    return opened;
+}
+
+/*
+ * ---- Heap timeline ----
+ * A sampler thread records '_memory_allocated', the number of unreleasing
+ * blocks and the applying rate into a ring buffer at a fixed interval. The
+ * sampler is the only writer. Every sample carries its own sequence number,
+ * odd while it is being written, so a reader (even a signal handler which
+ * interrupts the sampler) skips the samples which are torn instead of waiting
+*/
+typedef struct _TimelineSample {
+    std::atomic<unsigned long> sequence;    // 2 * index + 2 once the sample is complete
+    std::atomic<unsigned long> time;        // Milliseconds since the timeline started
+    std::atomic<unsigned long> allocated;   // Size of unreleasing memory
+    std::atomic<unsigned long> blocks;      // Number of unreleasing blocks
+    std::atomic<unsigned long> rate;        // Applyings per second since the previous sample
+} _TimelineSample;
+
+static const unsigned long _TIMELINE_SIZE = 4096;
+static _TimelineSample _timeline[_TIMELINE_SIZE];
+static std::atomic<unsigned long> _timeline_head(0);    // Number of samples ever written
+static std::atomic<bool> _timeline_running(false);
+static unsigned int _timeline_interval = 0;             // Milliseconds
+static const char *_timeline_path = NULL;               // Where SIGUSR2 dumps the ring, NULL for stderr
+static pthread_t _timeline_thread;
+
+static unsigned long MonotonicMs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000 + (unsigned long)now.tv_nsec / 1000000;
+}
+
+/*
+ * The sampler is a plain pthread rather than a std::thread, whose state would
+ * be applied by the overloaded new and reported as a leak
+*/
+static void* TimelineSampler(void*) {
+    unsigned long start = MonotonicMs();
+    unsigned long lastTime = start, lastSequence = 0;
+    {
+        std::lock_guard<std::mutex> guard(_memory_lock);
+        lastSequence = _memory_sequence;
+    }
+
+    while (_timeline_running.load(std::memory_order_acquire)) {
+        struct timespec interval;
+        interval.tv_sec = _timeline_interval / 1000;
+        interval.tv_nsec = (long)(_timeline_interval % 1000) * 1000000;
+        nanosleep(&interval, NULL);
+
+        unsigned long allocated, blocks, sequence;
+        {
+            std::lock_guard<std::mutex> guard(_memory_lock);
+            allocated = _memory_allocated;
+            blocks = _memory_blocks;
+            sequence = _memory_sequence;
+        }
+        unsigned long now = MonotonicMs();
+        unsigned long elapsed = now > lastTime ? now - lastTime : 1;
+
+        unsigned long index = _timeline_head.load(std::memory_order_relaxed);
+        _TimelineSample &sample = _timeline[index % _TIMELINE_SIZE];
+        sample.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        sample.time.store(now - start, std::memory_order_relaxed);
+        sample.allocated.store(allocated, std::memory_order_relaxed);
+        sample.blocks.store(blocks, std::memory_order_relaxed);
+        sample.rate.store((sequence - lastSequence) * 1000 / elapsed, std::memory_order_relaxed);
+        sample.sequence.store(2 * index + 2, std::memory_order_release);
+        _timeline_head.store(index + 1, std::memory_order_release);
+
+        lastTime = now;
+        lastSequence = sequence;
+    }
+    return NULL;
+}
+
+static void TimelineSignal(int) {
+    int saved = errno;
+    _leak_detector::dumpTimeline(_timeline_path);
+    errno = saved;
+}
+
+bool _leak_detector::startTimeline(unsigned int intervalMs, const char *path) noexcept {
+    if (!intervalMs || _timeline_running.exchange(true)) return false;
+    _timeline_interval = intervalMs;
+    _timeline_path = path;
+    if (pthread_create(&_timeline_thread, NULL, TimelineSampler, NULL)) {
+        _timeline_running.store(false);
+        return false;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = TimelineSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, NULL);
+    return true;
+}
+
+void _leak_detector::stopTimeline() noexcept {
+    if (!_timeline_running.exchange(false)) return;
+    pthread_join(_timeline_thread, NULL);
+}
+
+/*
+ * Only uses the ring and the report writer, both never block and never
+ * apply memory, so it can be called from the SIGUSR2 handler
+*/
+bool _leak_detector::dumpTimeline(const char *path) noexcept {
+    _LeakReport report;
+    if (!path) OpenReport(&report, STDERR_FILENO);
+    else if (!OpenReport(&report, path)) return false;
+
+    unsigned long head = _timeline_head.load(std::memory_order_acquire);
+    unsigned long first = head > _TIMELINE_SIZE ? head - _TIMELINE_SIZE : 0;
+    for (unsigned long index = first; index < head; ++index) {
+        _TimelineSample &sample = _timeline[index % _TIMELINE_SIZE];
+        unsigned long before = sample.sequence.load(std::memory_order_acquire);
+        unsigned long time = sample.time.load(std::memory_order_relaxed);
+        unsigned long allocated = sample.allocated.load(std::memory_order_relaxed);
+        unsigned long blocks = sample.blocks.load(std::memory_order_relaxed);
+        unsigned long rate = sample.rate.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // Overwritten by the sampler meanwhile
+        if (before != 2 * index + 2 || sample.sequence.load(std::memory_order_relaxed) != before) continue;
+
+        ReportAppend(&report, "{\"kind\":\"sample\",\"time_ms\":");
+        ReportNumber(&report, time);
+        ReportAppend(&report, ",\"bytes\":");
+        ReportNumber(&report, allocated);
+        ReportAppend(&report, ",\"blocks\":");
+        ReportNumber(&report, blocks);
+        ReportAppend(&report, ",\"rate\":");
+        ReportNumber(&report, rate);
+        ReportAppend(&report, "}\n");
+    }
+    CloseReport(&report);
+    return true;
+}
+
+/*
+ * Start the timeline before main() if LEAK_DETECTOR_TIMELINE_MS is set,
+ * LEAK_DETECTOR_TIMELINE optionally names the file SIGUSR2 dumps it to
+*/
+static struct _TimelineAutoStart {
+    _TimelineAutoStart() noexcept {
+        const char *interval = getenv("LEAK_DETECTOR_TIMELINE_MS");
+        if (interval && atoi(interval) > 0)
+            _leak_detector::startTimeline((unsigned int)atoi(interval), getenv("LEAK_DETECTOR_TIMELINE"));
+    }
+} _timeline_auto_start;
+
+
+/*
+ * ---- Overflow guard settings and sweep ----
+*/
+void _leak_detector::setGuard(GuardMode mode, size_t pageMin) noexcept {
+    _guard_page_min = pageMin;
+    _guard_mode.store(mode, std::memory_order_relaxed);
+}
+
+unsigned int _leak_detector::checkGuards() noexcept {
+    std::lock_guard<std::mutex> guard(_memory_lock);
+    unsigned int count = 0;
+    for (_MemoryList *ptr = _root.next; ptr != &_root; ptr = ptr->next) {
+        if (ptr->guard && !CheckCanary(ptr)) {
+            ReportOverflow(ptr);
+            ++count;
+        }
+    }
+    return count;
+}
+
+static std::atomic<bool> _sweep_running(false);
+static unsigned int _sweep_interval = 0;    // Milliseconds
+static pthread_t _sweep_thread;
+
+static void* GuardSweeper(void*) {
+    while (_sweep_running.load(std::memory_order_acquire)) {
+        struct timespec interval;
+        interval.tv_sec = _sweep_interval / 1000;
+        interval.tv_nsec = (long)(_sweep_interval % 1000) * 1000000;
+        nanosleep(&interval, NULL);
+        _leak_detector::checkGuards();
+    }
+    return NULL;
+}
+
+bool _leak_detector::startGuardSweep(unsigned int intervalMs) noexcept {
+    if (!intervalMs || _sweep_running.exchange(true)) return false;
+    _sweep_interval = intervalMs;
+    if (pthread_create(&_sweep_thread, NULL, GuardSweeper, NULL)) {
+        _sweep_running.store(false);
+        return false;
+    }
+    return true;
+}
+
+void _leak_detector::stopGuardSweep() noexcept {
+    if (!_sweep_running.exchange(false)) return;
+    pthread_join(_sweep_thread, NULL);
+}
+
+/*
+ * LEAK_DETECTOR_GUARD=canary|page picks the mode before main(),
+ * LEAK_DETECTOR_GUARD_PAGE_MIN the smallest block given its own pages and
+ * LEAK_DETECTOR_GUARD_SWEEP_MS the interval of the sweep
+*/
+static struct _GuardAutoStart {
+    _GuardAutoStart() noexcept {
+        const char *mode = getenv("LEAK_DETECTOR_GUARD");
+        if (!mode) return;
+        const char *pageMin = getenv("LEAK_DETECTOR_GUARD_PAGE_MIN");
+        size_t minimum = pageMin && atol(pageMin) > 0 ? (size_t)atol(pageMin) : 4096;
+        if (strcmp(mode, "canary") == 0) _leak_detector::setGuard(_leak_detector::GUARD_CANARY, minimum);
+        else if (strcmp(mode, "page") == 0) _leak_detector::setGuard(_leak_detector::GUARD_PAGE, minimum);
+        const char *sweep = getenv("LEAK_DETECTOR_GUARD_SWEEP_MS");
+        if (sweep && atoi(sweep) > 0) _leak_detector::startGuardSweep((unsigned int)atoi(sweep));
+    }
+} _guard_auto_start;
\ No newline at end of file
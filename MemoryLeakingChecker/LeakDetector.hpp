@@ -1,13 +1,34 @@
 #ifndef __LEAK_DETECTOR__
 #define __LEAK_DETECTOR__
 
+#include <cstddef>
+#include <iosfwd>
+#include <new>
+
 void* operator new(size_t _size, char *_file, unsigned int _line);
 void* operator new[](size_t _size, char *_file, unsigned int _line);
 
+#ifdef __cpp_aligned_new
+// Over-aligned types under the 'new' macro below, so that they keep their alignment
+void* operator new(size_t _size, std::align_val_t _align, char *_file, unsigned int _line);
+void* operator new[](size_t _size, std::align_val_t _align, char *_file, unsigned int _line);
+#endif
+
 #ifndef __NEW_OVERLOAD_IMPLEMENTATION__
 #define new    new(__FILE__, __LINE__)
 #endif
 
+/*
+ * A point in the allocation history of the process, taken by
+ * '_leak_detector::snapshot()'. Two snapshots bracket the allocations
+ * which '_leak_detector::diff()' reports.
+*/
+struct _leak_snapshot {
+    unsigned long sequence;     // Sequence number of the last allocation before the snapshot
+    unsigned long allocated;    // Size of unreleasing memory at the snapshot
+    unsigned long blocks;       // Number of unreleasing blocks at the snapshot
+};
+
 class _leak_detector {
 public:
     // callCount to make sure we only call it once
@@ -21,6 +42,60 @@ public:
         if (--callCount == 0) LeakDetector();
     }
 
+    // Take a snapshot of the heap. It can be called at any time while
+    // the process is running, from any thread
+    static _leak_snapshot snapshot() noexcept;
+
+    // Print the blocks which were allocated between the snapshots 'a' and 'b'
+    // and are still not released, grouped by the file and line applying them.
+    // Returns the number of such blocks
+    static unsigned int diff(const _leak_snapshot &a, const _leak_snapshot &b) noexcept;
+    static unsigned int diff(const _leak_snapshot &a, const _leak_snapshot &b, std::ostream &os) noexcept;
+
+    // Write the unreleasing blocks grouped by position to the path as JSON lines,
+    // "%p" in the path is replaced by the process id. Also done at exit when the
+    // environment variable LEAK_DETECTOR_REPORT holds a path. Returns false if
+    // the path cannot be opened
+    static bool dump(const char *path) noexcept;
+
+    // Sample the size of unreleasing memory, the number of unreleasing blocks
+    // and the applying rate every intervalMs milliseconds into a ring buffer.
+    // SIGUSR2 then dumps the ring to the path as JSON lines, or to stderr if the
+    // path is NULL. Also started before main() when the environment variable
+    // LEAK_DETECTOR_TIMELINE_MS holds the interval
+    static bool startTimeline(unsigned int intervalMs, const char *path = NULL) noexcept;
+    static void stopTimeline() noexcept;
+
+    // Write the samples in the ring, the oldest first. Safe in a signal handler
+    static bool dumpTimeline(const char *path) noexcept;
+
+    // Overflow checking of the blocks applied from now on, the cost grows with the mode:
+    //   GUARD_NONE    nothing is checked
+    //   GUARD_CANARY  a canary behind every block, checked when the block is released
+    //                 and by checkGuards()
+    //   GUARD_PAGE    as GUARD_CANARY, but blocks of at least 'pageMin' bytes end right
+    //                 before an inaccessible page, so that overflowing them crashes at once.
+    //                 Only the padding of a size not a multiple of the alignment holds a
+    //                 canary, so overruns into it are reported at release or by checkGuards()
+    // Also set before main() by the environment variable LEAK_DETECTOR_GUARD=canary|page
+    enum GuardMode { GUARD_NONE = 0, GUARD_CANARY, GUARD_PAGE };
+    static void setGuard(GuardMode mode, size_t pageMin = 4096) noexcept;
+
+    // Check the canaries of all unreleasing blocks and print the overflowed ones
+    // to stderr. Returns the number of overflowed blocks
+    static unsigned int checkGuards() noexcept;
+
+    // Run checkGuards() every intervalMs milliseconds in a background thread.
+    // Also started before main() by LEAK_DETECTOR_GUARD_SWEEP_MS
+    static bool startGuardSweep(unsigned int intervalMs) noexcept;
+    static void stopGuardSweep() noexcept;
+
+    // Scan the leaked blocks for pointers to each other at exit, and report
+    // one root for every group of blocks held by it, with cycles (such as
+    // 'shared_ptr's holding each other) as one root, instead of every block.
+    // Also turned on by the environment variable LEAK_DETECTOR_CYCLES=1
+    static void reportCycles(bool enable) noexcept;
+
 private:
     static unsigned int LeakDetector() noexcept;
 };
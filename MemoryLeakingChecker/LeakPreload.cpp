@@ -0,0 +1,610 @@
+/*
+ * LD_PRELOAD build of the memory leaking checker
+ *
+ * 'LeakDetector.cpp' needs the program to be recompiled with the 'new' macro
+ * of 'LeakDetector.hpp'. This file is built as a shared object instead, which
+ * interposes malloc/calloc/realloc/free and the operator new/delete family of
+ * any dynamically linked program:
+ *
+ *     g++ -O2 -shared -fPIC LeakPreload.cpp -o libleakpreload.so -ldl -pthread
+ *     LD_PRELOAD=./libleakpreload.so ./program
+ *
+ * There is no file and line without recompiling, so the position of a block
+ * is the return address of the call applying it. The report is written to
+ * stderr when the library is unloaded, after the static objects of the program
+ * are destructed. Set LEAK_DETECTOR_PROFILE=1 to also print where the most
+ * memory was applied, released or not, and LEAK_DETECTOR_REPORT=path to also
+ * write both as JSON lines.
+ *
+ * The blocks are not prefixed with a '_MemoryList' here. They are kept in a
+ * hash table on the side, so that memory from functions which are not
+ * interposed (memalign, strdup inside libc, ...) can still be released safely.
+*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <atomic>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "LeakReport.hpp"
+
+namespace {
+
+enum {
+    _KIND_MALLOC = 0,       // malloc/calloc/realloc, released by free
+    _KIND_NEW,              // operator new, released by operator delete
+    _KIND_NEW_ARRAY,        // operator new[], released by operator delete[]
+};
+
+typedef struct _PreloadBlock {
+    void          *ptr;     // NULL for an empty slot
+    size_t        size;     // Size for applying memory
+    unsigned int  site;     // Index into '_sites'
+    unsigned char kind;     // How the block was applied
+} _PreloadBlock;
+
+/*
+ * The blocks are spread over several tables by their address, each with its
+ * own lock, so that threads applying memory rarely wait for each other
+*/
+typedef struct _PreloadShard {
+    pthread_mutex_t lock;       // All zero is PTHREAD_MUTEX_INITIALIZER, usable before any constructor
+    _PreloadBlock   *blocks;    // Open addressing table from mmap, capacity is a power of 2
+    size_t          capacity;
+    size_t          used;
+} _PreloadShard;
+
+/*
+ * Every position applying memory, with what it has applied in total and what
+ * is still not released. Slots are claimed with a compare-and-swap and never
+ * removed, so the counters can be updated without a lock
+*/
+typedef struct _PreloadSite {
+    std::atomic<uintptr_t>      address;    // Return address of the caller, 0 for an empty slot
+    std::atomic<unsigned long>  liveCount;
+    std::atomic<unsigned long>  liveSize;
+    std::atomic<unsigned long>  totalCount;
+    std::atomic<unsigned long>  totalSize;
+} _PreloadSite;
+
+const unsigned int _NUM_SHARDS = 16;
+const size_t _INITIAL_CAPACITY = 4096;
+const unsigned int _MAX_SITES = 1 << 16;
+const unsigned int _OVERFLOW_SITE = _MAX_SITES;     // Shared by the positions once '_sites' is full
+const unsigned int _MAX_SITE_PROBES = 256;
+
+_PreloadShard _shards[_NUM_SHARDS];
+_PreloadSite _sites[_MAX_SITES + 1];
+std::atomic<unsigned long> _mismatches(0);      // Blocks released by the wrong function
+
+/*
+ * dlsym() applies memory itself before the real functions are known. Those
+ * applyings are served by bumping through this static arena and are never
+ * released
+*/
+const size_t _ARENA_SIZE = 64 * 1024;
+alignas(16) char _arena[_ARENA_SIZE];
+size_t _arena_used = 0;
+
+void* (*_real_malloc)(size_t) = NULL;
+void* (*_real_calloc)(size_t, size_t) = NULL;
+void* (*_real_realloc)(void*, size_t) = NULL;
+void  (*_real_free)(void*) = NULL;
+int   (*_real_posix_memalign)(void**, size_t, size_t) = NULL;
+bool _resolving = false;
+
+// Set while this library is working, applying from inside it is passed
+// straight to the real functions and not tracked
+__thread bool _in_hook __attribute__((tls_model("initial-exec"))) = false;
+
+class _HookGuard {
+public:
+    _HookGuard() noexcept { _in_hook = true; }
+    ~_HookGuard() noexcept { _in_hook = false; }
+};
+
+void* ArenaAllocate(size_t _size) {
+    // Keep the size in front of the memory for realloc()
+    size_t need = ((_size + 15) & ~(size_t)15) + 16;
+    size_t offset = __atomic_fetch_add(&_arena_used, need, __ATOMIC_RELAXED);
+    if (offset + need > _ARENA_SIZE) return NULL;
+    *(size_t*)(_arena + offset) = _size;
+    return _arena + offset + 16;
+}
+
+bool InArena(const void *_ptr) {
+    return (const char*)_ptr >= _arena && (const char*)_ptr < _arena + _ARENA_SIZE;
+}
+
+void ResolveReal() {
+    if (_resolving) return;
+    _resolving = true;
+    _real_malloc = (void* (*)(size_t))dlsym(RTLD_NEXT, "malloc");
+    _real_calloc = (void* (*)(size_t, size_t))dlsym(RTLD_NEXT, "calloc");
+    _real_realloc = (void* (*)(void*, size_t))dlsym(RTLD_NEXT, "realloc");
+    _real_free = (void (*)(void*))dlsym(RTLD_NEXT, "free");
+    _real_posix_memalign = (int (*)(void**, size_t, size_t))dlsym(RTLD_NEXT, "posix_memalign");
+    _resolving = false;
+}
+
+uint64_t HashValue(uintptr_t _value) {
+    // splitmix64 finalizer, spreads the aligned addresses over all bits
+    uint64_t h = _value;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+unsigned int FindSite(uintptr_t _address) {
+    unsigned int i = (unsigned int)HashValue(_address) & (_MAX_SITES - 1);
+    for (unsigned int probe = 0; probe < _MAX_SITE_PROBES; ++probe) {
+        uintptr_t current = _sites[i].address.load(std::memory_order_acquire);
+        if (current == _address) return i;
+        if (current == 0) {
+            if (_sites[i].address.compare_exchange_strong(current, _address)) return i;
+            if (current == _address) return i;
+        }
+        i = (i + 1) & (_MAX_SITES - 1);
+    }
+    return _OVERFLOW_SITE;
+}
+
+_PreloadBlock* MapBlocks(size_t _capacity) {
+    void *mem = mmap(NULL, _capacity * sizeof(_PreloadBlock), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mem == MAP_FAILED ? NULL : (_PreloadBlock*)mem;
+}
+
+size_t HomeSlot(const _PreloadShard *_shard, const void *_ptr) {
+    return (size_t)(HashValue((uintptr_t)_ptr) >> 4) & (_shard->capacity - 1);
+}
+
+_PreloadShard* ShardOf(const void *_ptr) {
+    return &_shards[HashValue((uintptr_t)_ptr) & (_NUM_SHARDS - 1)];
+}
+
+// Double the table while the lock is held. Keeps the old table if mmap fails
+void GrowShard(_PreloadShard *_shard) {
+    size_t newCapacity = _shard->capacity ? _shard->capacity * 2 : _INITIAL_CAPACITY;
+    _PreloadBlock *newBlocks = MapBlocks(newCapacity);
+    if (!newBlocks) return;
+    _PreloadBlock *oldBlocks = _shard->blocks;
+    size_t oldCapacity = _shard->capacity;
+    _shard->blocks = newBlocks;
+    _shard->capacity = newCapacity;
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (!oldBlocks[i].ptr) continue;
+        size_t j = HomeSlot(_shard, oldBlocks[i].ptr);
+        while (newBlocks[j].ptr) j = (j + 1) & (newCapacity - 1);
+        newBlocks[j] = oldBlocks[i];
+    }
+    if (oldBlocks) munmap(oldBlocks, oldCapacity * sizeof(_PreloadBlock));
+}
+
+void Track(void *_ptr, size_t _size, unsigned int _site, unsigned char _kind) {
+    _sites[_site].liveCount.fetch_add(1, std::memory_order_relaxed);
+    _sites[_site].liveSize.fetch_add(_size, std::memory_order_relaxed);
+    _sites[_site].totalCount.fetch_add(1, std::memory_order_relaxed);
+    _sites[_site].totalSize.fetch_add(_size, std::memory_order_relaxed);
+
+    _PreloadShard *shard = ShardOf(_ptr);
+    pthread_mutex_lock(&shard->lock);
+    if ((shard->used + 1) * 2 > shard->capacity) GrowShard(shard);
+    if (shard->capacity && (shard->used + 1) < shard->capacity) {
+        size_t i = HomeSlot(shard, _ptr);
+        while (shard->blocks[i].ptr && shard->blocks[i].ptr != _ptr) i = (i + 1) & (shard->capacity - 1);
+        _PreloadBlock *block = &shard->blocks[i];
+        if (block->ptr) {
+            // Released behind our back (e.g. by a function which is not interposed)
+            _sites[block->site].liveCount.fetch_sub(1, std::memory_order_relaxed);
+            _sites[block->site].liveSize.fetch_sub(block->size, std::memory_order_relaxed);
+        } else {
+            ++shard->used;
+        }
+        block->ptr = _ptr;
+        block->size = _size;
+        block->site = _site;
+        block->kind = _kind;
+    } else {
+        // Out of memory for the table, forget the block
+        _sites[_site].liveCount.fetch_sub(1, std::memory_order_relaxed);
+        _sites[_site].liveSize.fetch_sub(_size, std::memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/*
+ * Remove the block from its table and copy it to '_out'. Returns false if the
+ * block is not tracked. Uses backward shift deletion, so the table never
+ * needs tombstones
+*/
+bool Untrack(void *_ptr, unsigned char _kind, size_t _size = (size_t)-1, _PreloadBlock *_out = NULL) {
+    _PreloadShard *shard = ShardOf(_ptr);
+    pthread_mutex_lock(&shard->lock);
+    if (!shard->capacity) {
+        pthread_mutex_unlock(&shard->lock);
+        return false;
+    }
+    size_t mask = shard->capacity - 1;
+    size_t i = HomeSlot(shard, _ptr);
+    while (shard->blocks[i].ptr && shard->blocks[i].ptr != _ptr) i = (i + 1) & mask;
+    if (!shard->blocks[i].ptr) {
+        pthread_mutex_unlock(&shard->lock);
+        return false;
+    }
+
+    _PreloadBlock block = shard->blocks[i];
+    for (size_t j = (i + 1) & mask; shard->blocks[j].ptr; j = (j + 1) & mask) {
+        size_t home = HomeSlot(shard, shard->blocks[j].ptr);
+        // Move the block back if its home is not within (i, j]
+        bool between = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!between) {
+            shard->blocks[i] = shard->blocks[j];
+            i = j;
+        }
+    }
+    shard->blocks[i].ptr = NULL;
+    --shard->used;
+    pthread_mutex_unlock(&shard->lock);
+
+    _sites[block.site].liveCount.fetch_sub(1, std::memory_order_relaxed);
+    _sites[block.site].liveSize.fetch_sub(block.size, std::memory_order_relaxed);
+    if (block.kind != _kind || (_size != (size_t)-1 && block.size != _size))
+        _mismatches.fetch_add(1, std::memory_order_relaxed);
+    if (_out) *_out = block;
+    return true;
+}
+
+void* Allocate(size_t _size, void *_caller, unsigned char _kind) {
+    if (!_real_malloc) {
+        ResolveReal();
+        if (!_real_malloc) return ArenaAllocate(_size);
+    }
+    if (_in_hook) return _real_malloc(_size);
+    _HookGuard guard;
+    void *ptr = _real_malloc(_size);
+    if (ptr) Track(ptr, _size, FindSite((uintptr_t)_caller), _kind);
+    return ptr;
+}
+
+#ifdef __cpp_aligned_new
+void* AllocateAligned(size_t _size, size_t _align, void *_caller, unsigned char _kind) {
+    if (!_real_posix_memalign) ResolveReal();
+    void *ptr = NULL;
+    if (!_real_posix_memalign || _real_posix_memalign(&ptr, _align, _size)) return NULL;
+    if (!_in_hook) {
+        _HookGuard guard;
+        Track(ptr, _size, FindSite((uintptr_t)_caller), _kind);
+    }
+    return ptr;
+}
+#endif
+
+void Release(void *_ptr, unsigned char _kind, size_t _size = (size_t)-1) {
+    if (!_ptr || InArena(_ptr)) return;
+    if (!_real_free) {
+        ResolveReal();
+        // Keep the block tracked, it cannot be released without the real free()
+        if (!_real_free) return;
+    }
+    Untrack(_ptr, _kind, _size);
+    _real_free(_ptr);
+}
+
+void* AllocateOrThrow(size_t _size, void *_caller, unsigned char _kind) {
+    void *ptr = Allocate(_size, _caller, _kind);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+#ifdef __cpp_aligned_new
+void* AllocateAlignedOrThrow(size_t _size, size_t _align, void *_caller, unsigned char _kind) {
+    void *ptr = AllocateAligned(_size, _align, _caller, _kind);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+#endif
+
+/*
+ * ---- Report ----
+ * Formatted with snprintf into a stack buffer and written with write(2),
+ * so that reporting does not apply memory through stdio
+*/
+void Print(const char *_format, ...) {
+    char line[512];
+    va_list args;
+    va_start(args, _format);
+    int n = vsnprintf(line, sizeof(line), _format, args);
+    va_end(args);
+    if (n <= 0) return;
+    if ((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+    ssize_t written = write(STDERR_FILENO, line, (size_t)n);
+    (void)written;
+}
+
+/*
+ * Find the function or at least the module containing the position.
+ * '_offset' is relative to the function if it is found, or to the module
+*/
+const char* Symbolize(unsigned int _site, uintptr_t *_address, const char **_module, uintptr_t *_offset) {
+    *_address = _site == _OVERFLOW_SITE ? 0 : _sites[_site].address.load(std::memory_order_relaxed);
+    *_module = NULL;
+    *_offset = 0;
+    Dl_info info;
+    if (!*_address || !dladdr((void*)*_address, &info)) return NULL;
+    *_module = info.dli_fname;
+    if (info.dli_sname) {
+        *_offset = *_address - (uintptr_t)info.dli_saddr;
+        return info.dli_sname;
+    }
+    *_offset = *_address - (uintptr_t)info.dli_fbase;
+    return NULL;
+}
+
+void PrintPosition(const char *_prefix, unsigned long _count, unsigned long _size, unsigned int _site) {
+    uintptr_t address, offset;
+    const char *module;
+    const char *symbol = Symbolize(_site, &address, &module, &offset);
+    if (!address) {
+        Print("%s %lu blocks size %lu (Cannot find position)\n", _prefix, _count, _size);
+    } else if (symbol) {
+        Print("%s %lu blocks size %lu (located in %s+0x%lx in %s)\n", _prefix, _count, _size,
+              symbol, (unsigned long)offset, module);
+    } else if (module) {
+        // Feed the offset to addr2line to get the file and line
+        Print("%s %lu blocks size %lu (located in %s+0x%lx)\n", _prefix, _count, _size,
+              module, (unsigned long)offset);
+    } else {
+        Print("%s %lu blocks size %lu (located in %p)\n", _prefix, _count, _size, (void*)address);
+    }
+}
+
+/*
+ * One JSON object per line: a summary, then one record for every position
+ * with both what it still holds and what it has applied in total
+*/
+void WriteReport(const char *_path, const unsigned int *_order, unsigned int _n,
+                 unsigned long _count, unsigned long _size) {
+    _LeakReport report;
+    if (!OpenReport(&report, _path)) return;
+    ReportAppend(&report, "{\"kind\":\"summary\",\"pid\":");
+    ReportNumber(&report, (unsigned long)getpid());
+    ReportAppend(&report, ",\"count\":");
+    ReportNumber(&report, _count);
+    ReportAppend(&report, ",\"bytes\":");
+    ReportNumber(&report, _size);
+    ReportAppend(&report, ",\"sites\":");
+    ReportNumber(&report, _n);
+    ReportAppend(&report, ",\"mismatches\":");
+    ReportNumber(&report, _mismatches.load());
+    ReportAppend(&report, "}\n");
+    for (unsigned int i = 0; i < _n; ++i) {
+        const _PreloadSite &site = _sites[_order[i]];
+        uintptr_t address, offset;
+        const char *module;
+        const char *symbol = Symbolize(_order[i], &address, &module, &offset);
+        ReportAppend(&report, "{\"kind\":\"site\",\"address\":");
+        ReportAddress(&report, (unsigned long)address);
+        ReportAppend(&report, ",\"module\":");
+        ReportString(&report, module);
+        ReportAppend(&report, ",\"symbol\":");
+        ReportString(&report, symbol);
+        ReportAppend(&report, ",\"offset\":");
+        ReportAddress(&report, (unsigned long)offset);
+        ReportAppend(&report, ",\"count\":");
+        ReportNumber(&report, site.liveCount.load(std::memory_order_relaxed));
+        ReportAppend(&report, ",\"bytes\":");
+        ReportNumber(&report, site.liveSize.load(std::memory_order_relaxed));
+        ReportAppend(&report, ",\"total_count\":");
+        ReportNumber(&report, site.totalCount.load(std::memory_order_relaxed));
+        ReportAppend(&report, ",\"total_bytes\":");
+        ReportNumber(&report, site.totalSize.load(std::memory_order_relaxed));
+        ReportAppend(&report, "}\n");
+    }
+    CloseReport(&report);
+}
+
+// Sorting key for the report, chosen before qsort() is called
+bool _sort_by_total = false;
+
+int CompareSites(const void *_a, const void *_b) {
+    const _PreloadSite &a = _sites[*(const unsigned int*)_a];
+    const _PreloadSite &b = _sites[*(const unsigned int*)_b];
+    unsigned long sa = _sort_by_total ? a.totalSize.load() : a.liveSize.load();
+    unsigned long sb = _sort_by_total ? b.totalSize.load() : b.liveSize.load();
+    return sa > sb ? -1 : (sa < sb ? 1 : 0);
+}
+
+void Report() {
+    _HookGuard guard;
+
+    size_t bytes = (_MAX_SITES + 1) * sizeof(unsigned int);
+    void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return;
+    unsigned int *order = (unsigned int*)mem;
+
+    unsigned int n = 0;
+    unsigned long count = 0, size = 0;
+    for (unsigned int i = 0; i <= _MAX_SITES; ++i) {
+        if (!_sites[i].totalCount.load(std::memory_order_relaxed)) continue;
+        order[n++] = i;
+        count += _sites[i].liveCount.load(std::memory_order_relaxed);
+        size += _sites[i].liveSize.load(std::memory_order_relaxed);
+    }
+
+    _sort_by_total = false;
+    qsort(order, n, sizeof(unsigned int), CompareSites);
+    for (unsigned int i = 0; i < n; ++i) {
+        const _PreloadSite &site = _sites[order[i]];
+        unsigned long live = site.liveCount.load(std::memory_order_relaxed);
+        if (live) PrintPosition("leak", live, site.liveSize.load(std::memory_order_relaxed), order[i]);
+    }
+    if (count) Print("Total %lu leaks, size is %lu bytes.\n", count, size);
+    if (_mismatches.load()) Print("Total %lu blocks released by a mismatching function.\n", _mismatches.load());
+
+    const char *profile = getenv("LEAK_DETECTOR_PROFILE");
+    if (profile && *profile && strcmp(profile, "0") != 0) {
+        _sort_by_total = true;
+        qsort(order, n, sizeof(unsigned int), CompareSites);
+        for (unsigned int i = 0; i < n; ++i) {
+            const _PreloadSite &site = _sites[order[i]];
+            PrintPosition("alloc", site.totalCount.load(std::memory_order_relaxed),
+                          site.totalSize.load(std::memory_order_relaxed), order[i]);
+        }
+    }
+
+    const char *path = getenv(LEAK_REPORT_ENV);
+    if (path && *path) WriteReport(path, order, n, count, size);
+    munmap(mem, bytes);
+}
+
+/*
+ * Resolve the real functions as early as possible, and report when the
+ * library is unloaded. A preloaded library is unloaded after the program,
+ * so the static objects of the program are already destructed by then
+*/
+__attribute__((constructor)) void PreloadInit() {
+    if (!_real_malloc) ResolveReal();
+}
+
+__attribute__((destructor)) void PreloadExit() {
+    Report();
+}
+
+} // namespace
+
+/*
+ * ---- Interposed C functions ----
+*/
+extern "C" {
+
+void* malloc(size_t _size) {
+    return Allocate(_size, __builtin_return_address(0), _KIND_MALLOC);
+}
+
+void* calloc(size_t _count, size_t _size) {
+    if (_size && _count > (size_t)-1 / _size) return NULL;
+    if (!_real_calloc) {
+        ResolveReal();
+        // The arena is static, so it is already zeroed
+        if (!_real_calloc) return ArenaAllocate(_count * _size);
+    }
+    if (_in_hook) return _real_calloc(_count, _size);
+    _HookGuard guard;
+    void *ptr = _real_calloc(_count, _size);
+    if (ptr) Track(ptr, _count * _size, FindSite((uintptr_t)__builtin_return_address(0)), _KIND_MALLOC);
+    return ptr;
+}
+
+void* realloc(void *_ptr, size_t _size) {
+    if (!_ptr) return Allocate(_size, __builtin_return_address(0), _KIND_MALLOC);
+    if (InArena(_ptr)) {
+        // Move the block out of the arena
+        size_t oldSize = *(size_t*)((char*)_ptr - 16);
+        void *ptr = Allocate(_size, __builtin_return_address(0), _KIND_MALLOC);
+        if (ptr) memcpy(ptr, _ptr, oldSize < _size ? oldSize : _size);
+        return ptr;
+    }
+    if (!_real_realloc) {
+        ResolveReal();
+        if (!_real_realloc) return NULL;  // The old block is still valid
+    }
+    if (_in_hook) return _real_realloc(_ptr, _size);
+    _HookGuard guard;
+    // Untrack before the real realloc(), after it another thread may get the same address
+    _PreloadBlock old;
+    bool tracked = Untrack(_ptr, _KIND_MALLOC, (size_t)-1, &old);
+    void *ptr = _real_realloc(_ptr, _size);
+    if (ptr) Track(ptr, _size, FindSite((uintptr_t)__builtin_return_address(0)), _KIND_MALLOC);
+    else if (_size && tracked) Track(_ptr, old.size, old.site, old.kind);  // The old block is still valid
+    return ptr;
+}
+
+void free(void *_ptr) {
+    Release(_ptr, _KIND_MALLOC);
+}
+
+} // extern "C"
+
+
+/*
+ * ---- Interposed operator new and delete ----
+*/
+void* operator new(size_t _size) {
+    return AllocateOrThrow(_size, __builtin_return_address(0), _KIND_NEW);
+}
+void* operator new[](size_t _size) {
+    return AllocateOrThrow(_size, __builtin_return_address(0), _KIND_NEW_ARRAY);
+}
+void* operator new(size_t _size, const std::nothrow_t&) noexcept {
+    return Allocate(_size, __builtin_return_address(0), _KIND_NEW);
+}
+void* operator new[](size_t _size, const std::nothrow_t&) noexcept {
+    return Allocate(_size, __builtin_return_address(0), _KIND_NEW_ARRAY);
+}
+void operator delete(void *_ptr) noexcept {
+    Release(_ptr, _KIND_NEW);
+}
+void operator delete[](void *_ptr) noexcept {
+    Release(_ptr, _KIND_NEW_ARRAY);
+}
+void operator delete(void *_ptr, const std::nothrow_t&) noexcept {
+    Release(_ptr, _KIND_NEW);
+}
+void operator delete[](void *_ptr, const std::nothrow_t&) noexcept {
+    Release(_ptr, _KIND_NEW_ARRAY);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *_ptr, size_t _size) noexcept {
+    Release(_ptr, _KIND_NEW, _size);
+}
+void operator delete[](void *_ptr, size_t _size) noexcept {
+    Release(_ptr, _KIND_NEW_ARRAY, _size);
+}
+#endif
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t _size, std::align_val_t _align) {
+    return AllocateAlignedOrThrow(_size, (size_t)_align, __builtin_return_address(0), _KIND_NEW);
+}
+void* operator new[](size_t _size, std::align_val_t _align) {
+    return AllocateAlignedOrThrow(_size, (size_t)_align, __builtin_return_address(0), _KIND_NEW_ARRAY);
+}
+void* operator new(size_t _size, std::align_val_t _align, const std::nothrow_t&) noexcept {
+    return AllocateAligned(_size, (size_t)_align, __builtin_return_address(0), _KIND_NEW);
+}
+void* operator new[](size_t _size, std::align_val_t _align, const std::nothrow_t&) noexcept {
+    return AllocateAligned(_size, (size_t)_align, __builtin_return_address(0), _KIND_NEW_ARRAY);
+}
+void operator delete(void *_ptr, std::align_val_t) noexcept {
+    Release(_ptr, _KIND_NEW);
+}
+void operator delete[](void *_ptr, std::align_val_t) noexcept {
+    Release(_ptr, _KIND_NEW_ARRAY);
+}
+void operator delete(void *_ptr, size_t _size, std::align_val_t) noexcept {
+    Release(_ptr, _KIND_NEW, _size);
+}
+void operator delete[](void *_ptr, size_t _size, std::align_val_t) noexcept {
+    Release(_ptr, _KIND_NEW_ARRAY, _size);
+}
+void operator delete(void *_ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    Release(_ptr, _KIND_NEW);
+}
+void operator delete[](void *_ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    Release(_ptr, _KIND_NEW_ARRAY);
+}
+#endif
\ No newline at end of file
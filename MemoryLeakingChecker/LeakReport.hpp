@@ -0,0 +1,137 @@
+#ifndef __LEAK_REPORT__
+#define __LEAK_REPORT__
+
+/*
+ * Writer of the machine-readable report, one JSON object per line, shared by
+ * 'LeakDetector.cpp' and 'LeakPreload.cpp'. The report is only formatted when
+ * it is written, the applying and releasing of memory only update counters.
+ *
+ * It works in a fixed buffer, formats numbers itself and writes with write(2),
+ * so writing a report never applies memory, even while the heap is being
+ * checked, and it is safe to use from a signal handler.
+*/
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// Environment variable holding the path of the report. "%p" in the path is
+// replaced by the process id, so that many runs can share one setting
+#define LEAK_REPORT_ENV "LEAK_DETECTOR_REPORT"
+
+typedef struct _LeakReport {
+    int     fd;
+    size_t  used;
+    char    buffer[4096];
+} _LeakReport;
+
+// Digits of the value in the base, written backward from '_end'. Returns the first digit
+static inline char* FormatNumber(char *_end, unsigned long _value, unsigned int _base) {
+    char *c = _end;
+    do {
+        *--c = "0123456789abcdef"[_value % _base];
+        _value /= _base;
+    } while (_value);
+    return c;
+}
+
+static inline bool OpenReport(_LeakReport *_report, const char *_path) {
+    char path[4096];
+    size_t n = 0;
+    for (const char *c = _path; *c && n + 32 < sizeof(path); ++c) {
+        if (c[0] == '%' && c[1] == 'p') {
+            char digits[24];
+            char *end = digits + sizeof(digits);
+            for (char *d = FormatNumber(end, (unsigned long)getpid(), 10); d != end; ++d) path[n++] = *d;
+            ++c;
+        } else {
+            path[n++] = *c;
+        }
+    }
+    path[n] = '\0';
+    _report->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    _report->used = 0;
+    return _report->fd >= 0;
+}
+
+// Write to a file which is already open, such as STDERR_FILENO
+static inline void OpenReport(_LeakReport *_report, int _fd) {
+    _report->fd = _fd;
+    _report->used = 0;
+}
+
+static inline void ReportFlush(_LeakReport *_report) {
+    size_t done = 0;
+    while (done < _report->used) {
+        ssize_t n = write(_report->fd, _report->buffer + done, _report->used - done);
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    _report->used = 0;
+}
+
+static inline void ReportAppend(_LeakReport *_report, const char *_text, size_t _length) {
+    while (_length) {
+        if (_report->used == sizeof(_report->buffer)) ReportFlush(_report);
+        size_t n = sizeof(_report->buffer) - _report->used;
+        if (n > _length) n = _length;
+        memcpy(_report->buffer + _report->used, _text, n);
+        _report->used += n;
+        _text += n;
+        _length -= n;
+    }
+}
+
+static inline void ReportAppend(_LeakReport *_report, const char *_text) {
+    ReportAppend(_report, _text, strlen(_text));
+}
+
+static inline void ReportNumber(_LeakReport *_report, unsigned long _value) {
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *begin = FormatNumber(end, _value, 10);
+    ReportAppend(_report, begin, (size_t)(end - begin));
+}
+
+// Quoted hexadecimal, JSON numbers cannot hold every address exactly
+static inline void ReportAddress(_LeakReport *_report, unsigned long _value) {
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *begin = FormatNumber(end, _value, 16);
+    ReportAppend(_report, "\"0x", 3);
+    ReportAppend(_report, begin, (size_t)(end - begin));
+    ReportAppend(_report, "\"", 1);
+}
+
+// Quoted and escaped JSON string, or null
+static inline void ReportString(_LeakReport *_report, const char *_text) {
+    if (!_text) {
+        ReportAppend(_report, "null", 4);
+        return;
+    }
+    ReportAppend(_report, "\"", 1);
+    for (const char *c = _text; *c; ++c) {
+        unsigned char ch = (unsigned char)*c;
+        if (ch == '"' || ch == '\\') {
+            char escaped[2] = { '\\', (char)ch };
+            ReportAppend(_report, escaped, 2);
+        } else if (ch < 0x20) {
+            char escaped[6] = { '\\', 'u', '0', '0', "0123456789abcdef"[ch >> 4], "0123456789abcdef"[ch & 15] };
+            ReportAppend(_report, escaped, 6);
+        } else {
+            ReportAppend(_report, c, 1);
+        }
+    }
+    ReportAppend(_report, "\"", 1);
+}
+
+static inline void CloseReport(_LeakReport *_report) {
+    ReportFlush(_report);
+    if (_report->fd > STDERR_FILENO) close(_report->fd);
+    _report->fd = -1;
+}
+
+#endif // !__LEAK_REPORT__
\ No newline at end of file
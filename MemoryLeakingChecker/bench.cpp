@@ -0,0 +1,156 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Built with -DBENCH_LEAK_DETECTOR, the workloads go through the 'new' macro
+// of 'LeakDetector.hpp' like a program under checking does
+#ifdef BENCH_LEAK_DETECTOR
+#include "LeakDetector.hpp"
+#endif
+
+/*
+ * Overhead benchmark of the memory leaking checker
+ *
+ * Every workload applies and releases memory in a loop and reports the time
+ * per new/delete pair, the resident memory after it and the peak resident
+ * memory so far. The same source is run in every mode, see 'bench.sh':
+ *
+ *     off       g++ -O2 bench.cpp -pthread
+ *     leak      g++ -O2 -DBENCH_LEAK_DETECTOR bench.cpp LeakDetector.cpp -Wno-write-strings -pthread
+ *     profile   the 'off' build under LD_PRELOAD=libleakpreload.so LEAK_DETECTOR_PROFILE=1
+ *     sampling  the 'leak' build with LEAK_DETECTOR_TIMELINE_MS=10
+ *     canary    the 'leak' build with LEAK_DETECTOR_GUARD=canary
+ *     page      the 'leak' build with LEAK_DETECTOR_GUARD=page
+ *
+ * Usage: ./bench <mode label> [scale]
+*/
+
+// Keep the compiler from removing a new/delete pair
+static inline void Escape(void *_ptr) {
+    asm volatile("" : : "g"(_ptr) : "memory");
+}
+
+// Cheap deterministic random numbers, the same sequence in every mode
+static inline unsigned int NextRandom(unsigned int &_state) {
+    _state = _state * 1103515245u + 12345u;
+    return _state >> 8;
+}
+
+static long ReadStatusKb(const char *_field) {
+    FILE *file = fopen("/proc/self/status", "r");
+    if (!file) return -1;
+    char line[256];
+    long value = -1;
+    size_t length = strlen(_field);
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, _field, length) == 0) {
+            value = atol(line + length);
+            break;
+        }
+    }
+    fclose(file);
+    return value;
+}
+
+struct Small {
+    int value[4];
+};
+
+// Short-lived small objects, the most common pattern
+static unsigned long SmallObjects(unsigned long _n) {
+    for (unsigned long i = 0; i < _n; ++i) {
+        Small *p = new Small;
+        Escape(p);
+        delete p;
+    }
+    return _n;
+}
+
+// Sizes spread from 8 bytes to 4 KB, with a window of live blocks
+static unsigned long MixedSizes(unsigned long _n) {
+    const size_t window = 1024;
+    std::vector<char*> live(window, NULL);
+    unsigned int state = 1;
+    for (unsigned long i = 0; i < _n; ++i) {
+        size_t slot = NextRandom(state) % window;
+        delete[] live[slot];
+        live[slot] = new char[8 + NextRandom(state) % 4089];
+        Escape(live[slot]);
+    }
+    for (size_t i = 0; i < window; ++i) delete[] live[i];
+    return _n;
+}
+
+// Several threads applying and releasing at the same time
+static unsigned long ThreadedChurn(unsigned long _n) {
+    unsigned int threads = std::thread::hardware_concurrency();
+    if (threads < 2) threads = 2;
+    if (threads > 8) threads = 8;
+    unsigned long perThread = _n / threads;
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < threads; ++t) {
+        workers.push_back(std::thread([perThread, t]() {
+            const size_t window = 64;
+            char *live[window] = {};
+            unsigned int state = t + 1;
+            for (unsigned long i = 0; i < perThread; ++i) {
+                size_t slot = NextRandom(state) % window;
+                delete[] live[slot];
+                live[slot] = new char[16 + NextRandom(state) % 256];
+                Escape(live[slot]);
+            }
+            for (size_t i = 0; i < window; ++i) delete[] live[i];
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t) workers[t].join();
+    return perThread * threads;
+}
+
+// A large population of long-lived objects while short-lived ones churn,
+// which is what makes list or table based checking slow
+static unsigned long LongAndShortLived(unsigned long _n) {
+    const size_t longLived = 200000;
+    std::vector<Small*> keep(longLived);
+    for (size_t i = 0; i < longLived; ++i) keep[i] = new Small;
+    for (unsigned long i = 0; i < _n; ++i) {
+        Small *p = new Small;
+        Escape(p);
+        delete p;
+    }
+    for (size_t i = 0; i < longLived; ++i) delete keep[i];
+    return _n + longLived;
+}
+
+struct Workload {
+    const char *name;
+    unsigned long (*run)(unsigned long);
+    unsigned long iterations;
+};
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "unnamed";
+    double scale = argc > 2 ? atof(argv[2]) : 1.0;
+    if (scale <= 0) scale = 1.0;
+
+    const Workload workloads[] = {
+        { "small",      SmallObjects,       2000000 },
+        { "mixed",      MixedSizes,         1000000 },
+        { "threaded",   ThreadedChurn,      2000000 },
+        { "long-short", LongAndShortLived,  1000000 },
+    };
+
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); ++i) {
+        unsigned long n = (unsigned long)(workloads[i].iterations * scale);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        unsigned long pairs = workloads[i].run(n);
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        printf("%-10s %-11s %9.1f ns/op   rss %8ld KB   peak %8ld KB\n", mode, workloads[i].name,
+               ns / (double)pairs, ReadStatusKb("VmRSS:"), ReadStatusKb("VmHWM:"));
+        fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Build the overhead benchmark and run it in every mode of the checker.
+# Usage: ./bench.sh [scale]   (scale < 1 for a quick run)
+set -e
+
+cd "$(dirname "$0")"
+SCALE=${1:-1}
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+CXX=${CXX:-g++}
+$CXX -O2 -std=c++17 bench.cpp -o "$OUT/bench_off" -pthread
+$CXX -O2 -std=c++17 -DBENCH_LEAK_DETECTOR bench.cpp LeakDetector.cpp -o "$OUT/bench_leak" -Wno-write-strings -pthread
+$CXX -O2 -std=c++17 -shared -fPIC LeakPreload.cpp -o "$OUT/libleakpreload.so" -ldl -pthread
+
+"$OUT/bench_off" off "$SCALE"
+"$OUT/bench_leak" leak "$SCALE"
+LD_PRELOAD="$OUT/libleakpreload.so" LEAK_DETECTOR_PROFILE=1 "$OUT/bench_off" profile "$SCALE" 2>/dev/null
+LEAK_DETECTOR_TIMELINE_MS=10 "$OUT/bench_leak" sampling "$SCALE"
+LEAK_DETECTOR_GUARD=canary "$OUT/bench_leak" canary "$SCALE"
+LEAK_DETECTOR_GUARD=page "$OUT/bench_leak" page "$SCALE"
@@ -47,6 +47,14 @@ int main() {
     };
 
 
+    // Growth between two points of a running program, which
+    // is reported without waiting for the program to exit
+    _leak_snapshot before = _leak_detector::snapshot();
+    int *c = new int[4];
+    _leak_detector::diff(before, _leak_detector::snapshot());
+    delete[] c;
+
+
     // Memory leak caused by smart pointer circular references
     auto smartA = std::make_shared<A>();
     auto smartB = std::make_shared<B>();
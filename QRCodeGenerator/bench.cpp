@@ -0,0 +1,260 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "generator.hpp"
+
+using std::size_t;
+using std::uint8_t;
+using qrcodegen::QrCode;
+using qrcodegen::QrSegment;
+
+/*
+ * Throughput benchmark of the QR Code generator
+ *
+ * Every figure is measured by repeating one call until the time budget is
+ * spent, and is printed in fixed columns so that two runs can be diffed:
+ *
+ *     encode   encodes per second of every version and ECC level, with the mask
+ *              chosen automatically and fixed to mask 0, the payload in byte mode
+ *              filling the version
+ *     modes    the cost of segmenting and of encoding in every segment mode
+ *     stages   the cost of every stage of the pipeline, see doStageBench()
+ *
+ * Build and run:
+ *
+ *     g++ -O2 -std=c++17 bench.cpp generator.cpp -o bench -pthread
+ *     ./bench [scale]      (scale < 1 for a quick run)
+*/
+
+
+enum class Mode { NUMERIC, ALPHANUMERIC, BYTE, KANJI, MIXED };
+
+static const char *MODE_NAMES[] = {"numeric", "alnum", "byte", "kanji", "mixed"};
+
+static const QrCode::Ecc ECC_LEVELS[] = {
+	QrCode::Ecc::LOW, QrCode::Ecc::MEDIUM, QrCode::Ecc::QUARTILE, QrCode::Ecc::HIGH,
+};
+
+static const char *ECC_NAMES = "LMQH";
+
+// Milliseconds spent on every figure
+static double budgetMs = 10;
+
+// Results are added here, so that the compiler cannot remove the calls
+static volatile long sink;
+
+
+// Function prototypes
+static void doEncodeBench();
+static void doModeBench();
+static void doStageBench();
+
+
+int main(int argc, char **argv) {
+	double scale = argc > 1 ? std::atof(argv[1]) : 1.0;
+	if (scale > 0)
+		budgetMs *= scale;
+	doEncodeBench();
+	doModeBench();
+	doStageBench();
+	return EXIT_SUCCESS;
+}
+
+
+/*---- Utilities ----*/
+
+// Returns the nanoseconds per call of the function, called until the budget is spent
+template <typename Func>
+static double timeNs(Func func) {
+	using clock = std::chrono::steady_clock;
+	func();  // Warm up the caches and the lazy tables
+	long calls = 0;
+	long batch = 1;
+	clock::time_point start = clock::now();
+	double elapsed;
+	while (true) {
+		for (long i = 0; i < batch; i++)
+			func();
+		calls += batch;
+		elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+		if (elapsed >= budgetMs * 1e6)
+			break;
+		if (batch < 1024)
+			batch *= 2;
+	}
+	return elapsed / calls;
+}
+
+
+// Returns n characters of text in the mode. Mixed text alternates digits,
+// upper case letters and lower case words, so that every mode is worth a segment
+static std::string makePayload(Mode mode, size_t n) {
+	static const char *ALNUM = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 $%*+-./:";
+	static const char *WORDS = "the quick brown fox jumps over the lazy dog ";
+	static const char *KANJI[] = {"\xE6\xBC\xA2", "\xE5\xAD\x97", "\xE3\x81\x82", "\xE3\x82\xA2"};
+	std::string result;
+	for (size_t i = 0; i < n; i++) {
+		switch (mode) {
+			case Mode::NUMERIC:       result += static_cast<char>('0' + i % 10);  break;
+			case Mode::ALPHANUMERIC:  result += ALNUM[i % 45];  break;
+			case Mode::BYTE:          result += WORDS[i % 44];  break;
+			case Mode::KANJI:         result += KANJI[i % 4];  break;
+			case Mode::MIXED: {
+				size_t run = i % 48;
+				if (run < 16)
+					result += static_cast<char>('0' + i % 10);
+				else if (run < 32)
+					result += ALNUM[i % 26];
+				else
+					result += WORDS[i % 44];
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+
+// Returns the segments of the text in the mode at the version
+static std::vector<QrSegment> makeSegments(Mode mode, const std::string &text, int version) {
+	switch (mode) {
+		case Mode::NUMERIC:       return {QrSegment::makeNumeric(text.c_str())};
+		case Mode::ALPHANUMERIC:  return {QrSegment::makeAlphanumeric(text.c_str())};
+		case Mode::BYTE:          return {QrSegment::makeBytes(std::vector<uint8_t>(text.begin(), text.end()))};
+		case Mode::KANJI:         return {QrSegment::makeKanji(text.c_str())};
+		default:                  return QrSegment::makeSegmentsOptimally(text.c_str(), version);
+	}
+}
+
+
+// Returns the longest text in the mode which fits in the version at the ECC level
+static std::string fillVersion(Mode mode, int version, QrCode::Ecc ecl) {
+	size_t low = 0;
+	size_t high = 7090;  // The numeric capacity of version 40-L, plus one
+	while (high - low > 1) {
+		size_t mid = (low + high) / 2;
+		try {
+			QrCode::encodeSegments(makeSegments(mode, makePayload(mode, mid), version), ecl, version, version, 0, false);
+			low = mid;
+		} catch (const qrcodegen::data_too_long &) {
+			high = mid;
+		}
+	}
+	return makePayload(mode, low);
+}
+
+
+/*---- Benchmarks ----*/
+
+static void doEncodeBench() {
+	std::printf("encode   encodes/s, mask auto / mask 0, byte mode filling the version\n");
+	std::printf("version");
+	for (int i = 0; i < 4; i++)
+		std::printf("   %c auto   %c fixed", ECC_NAMES[i], ECC_NAMES[i]);
+	std::printf("\n");
+	for (int ver = QrCode::MIN_VERSION; ver <= QrCode::MAX_VERSION; ver++) {
+		std::printf("%7d", ver);
+		for (QrCode::Ecc ecl : ECC_LEVELS) {
+			std::vector<QrSegment> segs = makeSegments(Mode::BYTE, fillVersion(Mode::BYTE, ver, ecl), ver);
+			double autoNs = timeNs([&]() {
+				sink += QrCode::encodeSegments(segs, ecl, ver, ver, -1, false).getMask();
+			});
+			double fixedNs = timeNs([&]() {
+				sink += QrCode::encodeSegments(segs, ecl, ver, ver, 0, false).getMask();
+			});
+			std::printf("  %8.0f  %8.0f", 1e9 / autoNs, 1e9 / fixedNs);
+		}
+		std::printf("\n");
+		std::fflush(stdout);
+	}
+	std::printf("\n");
+}
+
+
+static void doModeBench() {
+	static const int VERSIONS[] = {1, 10, 27, 40};
+	std::printf("modes    ECC level M, the text filling the version\n");
+	std::printf("mode      version   chars   segment ns    encode ns    encodes/s\n");
+	for (int m = 0; m < 5; m++) {
+		Mode mode = static_cast<Mode>(m);
+		for (int ver : VERSIONS) {
+			std::string text = fillVersion(mode, ver, QrCode::Ecc::MEDIUM);
+			std::vector<QrSegment> segs = makeSegments(mode, text, ver);
+			double segmentNs = timeNs([&]() {
+				sink += static_cast<long>(makeSegments(mode, text, ver).size());
+			});
+			double encodeNs = timeNs([&]() {
+				sink += QrCode::encodeSegments(segs, QrCode::Ecc::MEDIUM, ver, ver, -1, false).getMask();
+			});
+			std::printf("%-8s  %7d  %6zu  %11.0f  %11.0f  %11.0f\n",
+				MODE_NAMES[m], ver, text.size(), segmentNs, encodeNs, 1e9 / encodeNs);
+			std::fflush(stdout);
+		}
+	}
+	std::printf("\n");
+}
+
+
+// Returns the stage times of an encode with the automatic mask, averaged over the calls
+// made in the budget, timed by the encoder itself
+static QrCode::EncodeStats timeStages(const std::vector<QrSegment> &segs, int version, bool parallelMask) {
+	QrCode::EncodeStats total = QrCode::EncodeStats();
+	QrCode::EncodeStats stats;
+	long calls = 0;
+	timeNs([&]() {
+		sink += QrCode::encodeSegments(segs, QrCode::Ecc::MEDIUM, version, version, -1, false, parallelMask, &stats).getMask();
+		total.segmentNs += stats.segmentNs;
+		total.eccNs += stats.eccNs;
+		total.drawNs += stats.drawNs;
+		total.maskNs += stats.maskNs;
+		total.penaltyNs += stats.penaltyNs;
+		calls++;
+	});
+	total.segmentNs /= calls;
+	total.eccNs /= calls;
+	total.drawNs /= calls;
+	total.maskNs /= calls;
+	total.penaltyNs /= calls;
+	return total;
+}
+
+
+/*
+ * The nanoseconds of every stage, in byte mode at ECC level M. Segmenting the
+ * text is timed on its own; choosing the version up to scoring the masks is
+ * timed by the encoder through QrCode::EncodeStats, "build" being the bit
+ * string of the segments, and "parallel" the wall time of applying and
+ * scoring the masks in threads
+*/
+static void doStageBench() {
+	static const int VERSIONS[] = {1, 5, 10, 20, 27, 40};
+	std::printf("stages   nanoseconds, byte mode at ECC level M\n");
+	std::printf("version   segment     build       ecc      draw      mask   penalty  parallel       svg       png\n");
+	for (int ver : VERSIONS) {
+		std::string text = fillVersion(Mode::BYTE, ver, QrCode::Ecc::MEDIUM);
+		std::vector<QrSegment> segs = QrSegment::makeSegmentsOptimally(text.c_str(), ver);
+		QrCode qr = QrCode::encodeSegments(segs, QrCode::Ecc::MEDIUM, ver, ver, -1, false);
+		std::vector<char> svg(qr.toSvg(nullptr, 0, 4));
+		std::vector<uint8_t> png(qr.toPng(nullptr, 0, 4, 4));
+
+		double segmentNs = timeNs([&]() {
+			sink += static_cast<long>(QrSegment::makeSegmentsOptimally(text.c_str(), ver).size());
+		});
+		QrCode::EncodeStats stages = timeStages(segs, ver, false);
+		QrCode::EncodeStats parallel = timeStages(segs, ver, true);
+		double svgNs = timeNs([&]() {
+			sink += static_cast<long>(qr.toSvg(svg.data(), svg.size(), 4));
+		});
+		double pngNs = timeNs([&]() {
+			sink += static_cast<long>(qr.toPng(png.data(), png.size(), 4, 4));
+		});
+		std::printf("%7d  %8.0f  %8ld  %8ld  %8ld  %8ld  %8ld  %8ld  %8.0f  %8.0f\n", ver, segmentNs,
+			stages.segmentNs, stages.eccNs, stages.drawNs, stages.maskNs, stages.penaltyNs,
+			parallel.penaltyNs, svgNs, pngNs);
+		std::fflush(stdout);
+	}
+}
@@ -1,15 +1,23 @@
 #include <algorithm>
 #include <climits>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <future>
+#include <iterator>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
 #include <utility>
 #include "generator.hpp"
 
 using std::int8_t;
+using std::int16_t;
+using std::uint64_t;
 using std::uint8_t;
+using std::uint32_t;
 using std::size_t;
 using std::vector;
 
@@ -39,14 +47,14 @@ const QrSegment::Mode QrSegment::Mode::ALPHANUMERIC(0x2,  9, 11, 13);
 const QrSegment::Mode QrSegment::Mode::BYTE        (0x4,  8, 16, 16);
 const QrSegment::Mode QrSegment::Mode::KANJI       (0x8,  8, 10, 12);
 const QrSegment::Mode QrSegment::Mode::ECI         (0x7,  0,  0,  0);
+const QrSegment::Mode QrSegment::Mode::STRUCTURED_APPEND(0x3, 0, 0, 0);
 
 
 QrSegment QrSegment::makeBytes(const vector<uint8_t> &data) {
 	if (data.size() > static_cast<unsigned int>(INT_MAX))
 		throw std::length_error("Data too long");
 	BitBuffer bb;
-	for (uint8_t b : data)
-		bb.appendBits(b, 8);
+	bb.appendBytes(data.data(), data.size());
 	return QrSegment(Mode::BYTE, static_cast<int>(data.size()), std::move(bb));
 }
 
@@ -97,19 +105,137 @@ QrSegment QrSegment::makeAlphanumeric(const char *text) {
 }
 
 
+QrSegment QrSegment::makeKanji(const char *text) {
+	const vector<int16_t> &unicodeToKanji = getUnicodeToKanji();
+	BitBuffer bb;
+	int charCount = 0;
+	for (const unsigned char *c = reinterpret_cast<const unsigned char*>(text); *c != '\0'; charCount++) {
+		// Decode one UTF-8 character of 2 or 3 bytes, kanji mode has no other characters
+		long codePoint = -1;
+		if ((c[0] & 0xE0) == 0xC0 && (c[1] & 0xC0) == 0x80) {
+			codePoint = (c[0] & 0x1FL) << 6 | (c[1] & 0x3F);
+			c += 2;
+		} else if ((c[0] & 0xF0) == 0xE0 && (c[1] & 0xC0) == 0x80 && (c[2] & 0xC0) == 0x80) {
+			codePoint = (c[0] & 0x0FL) << 12 | (c[1] & 0x3FL) << 6 | (c[2] & 0x3F);
+			c += 3;
+		}
+		if (codePoint < 0 || unicodeToKanji[static_cast<size_t>(codePoint)] == -1)
+			throw std::domain_error("String contains non-kanji-mode characters");
+		bb.appendBits(static_cast<uint32_t>(unicodeToKanji[static_cast<size_t>(codePoint)]), 13);
+	}
+	return QrSegment(Mode::KANJI, charCount, std::move(bb));
+}
+
+
 vector<QrSegment> QrSegment::makeSegments(const char *text) {
 	// Select the most efficient segment encoding automatically
+	return makeSegmentsOptimally(text, QrCode::MIN_VERSION);
+}
+
+
+vector<QrSegment> QrSegment::makeSegmentsOptimally(const char *text, int version) {
+	if (version < QrCode::MIN_VERSION || version > QrCode::MAX_VERSION)
+		throw std::domain_error("Version number out of range");
+	const vector<int16_t> &unicodeToKanji = getUnicodeToKanji();
+	
+	// Split the text into characters, and find the modes each one can be encoded in.
+	// A byte which does not start a valid UTF-8 sequence is a character of its own
+	enum { BYTE_MODE, ALPHANUMERIC_MODE, NUMERIC_MODE, KANJI_MODE, NUM_MODES };
+	const Mode *const modeTypes[NUM_MODES] = {&Mode::BYTE, &Mode::ALPHANUMERIC, &Mode::NUMERIC, &Mode::KANJI};
+	vector<int> charLengths;  // Bytes of each character
+	vector<int> charModes;    // Bit set of the modes which can encode each character
+	for (const unsigned char *c = reinterpret_cast<const unsigned char*>(text); *c != '\0'; ) {
+		int length = 1;
+		long codePoint = -1;
+		if (c[0] < 0x80)
+			codePoint = c[0];
+		else if ((c[0] & 0xE0) == 0xC0 && (c[1] & 0xC0) == 0x80)
+			codePoint = (c[0] & 0x1FL) << 6 | (c[1] & 0x3F), length = 2;
+		else if ((c[0] & 0xF0) == 0xE0 && (c[1] & 0xC0) == 0x80 && (c[2] & 0xC0) == 0x80)
+			codePoint = (c[0] & 0x0FL) << 12 | (c[1] & 0x3FL) << 6 | (c[2] & 0x3F), length = 3;
+		else if ((c[0] & 0xF8) == 0xF0 && (c[1] & 0xC0) == 0x80 && (c[2] & 0xC0) == 0x80 && (c[3] & 0xC0) == 0x80)
+			length = 4;  // Beyond kanji mode, byte mode only
+		int modes = 1 << BYTE_MODE;
+		if (codePoint >= '0' && codePoint <= '9')
+			modes |= 1 << NUMERIC_MODE;
+		if (codePoint > 0 && codePoint < 0x80 && std::strchr(ALPHANUMERIC_CHARSET, static_cast<int>(codePoint)) != nullptr)
+			modes |= 1 << ALPHANUMERIC_MODE;
+		if (codePoint >= 0 && unicodeToKanji[static_cast<size_t>(codePoint)] != -1)
+			modes |= 1 << KANJI_MODE;
+		charLengths.push_back(length);
+		charModes.push_back(modes);
+		c += length;
+	}
 	vector<QrSegment> result;
-	if (*text == '\0');  // Leave result empty
-	else if (isNumeric(text))
-		result.push_back(makeNumeric(text));
-	else if (isAlphanumeric(text))
-		result.push_back(makeAlphanumeric(text));
-	else {
-		vector<uint8_t> bytes;
-		for (; *text != '\0'; text++)
-			bytes.push_back(static_cast<uint8_t>(*text));
-		result.push_back(makeBytes(bytes));
+	size_t n = charLengths.size();
+	if (n == 0)
+		return result;
+	
+	// Dynamic programming over the characters, with costs in 1/6 bits. After character i,
+	// cost[j] is the fewest bits to encode the characters so far and the header of a segment
+	// in mode j which the next character continues, and from[i][j] is the mode of character i
+	// on that path, or -1 if there is none
+	const int charCosts[NUM_MODES] = {8 * 6, 33, 20, 13 * 6};  // Per byte for byte mode, per character for the others
+	long headCosts[NUM_MODES];
+	for (int j = 0; j < NUM_MODES; j++)
+		headCosts[j] = (4 + modeTypes[j]->numCharCountBits(version)) * 6L;
+	std::array<long,NUM_MODES> prevCosts;
+	std::copy(headCosts, headCosts + NUM_MODES, prevCosts.begin());
+	vector<std::array<int8_t,NUM_MODES> > from(n);
+	for (size_t i = 0; i < n; i++) {
+		std::array<long,NUM_MODES> curCosts;
+		for (int j = 0; j < NUM_MODES; j++) {  // Extend a segment if possible
+			bool possible = (charModes[i] >> j & 1) != 0;
+			curCosts[j] = possible ? prevCosts[j] + charCosts[j] * (j == BYTE_MODE ? charLengths[i] : 1) : 0;
+			from[i][j] = static_cast<int8_t>(possible ? j : -1);
+		}
+		std::array<long,NUM_MODES> extended = curCosts;
+		std::array<int8_t,NUM_MODES> extendedFrom = from[i];
+		for (int j = 0; j < NUM_MODES; j++) {  // Start a new segment at the end to switch modes
+			for (int k = 0; k < NUM_MODES; k++) {
+				if (extendedFrom[k] == -1)
+					continue;
+				long newCost = (extended[k] + 5) / 6 * 6 + headCosts[j];
+				if (from[i][j] == -1 || newCost < curCosts[j]) {
+					curCosts[j] = newCost;
+					from[i][j] = static_cast<int8_t>(k);
+				}
+			}
+		}
+		prevCosts = curCosts;
+	}
+	
+	// Trace back the mode of every character from the cheapest end
+	int mode = 0;
+	for (int j = 1; j < NUM_MODES; j++) {
+		if (prevCosts[j] < prevCosts[mode])
+			mode = j;
+	}
+	vector<int> chosen(n);
+	for (size_t i = n; i-- > 0; ) {
+		mode = from[i][mode];
+		chosen[i] = mode;
+	}
+	
+	// Make one segment of every run of characters in the same mode
+	const char *start = text;
+	for (size_t i = 0; i < n; ) {
+		size_t end = i;
+		size_t length = 0;
+		for (; end < n && chosen[end] == chosen[i]; end++)
+			length += static_cast<size_t>(charLengths[end]);
+		std::string part(start, length);
+		switch (chosen[i]) {
+			case BYTE_MODE:
+				result.push_back(makeBytes(vector<uint8_t>(part.begin(), part.end())));
+				break;
+			case ALPHANUMERIC_MODE:  result.push_back(makeAlphanumeric(part.c_str()));  break;
+			case NUMERIC_MODE:       result.push_back(makeNumeric(part.c_str()));       break;
+			case KANJI_MODE:         result.push_back(makeKanji(part.c_str()));         break;
+			default:  throw std::logic_error("Assertion error");
+		}
+		start += length;
+		i = end;
 	}
 	return result;
 }
@@ -133,7 +259,20 @@ QrSegment QrSegment::makeEci(long assignVal) {
 }
 
 
-QrSegment::QrSegment(Mode md, int numCh, const std::vector<bool> &dt) :
+QrSegment QrSegment::makeStructuredAppend(int index, int total, int parity) {
+	if (total < 1 || total > 16 || index < 0 || index >= total)
+		throw std::domain_error("Structured append position out of range");
+	if (parity < 0 || parity > 255)
+		throw std::domain_error("Structured append parity out of range");
+	BitBuffer bb;
+	bb.appendBits(static_cast<uint32_t>(index), 4);
+	bb.appendBits(static_cast<uint32_t>(total - 1), 4);
+	bb.appendBits(static_cast<uint32_t>(parity), 8);
+	return QrSegment(Mode::STRUCTURED_APPEND, 0, std::move(bb));
+}
+
+
+QrSegment::QrSegment(Mode md, int numCh, const BitBuffer &dt) :
 		mode(md),
 		numChars(numCh),
 		data(dt) {
@@ -142,7 +281,7 @@ QrSegment::QrSegment(Mode md, int numCh, const std::vector<bool> &dt) :
 }
 
 
-QrSegment::QrSegment(Mode md, int numCh, std::vector<bool> &&dt) :
+QrSegment::QrSegment(Mode md, int numCh, BitBuffer &&dt) :
 		mode(md),
 		numChars(numCh),
 		data(std::move(dt)) {
@@ -197,7 +336,7 @@ int QrSegment::getNumChars() const {
 }
 
 
-const std::vector<bool> &QrSegment::getData() const {
+const BitBuffer &QrSegment::getData() const {
 	return data;
 }
 
@@ -205,6 +344,378 @@ const std::vector<bool> &QrSegment::getData() const {
 const char *QrSegment::ALPHANUMERIC_CHARSET = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
 
 
+const vector<int16_t> &QrSegment::getUnicodeToKanji() {
+	// Inverts KANJI_TO_UNICODE, the kanji value of every code point or -1
+	static const vector<int16_t> table = [] {
+		vector<int16_t> result(0x10000, -1);
+		const char *digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		uint32_t accum = 0;
+		int bits = 0;
+		int kanji = 0;
+		int high = -1;  // First byte of the current 16-bit value
+		for (const char *c = KANJI_TO_UNICODE; *c != '\0' && *c != '='; c++) {
+			accum = accum << 6 | static_cast<uint32_t>(std::strchr(digits, *c) - digits);
+			bits += 6;
+			if (bits < 8)
+				continue;
+			bits -= 8;
+			int byte = static_cast<int>(accum >> bits & 0xFF);
+			if (high == -1) {
+				high = byte;
+				continue;
+			}
+			int codePoint = high << 8 | byte;
+			high = -1;
+			if (codePoint != 0xFFFF)
+				result.at(static_cast<size_t>(codePoint)) = static_cast<int16_t>(kanji);
+			kanji++;
+		}
+		return result;
+	}();
+	return table;
+}
+
+
+const char *QrSegment::KANJI_TO_UNICODE =
+	"MAAwATAC/wz/DjD7/xr/G/8f/wEwmzCcALT/QACo/z7/4/8/MP0w/jCdMJ4wA07dMAUwBjAHMPwgFSAQ/w//PDAcIBb/XCAmICUg"
+	"GCAZIBwgHf8I/wkwFDAV/zv/Pf9b/10wCDAJMAowCzAMMA0wDjAPMBAwEf8LIhIAsQDX//8A9/8dImD/HP8eImYiZyIeIjQmQiZA"
+	"ALAgMiAzIQP/5f8EAKIAo/8F/wP/Bv8K/yAApyYGJgUlyyXPJc4lxyXGJaEloCWzJbIlvSW8IDswEiGSIZAhkSGTMBP/////////"
+	"////////////////////IggiCyKGIocigiKDIioiKf////////////////////8iJyIoAKwh0iHUIgAiA///////////////////"
+	"//////////8iICKlIxIiAiIHImEiUiJqImsiGiI9Ih0iNSIrIiz//////////////////yErIDAmbyZtJmogICAhALb/////////"
+	"/yXv/////////////////////////////////////////////////xD/Ef8S/xP/FP8V/xb/F/8Y/xn///////////////////8h"
+	"/yL/I/8k/yX/Jv8n/yj/Kf8q/yv/LP8t/y7/L/8w/zH/Mv8z/zT/Nf82/zf/OP85/zr///////////////////9B/0L/Q/9E/0X/"
+	"Rv9H/0j/Sf9K/0v/TP9N/07/T/9Q/1H/Uv9T/1T/Vf9W/1f/WP9Z/1r//////////zBBMEIwQzBEMEUwRjBHMEgwSTBKMEswTDBN"
+	"ME4wTzBQMFEwUjBTMFQwVTBWMFcwWDBZMFowWzBcMF0wXjBfMGAwYTBiMGMwZDBlMGYwZzBoMGkwajBrMGwwbTBuMG8wcDBxMHIw"
+	"czB0MHUwdjB3MHgweTB6MHswfDB9MH4wfzCAMIEwgjCDMIQwhTCGMIcwiDCJMIowizCMMI0wjjCPMJAwkTCSMJP/////////////"
+	"////////////////////////MKEwojCjMKQwpTCmMKcwqDCpMKowqzCsMK0wrjCvMLAwsTCyMLMwtDC1MLYwtzC4MLkwujC7MLww"
+	"vTC+ML8wwDDBMMIwwzDEMMUwxjDHMMgwyTDKMMswzDDNMM4wzzDQMNEw0jDTMNQw1TDWMNcw2DDZMNow2zDcMN0w3jDf//8w4DDh"
+	"MOIw4zDkMOUw5jDnMOgw6TDqMOsw7DDtMO4w7zDwMPEw8jDzMPQw9TD2/////////////////////wORA5IDkwOUA5UDlgOXA5gD"
+	"mQOaA5sDnAOdA54DnwOgA6EDowOkA6UDpgOnA6gDqf////////////////////8DsQOyA7MDtAO1A7YDtwO4A7kDugO7A7wDvQO+"
+	"A78DwAPBA8MDxAPFA8YDxwPIA8n/////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////BBAEEQQSBBMEFAQVBAEEFgQXBBgEGQQaBBsEHAQdBB4EHwQgBCEEIgQjBCQEJQQm"
+	"BCcEKAQpBCoEKwQsBC0ELgQv////////////////////////////////////////BDAEMQQyBDMENAQ1BFEENgQ3BDgEOQQ6BDsE"
+	"PAQ9//8EPgQ/BEAEQQRCBEMERARFBEYERwRIBEkESgRLBEwETQROBE///////////////////////////////////yUAJQIlDCUQ"
+	"JRglFCUcJSwlJCU0JTwlASUDJQ8lEyUbJRclIyUzJSslOyVLJSAlLyUoJTclPyUdJTAlJSU4JUL/////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"/////////////////////////////////////06cVRZaA5Y/VMBhG2MoWfaQIoR1gxx6UGCqY+FuJWXthGaCppv1aJNXJ2WhYnFb"
+	"m1nQhnuY9H1ifb6bjmIWfJ+It1uJXrVjCWaXaEiVx5eNZ09O5U8KT01PnVBJVvJZN1nUWgFcCWDfYQ9hcGYTaQVwunVPdXB5+32t"
+	"fe+Aw4QOiGOLApBVkHpTO06VTqVX34CykMF4704AWPFuopA4ejKDKIKLnC9RQVNwVL1U4VbgWftfFZjybeuA5IUt////////lmKW"
+	"cJagl/tUC1PzW4dwz3+9j8KW6FNvnVx6uk4ReJOB/G4mVhhVBGsdhRqcO1nlU6ltZnTclY9WQk6RkEuW8oNPmQxT4VW2WzBfcWYg"
+	"ZvNoBGw4bPNtKXRbdsh6Tpg0gvGIW4pgku1tsnWrdsqZxWCmiwGNipWyaY5TrVGG//9XElgwWURbtF72YChjqWP0bL9vFHCOcRRx"
+	"WXHVcz9+AYJ2gtGFl5BgkludG1hpZbxsWnUlUflZLlllX4Bf3GK8ZfpqKmsna7Rzi3/BiVadLJ0OnsRcoWyWg3tRBFxLYbaBxmh2"
+	"cmFOWU/6U3hgaW4pek+X804LUxZO7k9VTz1PoU9zUqBT71YJWQ9awVu2W+F50WaHZ5xntmtMbLNwa3PCeY15vno8e4eCsYLbgwSD"
+	"d4Pvg9OHZoqyVimMqI/mkE6XHoaKT8Rc6GIRcll1O4Hlgr2G/ozAlsWZE5nVTstPGonjVt5YSljKXvtf62AqYJRgYmHQYhJi0GU5"
+	"////////m0FmZmiwbXdwcHVMdoZ9dYKlh/mVi5aOjJ1R8VK+WRZUs1uzXRZhaGmCba94jYTLiFeKcpOnmrhtbJmohtlXo2f/hs6S"
+	"DlKDVodUBF7TYuFkuWg8aDhru3NyeLp6a4maidKNa48DkO2Vo5aUl2lbZlyzaX2YTZhOY5t7IGor//9qf2i2nA1vX1JyVZ1gcGLs"
+	"bTtuB27RhFuJEI9EThScOVP2aRtqOpeEaCpRXHrDhLKR3JOMVludKGgigwWEMXylUgiCxXTmTn5Pg1GgW9JSClLYUudd+1WaWCpZ"
+	"5luMW5hb215yXnlgo2EfYWNhvmPbZWJn0WhTaPprPmtTbFdvIm+Xb0V0sHUYduN3C3r/e6F8IX3pfzZ/8ICdgmaDnomzisyMq5CE"
+	"lFGVk5WRlaKWZZfTmSiCGE44VCtcuF3Mc6l2THc8XKl/640LlsGYEZhUmFhPAU8OU3FVnFZoV/pZR1sJW8RckF4MXn5fzGPuZzpl"
+	"12XiZx9oy2jE////////al9eMGvFbBdsfXV/eUhbY3oAfQBfvYmPihiMtI13jsyPHZjimg6bPE6AUH1RAFmTW5xiL2KAZOxrOnKg"
+	"dZF5R3+ph/uKvItwY6yDypegVAlUA1WraFRqWIpweCdndZ7NU3RbooEahlCQBk4YTkVOx08RU8pUOFuuXxNgJWVR//9nPWxCbHJs"
+	"43B4dAN6dnquewh9Gnz+fWZl53JbU7tcRV3oYtJi4GMZbiCGWooxjd2S+G8BeaabWk6oTqtOrE+bT6BQ0VFHevZRcVH2U1RTIVN/"
+	"U+tVrFiDXOFfN19KYC9gUGBtYx9lWWpLbMFywnLtd++A+IEFggiFTpD3k+GX/5lXmlpO8FHdXC1mgWltXEBm8ml1c4loUHyBUMVS"
+	"5FdHXf6TJmWkayNrPXQ0eYF5vXtLfcqCuYPMiH+JX4s5j9GR0VQfkoBOXVA2U+VTOnLXc5Z36YLmjq+ZxpnImdJRd2Eahl5VsHp6"
+	"UHZb05BHloVOMmrbkedcUVxI////////Y5h6n2yTl3SPYXqqcYqWiHyCaBd+cGhRk2xS8lQbhauKE3+kjs2Q4VNmiIh5QU/CUL5S"
+	"EVFEVVNXLXPqV4tZUV9iX4RgdWF2YWdhqWOyZDplbGZvaEJuE3Vmej18+31MfZl+S39rgw6DSobNigiKY4tmjv2YGp2PgriPzpvo"
+	"//9Sh2IfZINvwJaZaEFQkWsgbHpvVHp0fVCIQIojZwhO9lA5UCZQZVF8UjhSY1WnVw9YBVrMXvphsmH4YvNjcmkcailyfXKscy54"
+	"FHhvfXl3DICpiYuLGYzijtKQY5N1lnqYVZoTnnhRQ1OfU7Nee18mbhtukHOEc/59Q4I3igCK+pZQTk5QC1PkVHxW+lnRW2Rd8V6r"
+	"XydiOGVFZ69uVnLQfMqItIChgOGD8IZOioeN6JI3lseYZ58TTpROkk8NU0hUSVQ+Wi9fjF+hYJ9op2qOdFp4gYqeiqSLd5GQTl6b"
+	"yU6kT3xPr1AZUBZRSVFsUp9SuVL+U5pT41QR////////VA5ViVdRV6JZfVtUW11bj13lXedd9154XoNeml63XxhgUmFMYpdi2GOn"
+	"ZTtmAmZDZvRnbWghaJdpy2xfbSptaW4vbp11MnaHeGx6P3zgfQV9GH1efbGAFYADgK+AsYFUgY+CKoNSiEyIYYsbjKKM/JDKkXWS"
+	"cXg/kvyVpJZN//+YBZmZmtidO1JbUqtT91QIWNVi92/gjGqPX565UUtSO1RKVv16QJF3nWCe0nNEbwmBcHURX/1g2pqoctuPvGtk"
+	"mANOylbwV2RYvlpaYGhhx2YPZgZoOWixbfd11X06gm6bQk6bT1BTyVUGXW9d5l3uZ/tsmXRzeAKKUJOWiN9XUF6nYytQtVCsUY1n"
+	"AFTJWF5Zu1uwX2liTWOhaD1rc24IcH2Rx3KAeBV4JnltZY59MIPciMGPCZabUmRXKGdQf2qMoVG0V0KWKlg6aYqAtFSyXQ5X/HiV"
+	"nfpPXFJKVItkPmYoZxRn9XqEe1Z9IpMvaFybrXs5UxlRilI3////////W99i9mSuZOZnLWu6hamW0XaQm9ZjTJMGm6t2v2ZSTglQ"
+	"mFPCXHFg6GSSZWNoX3Hmc8p1I3uXfoKGlYuDjNuReJkQZaxmq2uLTtVO1E86T39SOlP4U/JV41bbWOtZy1nJWf9bUFxNXgJeK1/X"
+	"YB1jB2UvW1xlr2W9ZehnnWti//9re2wPc0V5SXnBfPh9GX0rgKKBAoHziZaKXoppimaKjIrujMeM3JbMmPxrb06LTzxPjVFQW1db"
+	"+mFIYwFmQmshbstsu3I+dL111HjBeTqADIAzgeqElI+ebFCef18Pi1idK3r6jvhbjZbrTgNT8Vf3WTFayVukYIluf28Gdb6M6luf"
+	"hQB74FByZ/SCnVxhhUp+HoIOUZlcBGNojWZlnHFueT59F4AFix2OypBuhseQqlAfUvpcOmdTcHxyNZFMkciTK4LlW8JfMWD5TjtT"
+	"1luIYktnMWuKculz4HougWuNo5FSmZZRElPXVGpb/2OIajl9rJcAVtpTzlRo////////W5dcMV3eT+5hAWL+bTJ5wHnLfUJ+TX/S"
+	"ge2CH4SQiEaJcouQjnSPL5AxkUuRbJbGkZxOwE9PUUVTQV+TYg5n1GxBbgtzY34mkc2Sg1PUWRlbv23ReV1+LnybWH5xn1H6iFOP"
+	"8E/KXPtmJXeseuOCHJn/UcZfqmXsaW9riW3z//9ulm9kdv59FF3hkHWRh5gGUeZSHWJAZpFm2W4aXrZ90n9yZviFr4X3ivhSqVPZ"
+	"WXNej1+QYFWS5JZkULdRH1LdUyBTR1PsVOhVRlUxVhdZaFm+WjxbtVwGXA9cEVwaXoReil7gX3Bif2KEYttjjGN3ZgdmDGYtZnZn"
+	"fmiiah9qNWy8bYhuCW5YcTxxJnFndcd3AXhdeQF5ZXnweuB7EXynfTmAloPWhIuFSYhdiPOKH4o8ilSKc4xhjN6RpJJmk36UGJac"
+	"l5hOCk4ITh5OV1GXUnBXzlg0WMxbIl44YMVk/mdhZ1ZtRHK2dXN6Y4S4i3KRuJMgVjFX9Jj+////////Yu1pDWuWce1+VIB3gnKJ"
+	"5pjfh1WPsVw7TzhP4U+1VQdaIFvdW+lfw2FOYy9lsGZLaO5pm214bfF1M3W5dx95XnnmfTOB44KvhaqJqoo6jquPm5Aykd2XB066"
+	"TsFSA1h1WOxcC3UaXD2BTooKj8WWY5dteyWKz5gIkWJW81Oo//+QF1Q5V4JeJWOobDRwindhfIt/4IhwkEKRVJMQkxiWj3RemsRd"
+	"B11pZXBnoo2olttjbmdJaRmDxZgXlsCI/m+EZHpb+E4WcCx1XWYvUcRSNlLiWdNfgWAnYhBlP2V0Zh9mdGjyaBZrY24FcnJ1H3bb"
+	"fL6AVljwiP2Jf4qgipOKy5AdkZKXUpdZZYl6DoEGlrteLWDcYhplpWYUZ5B383pNfE1+PoEKjKyNZI3hjl94qVIHYtljpWRCYpiK"
+	"LXqDe8CKrJbqfXaCDIdJTtlRSFNDU2Bbo1wCXBZd3WImYkdksGgTaDRsyW1FbRdn029ccU5xfWXLen97rX3a////////fkp/qIF6"
+	"ghuCOYWmim6Mzo31kHiQd5KtkpGVg5uuUk1VhG84cTZRaHmFflWBs3zOVkxYUVyoY6pm/mb9aVpy2XWPdY55DnlWed98l30gfUSG"
+	"B4o0ljuQYZ8gUOdSdVPMU+JQCVWqWO5ZT3I9W4tcZFMdYONg82NcY4NjP2O7//9kzWXpZvld42nNaf1vFXHlTol16Xb4epN8333P"
+	"fZyAYYNJg1iEbIS8hfuIxY1wkAGQbZOXlxyaElDPWJdhjoHThTWNCJAgT8NQdFJHU3Ngb2NJZ19uLI2zkB9P11xejMplz32aU1KI"
+	"llF2Y8NbWFtrXApkDWdRkFxO1lkaWSpscIpRVT5YFVmlYPBiU2fBgjVpVZZAmcSaKE9TWAZb/oAQXLFeL1+FYCBhS2I0Zv9s8G7e"
+	"gM6Bf4LUiIuMuJAAkC6Wip7bm9tO41PwWSd7LJGNmEyd+W7dcCdTU1VEW4ViWGKeYtNsom/vdCKKF5Q4b8GK/oM4UeeG+FPq////"
+	"////U+lPRpBUj7BZaoExXf166o+/aNqMN3L4nEhqPYqwTjlTWFYGV2ZixWOiZeZrTm3hbltwrXfteu97qn27gD2AxobLipWTW1bj"
+	"WMdfPmWtZpZqgGu1dTeKx1Akd+VXMF8bYGVmemxgdfR6Gn9ugfSHGJBFmbN7yXVcevl7UYTE//+QEHnpepKDNlrhd0BOLU7yW5lf"
+	"4GK9Zjxn8WzohmuId4o7kU6S85nQahdwJnMqgueEV4yvTgFRRlHLVYtb9V4WXjNegV8UXzVfa1+0YfJjEWaiZx1vbnJSdTp3OoB0"
+	"gTmBeId2ir+K3I2FjfOSmpV3mAKc5VLFY1d29GcVbIhzzYzDk66Wc20lWJxpDmnMj/2TmnXbkBpYWmgCY7Rp+09Dbyxn2I+7hSZ9"
+	"tJNUaT9vcFdqWPdbLH0scipUCpHjnbROrU9OUFxQdVJDjJ5USFgkW5peHV6VXq1e918fYIxitWM6Y9Bor2xAeId5jnoLfeCCR4oC"
+	"iuaORJAT////////kLiRLZHYnw5s5WRYZOJldW70doR7G5Bpk9FuulTyX7lkpI9Nj+2SRFF4WGtZKVxVXpdt+36PdRyMvI7imFtw"
+	"uU8da79vsXUwlvtRTlQQWDVYV1msXGBfkmWXZ1xuIXZ7g9+M7ZAUkP2TTXgleDpSql6mVx9ZdGASUBJRWlGs//9RzVIAVRBYVFhY"
+	"WVdblVz2XYtgvGKVZC1ncWhDaLxo33bXbdhub22bcG9xyF9Tddh5d3tJe1R7UnzWfXFSMIRjhWmF5IoOiwSMRo4PkAOQD5QZlnaY"
+	"LZowldhQzVLVVAxYAlwOYadknm0ed7N65YD0hASQU5KFXOCdB1M/X5dfs22ccnl3Y3m/e+Rr0nLsiq1oA2phUfh6gWk0XEqc9oLr"
+	"W8WRSXAeVnhcb2DHZWZsjIxakEGYE1RRZseSDVlIkKNRhU5NUeqFmYsOcFhjepNLaWKZtH4EdXdTV2lgjt+W42xdToxcPF8Qj+lT"
+	"AozRgImGeV7/ZeVOc1Fl////////WYJcP5fuTvtZil/Nio1v4XmweWJb54RxcytxsV50X/Vje2SaccN8mE5DXvxOS1fcVqJgqW/D"
+	"fQ2A/YEzgb+PsomXhqRd9GKKZK2Jh2d3bOJtPnQ2eDRaRn91gq2ZrE/zXsNi3WOSZVdnb3bDckyAzIC6jymRTVANV/lakmiF//9p"
+	"c3Fkcv2Mt1jyjOCWapAZh3955HfnhClPL1JlU1pizWfPbMp2fXuUfJWCNoWEj+tm3W8gcgZ+G4OrmcGeplH9e7F4cnu4gId7SGro"
+	"XmGAjHVRdWBRa5Jibox2epGXmupPEH9wYpx7T5WlnOlWelhZhuSWvE80UiRTSlPNU9teBmQsZZFnf2w+bE5ySHKvc+11VH5BgiyF"
+	"6Yype8SRxnFpmBKY72M9Zml1anbkeNCFQ4buUypTUVQmWYNeh198YLJiSWJ5YqtlkGvUbMx1snaueJF52H3Lf3eApYirirmMu5B/"
+	"l16Y22oLfDhQmVw+X65nh2vYdDV3CX+O////////nztnynoXUzl1i5rtX2aBnYPxgJhfPF/FdWJ7RpA8aGdZ61qbfRB2fossT/Vf"
+	"amoZbDdvAnTieWiIaIpVjHle32PPdcV50oLXkyiS8oSchu2cLVTBX2xljG1ccBWMp4zTmDtlT3T2Tg1O2FfgWStaZlvMUaheA16c"
+	"YBZidmV3//9lp2ZubW5yNnsmgVCBmoKZi1yMoIzmjXSWHJZET65kq2tmgh6EYYVqkOhcAWlTmKiEeoVXTw9Sb1+pXkVnDXmPgXmJ"
+	"B4mGbfVfF2JVbLhOz3Jpm5JSBlQ7VnRYs2GkYm5xGllufIl83n0blvBlh4BeThlPdVF1WEBeY15zXwpnxE4mhT2ViZZbfHOYAVD7"
+	"WMF2VninUiV3pYURe4ZQT1kJckd7x33oj7qP1JBNT79SyVopXwGXrU/dgheS6lcDY1VraXUriNyPFHpCUt9Yk2FVYgpmrmvNfD+D"
+	"6VAjT/hTBVRGWDFZSVudXPBc710pXpZisWNnZT5luWcL////////bNVs4XD5eDJ+K4DegrOEDITshwKJEooqjEqQppLSmP2c851s"
+	"Tk9OoVCNUlZXSlmoXj1f2F/ZYj9mtGcbZ9Bo0lGSfSGAqoGoiwCMjIy/kn6WMlQgmCxTF1DVU1xYqGSyZzRyZ3dmekaR5lLDbKFr"
+	"hlgAXkxZVGcsf/tR4XbG//9kaXjom1Seu1fLWblmJ2eaa85U6WnZXlWBnGeVm6pn/pxSaF1Opk/jU8hiuWcrbKuPxE+tfm2ev04H"
+	"YWJugG8rhRNUc2cqm0Vd83uVXKxbxoccbkqE0XoUgQhZmXyNbBF3IFLZWSJxIXJfd9uXJ51haQtaf1oYUaVUDVR9Zg5234/3kpic"
+	"9Fnqcl1uxVFNaMl9v33sl2KeumR4aiGDAlmEW19r23MbdvJ9soAXhJlRMmcontl27mdiUv+ZBVwkYjt8foywVU9gtn0LlYBTAU5f"
+	"UbZZHHI6gDaRzl8ld+JThF95fQSFrIozjo2XVmfzha6UU2EJYQhsuXZS////////iu2POFUvT1FRKlLHU8tbpV59YKBhgmPWZwln"
+	"2m5nbYxzNnM3dTF5UIjVipiQSpCRkPWWxIeNWRVOiE9ZTg6KiY8/mBBQrV58WZZbuV64Y9pj+mTBZtxpSmnYbQtutnGUdSh6r3+K"
+	"gACESYTJiYGLIY4KkGWWfZkKYX5ikWsy//9sg210f8x//G3Af4WHuoj4Z2WDsZg8lvdtG31hhD2Rak5xU3VdUGsEb+uFzYYtiadS"
+	"KVQPXGVnTmiodAZ0g3XiiM+I4ZHMluKWeF+Lc4d6y4ROY6B1ZVKJbUFunHQJdVl4a3ySloZ63J+NT7ZhbmXFhlxOhk6uUNpOIVHM"
+	"W+5lmWiBbbxzH3ZCd616HHzngm+K0pB8kc+WdZgYUpt90VArU5hnl23LcdB0M4HojyqWo5xXnp90YFhBbZl9L5heTuRPNk+LUbdS"
+	"sV26YBxzsnk8gtOSNJa3lvaXCp6Xn2Jmpmt0UhdSo3DIiMJeyWBLYZBvI3FJfD599IBv////////hO6QI5MsVEKbb2rTcImMwo3v"
+	"lzJStFpBXspfBGcXaXxplG1qbw9yYnL8e+2AAYB+h0uQzlFtnpN5hICLkzKK1lAtVIyKcWtqjMSBB2DRZ6Cd8k6ZTpicEIprhcGF"
+	"aGkAbn54l4FV////////////////////////////////////////////////////////////////////////////////////////"
+	"/////////////////////////////18MThBOFU4qTjFONk48Tj9OQk5WTlhOgk6FjGtOioISXw1Ojk6eTp9OoE6iTrBOs062Ts5O"
+	"zU7ETsZOwk7XTt5O7U7fTvdPCU9aTzBPW09dT1dPR092T4hPj0+YT3tPaU9wT5FPb0+GT5ZRGE/UT99Pzk/YT9tP0U/aT9BP5E/l"
+	"UBpQKFAUUCpQJVAFTxxP9lAhUClQLE/+T+9QEVAGUENQR2cDUFVQUFBIUFpQVlBsUHhQgFCaUIVQtFCy////////UMlQylCzUMJQ"
+	"1lDeUOVQ7VDjUO5Q+VD1UQlRAVECURZRFVEUURpRIVE6UTdRPFE7UT9RQFFSUUxRVFFievhRaVFqUW5RgFGCVthRjFGJUY9RkVGT"
+	"UZVRllGkUaZRolGpUapRq1GzUbFRslGwUbVRvVHFUclR21HghlVR6VHt//9R8FH1Uf5SBFILUhRSDlInUipSLlIzUjlST1JEUktS"
+	"TFJeUlRSalJ0UmlSc1J/Un1SjVKUUpJScVKIUpGPqI+nUqxSrVK8UrVSwVLNUtdS3lLjUuaY7VLgUvNS9VL4UvlTBlMIdThTDVMQ"
+	"Uw9TFVMaUyNTL1MxUzNTOFNAU0ZTRU4XU0lTTVHWU15TaVNuWRhTe1N3U4JTllOgU6ZTpVOuU7BTtlPDfBKW2VPfZvxx7lPuU+hT"
+	"7VP6VAFUPVRAVCxULVQ8VC5UNlQpVB1UTlSPVHVUjlRfVHFUd1RwVJJUe1SAVHZUhFSQVIZUx1SiVLhUpVSsVMRUyFSo////////"
+	"VKtUwlSkVL5UvFTYVOVU5lUPVRRU/VTuVO1U+lTiVTlVQFVjVUxVLlVcVUVVVlVXVThVM1VdVZlVgFSvVYpVn1V7VX5VmFWeVa5V"
+	"fFWDValVh1WoVdpVxVXfVcRV3FXkVdRWFFX3VhZV/lX9VhtV+VZOVlBx31Y0VjZWMlY4//9Wa1ZkVi9WbFZqVoZWgFaKVqBWlFaP"
+	"VqVWrla2VrRWwla8VsFWw1bAVshWzlbRVtNW11buVvlXAFb/VwRXCVcIVwtXDVcTVxhXFlXHVxxXJlc3VzhXTlc7V0BXT1dpV8BX"
+	"iFdhV39XiVeTV6BXs1ekV6pXsFfDV8ZX1FfSV9NYClfWV+NYC1gZWB1YclghWGJYS1hwa8BYUlg9WHlYhVi5WJ9Yq1i6WN5Yu1i4"
+	"WK5YxVjTWNFY11jZWNhY5VjcWORY31jvWPpY+Vj7WPxY/VkCWQpZEFkbaKZZJVksWS1ZMlk4WT560llVWVBZTllaWVhZYllgWWdZ"
+	"bFlp////////WXhZgVmdT15Pq1mjWbJZxlnoWdxZjVnZWdpaJVofWhFaHFoJWhpaQFpsWklaNVo2WmJaalqaWrxavlrLWsJavVrj"
+	"Wtda5lrpWtZa+lr7WwxbC1sWWzJa0FsqWzZbPltDW0VbQFtRW1VbWltbW2VbaVtwW3NbdVt4ZYhbeluA//9bg1umW7hbw1vHW8lb"
+	"1FvQW+Rb5lviW95b5VvrW/Bb9lvzXAVcB1wIXA1cE1wgXCJcKFw4XDlcQVxGXE5cU1xQXE9bcVxsXG5OYlx2XHlcjFyRXJRZm1yr"
+	"XLtctly8XLdcxVy+XMdc2VzpXP1c+lztXYxc6l0LXRVdF11cXR9dG10RXRRdIl0aXRldGF1MXVJdTl1LXWxdc112XYddhF2CXaJd"
+	"nV2sXa5dvV2QXbddvF3JXc1d013SXdZd213rXfJd9V4LXhpeGV4RXhteNl43XkReQ15AXk5eV15UXl9eYl5kXkdedV52XnqevF5/"
+	"XqBewV7CXshe0F7P////////XtZe417dXtpe217iXuFe6F7pXuxe8V7zXvBe9F74Xv5fA18JX11fXF8LXxFfFl8pXy1fOF9BX0hf"
+	"TF9OXy9fUV9WX1dfWV9hX21fc193X4Nfgl9/X4pfiF+RX4dfnl+ZX5hfoF+oX61fvF/WX/tf5F/4X/Ff3WCzX/9gIWBg//9gGWAQ"
+	"YClgDmAxYBtgFWArYCZgD2A6YFpgQWBqYHdgX2BKYEZgTWBjYENgZGBCYGxga2BZYIFgjWDnYINgmmCEYJtglmCXYJJgp2CLYOFg"
+	"uGDgYNNgtF/wYL1gxmC1YNhhTWEVYQZg9mD3YQBg9GD6YQNhIWD7YPFhDWEOYUdhPmEoYSdhSmE/YTxhLGE0YT1hQmFEYXNhd2FY"
+	"YVlhWmFrYXRhb2FlYXFhX2FdYVNhdWGZYZZhh2GsYZRhmmGKYZFhq2GuYcxhymHJYfdhyGHDYcZhumHLf3lhzWHmYeNh9mH6YfRh"
+	"/2H9Yfxh/mIAYghiCWINYgxiFGIb////////Yh5iIWIqYi5iMGIyYjNiQWJOYl5iY2JbYmBiaGJ8YoJiiWJ+YpJik2KWYtRig2KU"
+	"Ytdi0WK7Ys9i/2LGZNRiyGLcYsxiymLCYsdim2LJYwxi7mLxYydjAmMIYu9i9WNQYz5jTWQcY09jlmOOY4Bjq2N2Y6Njj2OJY59j"
+	"tWNr//9jaWO+Y+ljwGPGY+NjyWPSY/ZjxGQWZDRkBmQTZCZkNmUdZBdkKGQPZGdkb2R2ZE5lKmSVZJNkpWSpZIhkvGTaZNJkxWTH"
+	"ZLtk2GTCZPFk54IJZOBk4WKsZONk72UsZPZk9GTyZPplAGT9ZRhlHGUFZSRlI2UrZTRlNWU3ZTZlOHVLZUhlVmVVZU1lWGVeZV1l"
+	"cmV4ZYJlg4uKZZtln2WrZbdlw2XGZcFlxGXMZdJl22XZZeBl4WXxZ3JmCmYDZftnc2Y1ZjZmNGYcZk9mRGZJZkFmXmZdZmRmZ2Zo"
+	"Zl9mYmZwZoNmiGaOZolmhGaYZp1mwWa5Zslmvma8////////ZsRmuGbWZtpm4GY/ZuZm6WbwZvVm92cPZxZnHmcmZyeXOGcuZz9n"
+	"NmdBZzhnN2dGZ15nYGdZZ2NnZGeJZ3BnqWd8Z2pnjGeLZ6ZnoWeFZ7dn72e0Z+xns2fpZ7hn5GfeZ91n4mfuZ7lnzmfGZ+dqnGge"
+	"aEZoKWhAaE1oMmhO//9os2graFloY2h3aH9on2iPaK1olGidaJtog2quaLlodGi1aKBoumkPaI1ofmkBaMppCGjYaSJpJmjhaQxo"
+	"zWjUaOdo1Wk2aRJpBGjXaONpJWj5aOBo72koaSppGmkjaSFoxml5aXdpXGl4aWtpVGl+aW5pOWl0aT1pWWkwaWFpXmldaYFpammy"
+	"aa5p0Gm/acFp02m+ac5b6GnKad1pu2nDaadqLmmRaaBpnGmVabRp3mnoagJqG2n/awpp+WnyaedqBWmxah5p7WoUaetqCmoSasFq"
+	"I2oTakRqDGpyajZqeGpHamJqWWpmakhqOGoiapBqjWqgaoRqomqj////////apeGF2q7asNqwmq4arNqrGreatFq32qqatpq6mr7"
+	"awWGFmr6axJrFpsxax9rOGs3dtxrOZjua0drQ2tJa1BrWWtUa1trX2tha3hreWt/a4BrhGuDa41rmGuVa55rpGuqa6trr2uya7Fr"
+	"s2u3a7xrxmvLa9Nr32vsa+tr82vv//+evmwIbBNsFGwbbCRsI2xebFVsYmxqbIJsjWyabIFsm2x+bGhsc2ySbJBsxGzxbNNsvWzX"
+	"bMVs3WyubLFsvmy6bNts72zZbOptH4hNbTZtK209bThtGW01bTNtEm0MbWNtk21kbVpteW1ZbY5tlW/kbYVt+W4VbgpttW3HbeZt"
+	"uG3Gbext3m3Mbeht0m3Fbfpt2W3kbdVt6m3ubi1ubm4ubhlucm5fbj5uI25rbitudm5Nbh9uQ246bk5uJG7/bh1uOG6CbqpumG7J"
+	"brdu0269bq9uxG6ybtRu1W6PbqVuwm6fb0FvEXBMbuxu+G7+bz9u8m8xbu9vMm7M////////bz5vE273b4Zvem94b4FvgG9vb1tv"
+	"829tb4JvfG9Yb45vkW/Cb2Zvs2+jb6FvpG+5b8Zvqm/fb9Vv7G/Ub9hv8W/ub9twCXALb/pwEXABcA9v/nAbcBpvdHAdcBhwH3Aw"
+	"cD5wMnBRcGNwmXCScK9w8XCscLhws3CucN9wy3Dd//9w2XEJcP1xHHEZcWVxVXGIcWZxYnFMcVZxbHGPcftxhHGVcahxrHHXcblx"
+	"vnHScclx1HHOceBx7HHncfVx/HH5cf9yDXIQchtyKHItcixyMHIycjtyPHI/ckByRnJLclhydHJ+coJygXKHcpJylnKicqdyuXKy"
+	"csNyxnLEcs5y0nLicuBy4XL5cvdQD3MXcwpzHHMWcx1zNHMvcylzJXM+c05zT57Yc1dzanNoc3BzeHN1c3tzenPIc7NzznO7c8Bz"
+	"5XPuc950onQFdG90JXP4dDJ0OnRVdD90X3RZdEF0XHRpdHB0Y3RqdHZ0fnSLdJ50p3TKdM901HPx////////dOB043TndOl07nTy"
+	"dPB08XT4dPd1BHUDdQV1DHUOdQ11FXUTdR51JnUsdTx1RHVNdUp1SXVbdUZ1WnVpdWR1Z3VrdW11eHV2dYZ1h3V0dYp1iXWCdZR1"
+	"mnWddaV1o3XCdbN1w3W1db11uHW8dbF1zXXKddJ12XXjdd51/nX///91/HYBdfB1+nXydfN2C3YNdgl2H3YndiB2IXYidiR2NHYw"
+	"djt2R3ZIdkZ2XHZYdmF2YnZodml2anZndmx2cHZydnZ2eHZ8doB2g3aIdot2jnaWdpN2mXaadrB2tHa4drl2unbCds121nbSdt52"
+	"4Xbldud26oYvdvt3CHcHdwR3KXckdx53JXcmdxt3N3c4d0d3Wndod2t3W3dld393fnd5d453i3eRd6B3nnewd7Z3uXe/d7x3vXe7"
+	"d8d3zXfXd9p33Hfjd+53/HgMeBJ5JnggeSp4RXiOeHR4hnh8eJp4jHijeLV4qniveNF4xnjLeNR4vni8eMV4ynjs////////eOd4"
+	"2nj9ePR5B3kSeRF5GXkseSt5QHlgeVd5X3laeVV5U3l6eX95inmdeaefS3mqea55s3m5ebp5yXnVeed57HnheeN6CHoNehh6GXog"
+	"eh95gHoxejt6Pno3ekN6V3pJemF6Ynppn516cHp5en16iHqXepV6mHqWeql6yHqw//96tnrFesR6v5CDesd6ynrNes961XrTetl6"
+	"2nrdeuF64nrmeu168HsCew97CnsGezN7GHsZex57NXsoezZ7UHt6ewR7TXsLe0x7RXt1e2V7dHtne3B7cXtse257nXuYe597jXuc"
+	"e5p7i3uSe497XXuZe8t7wXvMe897tHvGe9176XwRfBR75nvlfGB8AHwHfBN783v3fBd8DXv2fCN8J3wqfB98N3wrfD18THxDfFR8"
+	"T3xAfFB8WHxffGR8VnxlfGx8dXyDfJB8pHytfKJ8q3yhfKh8s3yyfLF8rny5fL18wHzFfMJ82HzSfNx84ps7fO988nz0fPZ8+n0G"
+	"////////fQJ9HH0VfQp9RX1LfS59Mn0/fTV9Rn1zfVZ9Tn1yfWh9bn1PfWN9k32JfVt9j319fZt9un2ufaN9tX3Hfb19q349faJ9"
+	"r33cfbh9n32wfdh93X3kfd59+33yfeF+BX4KfiN+IX4SfjF+H34Jfgt+In5GfmZ+O341fjl+Q343//9+Mn46fmd+XX5Wfl5+WX5a"
+	"fnl+an5pfnx+e36DfdV+fY+ufn9+iH6Jfox+kn6QfpN+lH6Wfo5+m36cfzh/On9Ff0x/TX9Of1B/UX9Vf1R/WH9ff2B/aH9pf2d/"
+	"eH+Cf4Z/g3+If4d/jH+Uf55/nX+af6N/r3+yf7l/rn+2f7iLcX/Ff8Z/yn/Vf9R/4X/mf+l/83/5mNyABoAEgAuAEoAYgBmAHIAh"
+	"gCiAP4A7gEqARoBSgFiAWoBfgGKAaIBzgHKAcIB2gHmAfYB/gISAhoCFgJuAk4CagK1RkICsgNuA5YDZgN2AxIDagNaBCYDvgPGB"
+	"G4EpgSOBL4FL////////louBRoE+gVOBUYD8gXGBboFlgWaBdIGDgYiBioGAgYKBoIGVgaSBo4FfgZOBqYGwgbWBvoG4gb2BwIHC"
+	"gbqByYHNgdGB2YHYgciB2oHfgeCB54H6gfuB/oIBggKCBYIHggqCDYIQghaCKYIrgjiCM4JAglmCWIJdglqCX4Jk//+CYoJogmqC"
+	"a4IugnGCd4J4gn6CjYKSgquCn4K7gqyC4YLjgt+C0oL0gvOC+oOTgwOC+4L5gt6DBoLcgwmC2YM1gzSDFoMygzGDQIM5g1CDRYMv"
+	"gyuDF4MYg4WDmoOqg5+DooOWgyODjoOHg4qDfIO1g3ODdYOgg4mDqIP0hBOD64POg/2EA4PYhAuDwYP3hAeD4IPyhA2EIoQgg72E"
+	"OIUGg/uEbYQqhDyFWoSEhHeEa4SthG6EgoRphEaELIRvhHmENYTKhGKEuYS/hJ+E2YTNhLuE2oTQhMGExoTWhKGFIYT/hPSFF4UY"
+	"hSyFH4UVhRSE/IVAhWOFWIVI////////hUGGAoVLhVWFgIWkhYiFkYWKhaiFbYWUhZuF6oWHhZyFd4V+hZCFyYW6hc+FuYXQhdWF"
+	"3YXlhdyF+YYKhhOGC4X+hfqGBoYihhqGMIY/hk1OVYZUhl+GZ4ZxhpOGo4aphqqGi4aMhraGr4bEhsaGsIbJiCOGq4bUht6G6Ybs"
+	"//+G34bbhu+HEocGhwiHAIcDhvuHEYcJhw2G+YcKhzSHP4c3hzuHJYcphxqHYIdfh3iHTIdOh3SHV4doh26HWYdTh2OHaogFh6KH"
+	"n4eCh6+Hy4e9h8CH0JbWh6uHxIezh8eHxoe7h++H8ofgiA+IDYf+h/aH94gOh9KIEYgWiBWIIoghiDGINog5iCeIO4hEiEKIUohZ"
+	"iF6IYohriIGIfoieiHWIfYi1iHKIgoiXiJKIroiZiKKIjYikiLCIv4ixiMOIxIjUiNiI2YjdiPmJAoj8iPSI6IjyiQSJDIkKiROJ"
+	"Q4keiSWJKokriUGJRIk7iTaJOIlMiR2JYIle////////iWaJZIltiWqJb4l0iXeJfomDiYiJiomTiZiJoYmpiaaJrImvibKJuom9"
+	"ib+JwInaidyJ3YnnifSJ+IoDihaKEIoMihuKHYolijaKQYpbilKKRopIinyKbYpsimKKhYqCioSKqIqhipGKpYqmipqKo4rEis2K"
+	"woraiuuK84rn//+K5IrxixSK4IriiveK3orbiwyLB4saiuGLFosQixeLIIszl6uLJosriz6LKItBi0yLT4tOi0mLVotbi1qLa4tf"
+	"i2yLb4t0i32LgIuMi46LkouTi5aLmYuajDqMQYw/jEiMTIxOjFCMVYxijGyMeIx6jIKMiYyFjIqMjYyOjJSMfIyYYh2MrYyqjL2M"
+	"soyzjK6MtozIjMGM5IzjjNqM/Yz6jPuNBI0FjQqNB40PjQ2NEJ9OjROMzY0UjRaNZ41tjXGNc42BjZmNwo2+jbqNz43ajdaNzI3b"
+	"jcuN6o3rjd+N4438jgiOCY3/jh2OHo4Qjh+OQo41jjCONI5K////////jkeOSY5MjlCOSI5ZjmSOYI4qjmOOVY52jnKOfI6BjoeO"
+	"hY6EjouOio6TjpGOlI6ZjqqOoY6sjrCOxo6xjr6OxY7IjsuO247jjvyO+47rjv6PCo8FjxWPEo8ZjxOPHI8fjxuPDI8mjzOPO485"
+	"j0WPQo8+j0yPSY9Gj06PV49c//+PYo9jj2SPnI+fj6OPrY+vj7eP2o/lj+KP6o/vkIeP9JAFj/mP+pARkBWQIZANkB6QFpALkCeQ"
+	"NpA1kDmP+JBPkFCQUZBSkA6QSZA+kFaQWJBekGiQb5B2lqiQcpCCkH2QgZCAkIqQiZCPkKiQr5CxkLWQ4pDkYkiQ25ECkRKRGZEy"
+	"kTCRSpFWkViRY5FlkWmRc5FykYuRiZGCkaKRq5GvkaqRtZG0kbqRwJHBkcmRy5HQkdaR35HhkduR/JH1kfaSHpH/khSSLJIVkhGS"
+	"XpJXkkWSSZJkkkiSlZI/kkuSUJKckpaSk5KbklqSz5K5kreS6ZMPkvqTRJMu////////kxmTIpMakyOTOpM1kzuTXJNgk3yTbpNW"
+	"k7CTrJOtk5STuZPWk9eT6JPlk9iTw5Pdk9CTyJPklBqUFJQTlAOUB5QQlDaUK5Q1lCGUOpRBlFKURJRblGCUYpRelGqSKZRwlHWU"
+	"d5R9lFqUfJR+lIGUf5WClYeVipWUlZaVmJWZ//+VoJWolaeVrZW8lbuVuZW+lcpv9pXDlc2VzJXVldSV1pXcleGV5ZXiliGWKJYu"
+	"li+WQpZMlk+WS5Z3llyWXpZdll+WZpZylmyWjZaYlpWWl5aqlqeWsZaylrCWtJa2lriWuZbOlsuWyZbNiU2W3JcNltWW+ZcElwaX"
+	"CJcTlw6XEZcPlxaXGZcklyqXMJc5lz2XPpdEl0aXSJdCl0mXXJdgl2SXZpdoUtKXa5dxl3mXhZd8l4GXepeGl4uXj5eQl5yXqJem"
+	"l6OXs5e0l8OXxpfIl8uX3Jftn0+X8nrfl/aX9ZgPmAyYOJgkmCGYN5g9mEaYT5hLmGuYb5hw////////mHGYdJhzmKqYr5ixmLaY"
+	"xJjDmMaY6ZjrmQOZCZkSmRSZGJkhmR2ZHpkkmSCZLJkumT2ZPplCmUmZRZlQmUuZUZlSmUyZVZmXmZiZpZmtma6ZvJnfmduZ3ZnY"
+	"mdGZ7ZnumfGZ8pn7mfiaAZoPmgWZ4poZmiuaN5pFmkKaQJpD//+aPppVmk2aW5pXml+aYpplmmSaaZprmmqarZqwmryawJrPmtGa"
+	"05rUmt6a35rimuOa5prvmuua7pr0mvGa95r7mwabGJsamx+bIpsjmyWbJ5somymbKpsumy+bMptEm0ObT5tNm06bUZtYm3Sbk5uD"
+	"m5GblpuXm5+boJuom7SbwJvKm7mbxpvPm9Gb0pvjm+Kb5JvUm+GcOpvym/Gb8JwVnBScCZwTnAycBpwInBKcCpwEnC6cG5wlnCSc"
+	"IZwwnEecMpxGnD6cWpxgnGecdpx4nOec7JzwnQmdCJzrnQOdBp0qnSadr50jnR+dRJ0VnRKdQZ0/nT6dRp1I////////nV2dXp1k"
+	"nVGdUJ1ZnXKdiZ2Hnaudb516nZqdpJ2pnbKdxJ3BnbuduJ26ncadz53Cndmd0534nead7Z3vnf2eGp4bnh6edZ55nn2egZ6Inoue"
+	"jJ6SnpWekZ6dnqWeqZ64nqqerZdhnsyezp7PntCe1J7cnt6e3Z7gnuWe6J7v//+e9J72nvee+Z77nvye/Z8Hnwh2t58VnyGfLJ8+"
+	"n0qfUp9Un2OfX59gn2GfZp9nn2yfap93n3Kfdp+Vn5yfoFgvaceQWXRkUdxxmf//////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"////////////////////////////////////////////////////////////////////////////////////////////////////"
+	"/////////////////////////////////////////////w==";
+
+
+
+struct QrCode::EncodeScratch final {
+	BitBuffer bits;
+	vector<uint8_t> dataCodewords;
+	vector<uint8_t> allCodewords;
+	vector<uint64_t> isFunction;
+};
+
+
+class QrCode::MaskPool final {
+	
+	// The smallest version whose masks are worth handing to the workers; below it
+	// the wake-ups cost more than the scoring they would save
+	public: static const int MIN_POOLED_VERSION = 15;
+	
+	// The 8 masks of one grid, scored by the caller and any idle workers
+	private: struct Job final {
+		const Grid *grid;
+		long penalties[8];
+		int next;  // The next mask to score
+		int done;  // The number of masks scored
+	};
+	
+	
+	// Returns the pool, started on the first call, with no workers on a single core
+	public: static MaskPool &instance() {
+		static MaskPool pool(std::min(std::thread::hardware_concurrency(), 8U));
+		return pool;
+	}
+	
+	
+	// The threads scoring along with the caller, one less than the usable cores
+	private: explicit MaskPool(unsigned int cores) :
+			stopping(false) {
+		size_t words = static_cast<size_t>(QrCode::MAX_VERSION * 4 + 17) * ((QrCode::MAX_VERSION * 4 + 17 + 63) / 64);
+		for (unsigned int i = 1; i < cores; i++)
+			workers.emplace_back(&MaskPool::work, this, words);
+	}
+	
+	
+	public: ~MaskPool() {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread &worker : workers)
+			worker.join();
+	}
+	
+	
+	public: bool hasWorkers() const {
+		return !workers.empty();
+	}
+	
+	
+	// Scores the 8 masks of the grid, which is only read, into penalties
+	public: void score(const Grid &grid, long penalties[8]) {
+		Job job{&grid, {}, 0, 0};
+		size_t words = static_cast<size_t>(grid.size) * static_cast<size_t>(grid.rowWords);
+		vector<uint64_t> buffer(words * 2);
+		vector<uint64_t> columns(words);
+		std::unique_lock<std::mutex> guard(lock);
+		jobs.push_back(&job);
+		wake.notify_all();
+		// The caller scores masks too, so the job finishes even when all the workers are busy
+		while (job.next < 8) {
+			int msk = take(job);
+			guard.unlock();
+			long penalty = getMaskPenaltyScore(grid, msk, buffer.data(), columns.data());
+			guard.lock();
+			job.penalties[msk] = penalty;
+			job.done++;
+		}
+		finished.wait(guard, [&job] { return job.done == 8; });
+		std::copy(job.penalties, job.penalties + 8, penalties);
+	}
+	
+	
+	// Returns the next mask of the job, and dequeues the job once all are taken
+	private: int take(Job &job) {
+		int msk = job.next++;
+		if (job.next == 8)
+			jobs.erase(std::find(jobs.begin(), jobs.end(), &job));
+		return msk;
+	}
+	
+	
+	// The loop of one worker, with its own buffers for the largest version
+	private: void work(size_t words) {
+		vector<uint64_t> buffer(words * 2);
+		vector<uint64_t> columns(words);
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+			if (stopping)
+				return;
+			Job &job = *jobs.front();
+			int msk = take(job);
+			guard.unlock();
+			long penalty = getMaskPenaltyScore(*job.grid, msk, buffer.data(), columns.data());
+			guard.lock();
+			job.penalties[msk] = penalty;
+			if (++job.done == 8)
+				finished.notify_all();
+		}
+	}
+	
+	
+	private: vector<std::thread> workers;
+	private: std::deque<Job*> jobs;  // The jobs with masks not yet taken
+	private: bool stopping;
+	private: std::mutex lock;  // Guards jobs, stopping and the counters of every job
+	private: std::condition_variable wake;
+	private: std::condition_variable finished;
+	
+};
+
 
 int QrCode::getFormatBits(Ecc ecl) {
 	switch (ecl) {
@@ -217,9 +728,32 @@ int QrCode::getFormatBits(Ecc ecl) {
 }
 
 
-QrCode QrCode::encodeText(const char *text, Ecc ecl) {
-	vector<QrSegment> segs = QrSegment::makeSegments(text);
-	return encodeSegments(segs, ecl);
+QrCode QrCode::encodeText(const char *text, Ecc ecl, EncodeStats *stats) {
+	EncodeScratch scratch;
+	if (stats != nullptr)
+		*stats = EncodeStats();
+	return encodeText(text, ecl, stats, scratch);
+}
+
+
+QrCode QrCode::encodeText(const char *text, Ecc ecl, EncodeStats *stats, EncodeScratch &scratch) {
+	std::chrono::steady_clock::time_point lap;
+	if (stats != nullptr)
+		lap = std::chrono::steady_clock::now();
+	// The optimal segments depend on the widths of the character count fields, which
+	// change after versions 9 and 26. The first range whose optimal segments fit its
+	// last version holds the smallest version the text fits
+	const int rangeEnds[] = {9, 26, MAX_VERSION};
+	vector<QrSegment> segs;
+	for (int end : rangeEnds) {
+		segs = QrSegment::makeSegmentsOptimally(text, end);
+		int dataUsedBits = QrSegment::getTotalBits(segs, end);
+		if (dataUsedBits != -1 && dataUsedBits <= getNumDataCodewords(end, ecl) * 8)
+			break;
+	}
+	if (stats != nullptr)
+		stats->segmentNs += getLapNs(lap);
+	return encodeSegments(segs, ecl, MIN_VERSION, MAX_VERSION, -1, true, false, stats, scratch);  // Throws data_too_long if nothing fits
 }
 
 
@@ -229,10 +763,265 @@ QrCode QrCode::encodeBinary(const vector<uint8_t> &data, Ecc ecl) {
 }
 
 
-QrCode QrCode::encodeSegments(const vector<QrSegment> &segs, Ecc ecl,
+bool QrCode::encodeText(const char *text, Ecc ecl, uint8_t *tempBuffer, uint8_t *qrcodeOut,
 		int minVersion, int maxVersion, int mask, bool boostEcl) {
 	if (!(MIN_VERSION <= minVersion && minVersion <= maxVersion && maxVersion <= MAX_VERSION) || mask < -1 || mask > 7)
 		throw std::invalid_argument("Invalid value");
+	qrcodeOut[0] = 0;
+	
+	// The whole text in one segment, of the most compact mode it allows
+	size_t numChars = std::strlen(text);
+	const QrSegment::Mode *mode;
+	long dataBits;
+	if (QrSegment::isNumeric(text)) {
+		mode = &QrSegment::Mode::NUMERIC;
+		dataBits = static_cast<long>(numChars / 3 * 10 + (numChars % 3 == 0 ? 0 : numChars % 3 * 3 + 1));
+	} else if (QrSegment::isAlphanumeric(text)) {
+		mode = &QrSegment::Mode::ALPHANUMERIC;
+		dataBits = static_cast<long>(numChars / 2 * 11 + numChars % 2 * 6);
+	} else {
+		mode = &QrSegment::Mode::BYTE;
+		dataBits = static_cast<long>(numChars * 8);
+	}
+	
+	// Find the minimal version number to use
+	int version;
+	long dataUsedBits;
+	for (version = minVersion; ; version++) {
+		int ccBits = mode->numCharCountBits(version);
+		dataUsedBits = 4 + ccBits + dataBits;
+		if (numChars < (static_cast<size_t>(1) << ccBits) && dataUsedBits <= getNumDataCodewords(version, ecl) * 8L)
+			break;  // This version number is found to be suitable
+		if (version >= maxVersion)
+			return false;
+	}
+	
+	// Increase the error correction level while the data still fits in the current version number
+	for (Ecc newEcl : {Ecc::MEDIUM, Ecc::QUARTILE, Ecc::HIGH}) {  // From low to high
+		if (boostEcl && dataUsedBits <= getNumDataCodewords(version, newEcl) * 8L)
+			ecl = newEcl;
+	}
+	
+	// Carve the temporary buffer: the module grid, the function module marks and the
+	// transposed grid, aligned for 64-bit words, then the data and all codewords
+	int size = version * 4 + 17;
+	int rowWords = (size + 63) / 64;
+	int gridWords = size * rowWords;
+	uint64_t *words = reinterpret_cast<uint64_t*>((reinterpret_cast<std::uintptr_t>(tempBuffer) + 7) & ~static_cast<std::uintptr_t>(7));
+	Grid grid{words, words + gridWords, version, size, rowWords, ecl};
+	uint64_t *columns = words + 2 * gridWords;
+	uint8_t *dataCodewords = reinterpret_cast<uint8_t*>(columns + gridWords);
+	size_t numDataCodewords = static_cast<size_t>(getNumDataCodewords(version, ecl));
+	uint8_t *allCodewords = dataCodewords + numDataCodewords;
+	
+	// Write the data bit string: segment header, data, terminator and padding
+	std::fill(dataCodewords, dataCodewords + numDataCodewords, 0);
+	size_t bitLen = 0;
+	auto appendBits = [dataCodewords, &bitLen](uint32_t val, int len) {
+		for (int i = len - 1; i >= 0; i--, bitLen++)
+			dataCodewords[bitLen >> 3] |= static_cast<uint8_t>(((val >> i) & 1) << (7 - (bitLen & 7)));
+	};
+	appendBits(static_cast<uint32_t>(mode->getModeBits()), 4);
+	appendBits(static_cast<uint32_t>(numChars), mode->numCharCountBits(version));
+	if (mode == &QrSegment::Mode::NUMERIC) {
+		for (size_t i = 0; i < numChars; i += 3) {  // Groups of 3 digits in 10 bits, the rest in 7 or 4
+			int n = static_cast<int>(std::min(numChars - i, static_cast<size_t>(3)));
+			uint32_t accum = 0;
+			for (int j = 0; j < n; j++)
+				accum = accum * 10 + static_cast<uint32_t>(text[i + static_cast<size_t>(j)] - '0');
+			appendBits(accum, n * 3 + 1);
+		}
+	} else if (mode == &QrSegment::Mode::ALPHANUMERIC) {
+		for (size_t i = 0; i < numChars; i += 2) {  // Pairs of characters in 11 bits, the last one in 6
+			uint32_t accum = static_cast<uint32_t>(std::strchr(QrSegment::ALPHANUMERIC_CHARSET, text[i]) - QrSegment::ALPHANUMERIC_CHARSET);
+			if (i + 1 < numChars) {
+				accum = accum * 45 + static_cast<uint32_t>(std::strchr(QrSegment::ALPHANUMERIC_CHARSET, text[i + 1]) - QrSegment::ALPHANUMERIC_CHARSET);
+				appendBits(accum, 11);
+			} else
+				appendBits(accum, 6);
+		}
+	} else {
+		for (size_t i = 0; i < numChars; i++)
+			appendBits(static_cast<uint8_t>(text[i]), 8);
+	}
+	if (bitLen != static_cast<size_t>(dataUsedBits))
+		throw std::logic_error("Assertion error");
+	size_t dataCapacityBits = numDataCodewords * 8;
+	bitLen += std::min(static_cast<size_t>(4), dataCapacityBits - bitLen);
+	bitLen = (bitLen + 7) / 8 * 8;
+	for (uint8_t padByte = 0xEC; bitLen < dataCapacityBits; padByte ^= 0xEC ^ 0x11)
+		appendBits(padByte, 8);
+	
+	// Compute ECC, draw modules
+	addEccAndInterleave(version, ecl, dataCodewords, allCodewords);
+	std::fill(words, words + 2 * gridWords, 0);
+	drawFunctionPatterns(grid);
+	drawCodewords(grid, allCodewords, static_cast<size_t>(getNumRawDataModules(version) / 8));
+	
+	// Do masking
+	if (mask == -1) {  // Automatically choose best mask
+		long minPenalty = LONG_MAX;
+		for (int i = 0; i < 8; i++) {
+			applyMask(grid, i);
+			drawFormatBits(grid, i);
+			long penalty = getPenaltyScore(grid, columns);
+			if (penalty < minPenalty) {
+				mask = i;
+				minPenalty = penalty;
+			}
+			applyMask(grid, i);  // Undoes the mask due to XOR
+		}
+	}
+	applyMask(grid, mask);
+	drawFormatBits(grid, mask);
+	
+	// Copy the modules out, one bit each
+	size_t outBytes = (static_cast<size_t>(size * size) + 7) / 8;
+	std::fill(qrcodeOut + 1, qrcodeOut + 1 + outBytes, 0);
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			if (((grid.modules[y * rowWords + (x >> 6)] >> (x & 63)) & 1) != 0) {
+				size_t i = static_cast<size_t>(y * size + x);
+				qrcodeOut[1 + (i >> 3)] |= static_cast<uint8_t>(1 << (i & 7));
+			}
+		}
+	}
+	qrcodeOut[0] = static_cast<uint8_t>(size);
+	return true;
+}
+
+
+int QrCode::getSize(const uint8_t *qrcode) {
+	return qrcode[0];
+}
+
+
+bool QrCode::getModule(const uint8_t *qrcode, int x, int y) {
+	int size = qrcode[0];
+	if (x < 0 || x >= size || y < 0 || y >= size)
+		return false;
+	size_t i = static_cast<size_t>(y * size + x);
+	return ((qrcode[1 + (i >> 3)] >> (i & 7)) & 1) != 0;
+}
+
+
+template <typename Encode>
+vector<QrCode> QrCode::encodeParallel(size_t count, int threads, Encode encode) {
+	if (threads < 0)
+		throw std::domain_error("Thread count out of range");
+	vector<QrCode> result;
+	if (count == 0)
+		return result;
+	size_t workers = threads > 0 ? static_cast<size_t>(threads) : std::thread::hardware_concurrency();
+	workers = std::max(static_cast<size_t>(1), std::min(workers, count));
+	
+	// Each worker encodes one contiguous chunk of the codes with its own scratch buffers
+	auto encodeChunk = [&encode](size_t begin, size_t end) {
+		EncodeScratch scratch;
+		vector<QrCode> chunk;
+		chunk.reserve(end - begin);
+		for (size_t i = begin; i < end; i++)
+			chunk.push_back(encode(i, scratch));
+		return chunk;
+	};
+	vector<std::future<vector<QrCode> > > chunks;
+	for (size_t w = 0; w < workers; w++) {
+		size_t begin = count * w / workers;
+		size_t end = count * (w + 1) / workers;
+		chunks.push_back(std::async(std::launch::async, encodeChunk, begin, end));
+	}
+	result.reserve(count);
+	for (std::future<vector<QrCode> > &chunk : chunks) {
+		vector<QrCode> codes = chunk.get();
+		std::move(codes.begin(), codes.end(), std::back_inserter(result));
+	}
+	return result;
+}
+
+
+vector<QrCode> QrCode::encodeBatch(const vector<std::string> &texts, Ecc ecl, int threads) {
+	return encodeParallel(texts.size(), threads, [&texts, ecl](size_t i, EncodeScratch &scratch) {
+		return encodeText(texts[i].c_str(), ecl, nullptr, scratch);
+	});
+}
+
+
+vector<QrCode> QrCode::encodeStructuredAppend(const char *text, Ecc ecl, int maxVersion, int threads) {
+	if (maxVersion < MIN_VERSION || maxVersion > MAX_VERSION)
+		throw std::domain_error("Version value out of range");
+	if (threads < 0)
+		throw std::domain_error("Thread count out of range");
+	std::string whole(text);
+	int capacityBits = getNumDataCodewords(maxVersion, ecl) * 8;
+	int bits = QrSegment::getTotalBits(QrSegment::makeSegmentsOptimally(text, maxVersion), maxVersion);
+	if (bits != -1 && bits <= capacityBits)  // Then encodeText() picks a version up to maxVersion
+		return vector<QrCode>{encodeText(text, ecl)};
+	
+	// Positions where the text may be cut, the start of every UTF-8 character and the end
+	vector<size_t> cuts;
+	for (size_t i = 0; i < whole.size(); i++) {
+		if ((static_cast<uint8_t>(whole[i]) & 0xC0) != 0x80)
+			cuts.push_back(i);
+	}
+	cuts.push_back(whole.size());
+	
+	// Cut greedily, the longest part whose segments and the 20-bit header fit maxVersion.
+	// The fewest bits of a part only grow with its length, so a binary search finds it
+	vector<vector<QrSegment> > parts;
+	for (size_t begin = 0; begin + 1 < cuts.size(); ) {
+		size_t low = begin;  // The longest part known to fit ends at cuts[low]
+		size_t high = cuts.size();  // The shortest part known not to fit ends at cuts[high]
+		vector<QrSegment> fitting;
+		while (high - low > 1) {
+			size_t mid = (low + high) / 2;
+			std::string part = whole.substr(cuts[begin], cuts[mid] - cuts[begin]);
+			vector<QrSegment> segs = QrSegment::makeSegmentsOptimally(part.c_str(), maxVersion);
+			int used = QrSegment::getTotalBits(segs, maxVersion);
+			if (used != -1 && used + 20 <= capacityBits) {
+				low = mid;
+				fitting = std::move(segs);
+			} else
+				high = mid;
+		}
+		if (low == begin)
+			throw data_too_long("A character does not fit in one symbol");
+		parts.push_back(std::move(fitting));
+		begin = low;
+		if (parts.size() == 16 && begin + 1 < cuts.size()) {
+			std::ostringstream sb;
+			sb << "Data length = " << whole.size() << " bytes, more than 16 symbols of version " << maxVersion;
+			throw data_too_long(sb.str());
+		}
+	}
+	
+	int parity = 0;
+	for (char c : whole)
+		parity ^= static_cast<uint8_t>(c);
+	int total = static_cast<int>(parts.size());
+	return encodeParallel(parts.size(), threads, [&parts, ecl, maxVersion, total, parity](size_t i, EncodeScratch &scratch) {
+		vector<QrSegment> segs{QrSegment::makeStructuredAppend(static_cast<int>(i), total, parity)};
+		segs.insert(segs.end(), parts[i].begin(), parts[i].end());
+		return encodeSegments(segs, ecl, MIN_VERSION, maxVersion, -1, true, false, nullptr, scratch);
+	});
+}
+
+
+QrCode QrCode::encodeSegments(const vector<QrSegment> &segs, Ecc ecl,
+		int minVersion, int maxVersion, int mask, bool boostEcl, bool parallelMask, EncodeStats *stats) {
+	EncodeScratch scratch;
+	if (stats != nullptr)
+		*stats = EncodeStats();
+	return encodeSegments(segs, ecl, minVersion, maxVersion, mask, boostEcl, parallelMask, stats, scratch);
+}
+
+
+QrCode QrCode::encodeSegments(const vector<QrSegment> &segs, Ecc ecl,
+		int minVersion, int maxVersion, int mask, bool boostEcl, bool parallelMask, EncodeStats *stats, EncodeScratch &scratch) {
+	if (!(MIN_VERSION <= minVersion && minVersion <= maxVersion && maxVersion <= MAX_VERSION) || mask < -1 || mask > 7)
+		throw std::invalid_argument("Invalid value");
+	std::chrono::steady_clock::time_point lap;
+	if (stats != nullptr)
+		lap = std::chrono::steady_clock::now();
 	
 	// Find the minimal version number to use
 	int version, dataUsedBits;
@@ -262,11 +1051,12 @@ QrCode QrCode::encodeSegments(const vector<QrSegment> &segs, Ecc ecl,
 	}
 	
 	// Concatenate all segments to create the data bit string
-	BitBuffer bb;
+	BitBuffer &bb = scratch.bits;
+	bb.clear();
 	for (const QrSegment &seg : segs) {
 		bb.appendBits(static_cast<uint32_t>(seg.getMode().getModeBits()), 4);
 		bb.appendBits(static_cast<uint32_t>(seg.getNumChars()), seg.getMode().numCharCountBits(version));
-		bb.insert(bb.end(), seg.getData().begin(), seg.getData().end());
+		bb.appendData(seg.getData());
 	}
 	if (bb.size() != static_cast<unsigned int>(dataUsedBits))
 		throw std::logic_error("Assertion error");
@@ -284,56 +1074,140 @@ QrCode QrCode::encodeSegments(const vector<QrSegment> &segs, Ecc ecl,
 	for (uint8_t padByte = 0xEC; bb.size() < dataCapacityBits; padByte ^= 0xEC ^ 0x11)
 		bb.appendBits(padByte, 8);
 	
-	// Pack bits into bytes in big endian
-	vector<uint8_t> dataCodewords(bb.size() / 8);
-	for (size_t i = 0; i < bb.size(); i++)
-		dataCodewords[i >> 3] |= (bb.at(i) ? 1 : 0) << (7 - (i & 7));
+	// The bits are already packed into bytes in big endian
+	vector<uint8_t> &dataCodewords = scratch.dataCodewords;
+	dataCodewords.assign(bb.getBytes().begin(), bb.getBytes().end());
+	if (stats != nullptr)
+		stats->segmentNs += getLapNs(lap);
 	
 	// Create the QR Code object
-	return QrCode(version, ecl, dataCodewords, mask);
+	return QrCode(version, ecl, dataCodewords, mask, parallelMask, stats, scratch);
+}
+
+
+QrCode::QrCode(int ver, Ecc ecl, const vector<uint8_t> &dataCodewords, int msk, bool parallelMask) :
+		// Initialize fields
+		version(ver),
+		errorCorrectionLevel(ecl) {
+	EncodeScratch scratch;
+	build(dataCodewords, msk, parallelMask, nullptr, scratch);
 }
 
 
-QrCode::QrCode(int ver, Ecc ecl, const vector<uint8_t> &dataCodewords, int msk) :
-		// Initialize fields and check arguments
+QrCode::QrCode(int ver, Ecc ecl, const vector<uint8_t> &dataCodewords, int msk, bool parallelMask,
+		EncodeStats *stats, EncodeScratch &scratch) :
+		// Initialize fields
 		version(ver),
 		errorCorrectionLevel(ecl) {
+	build(dataCodewords, msk, parallelMask, stats, scratch);
+}
+
+
+QrCode::QrCode(int ver) :
+		version(ver),
+		errorCorrectionLevel(Ecc::LOW),
+		mask(0) {
 	if (ver < MIN_VERSION || ver > MAX_VERSION)
 		throw std::domain_error("Version value out of range");
+	size = ver * 4 + 17;
+	rowWords = (size + 63) / 64;
+	size_t words = static_cast<size_t>(size) * static_cast<size_t>(rowWords);
+	modules    = vector<uint64_t>(words);
+	isFunction = vector<uint64_t>(words);
+	drawFunctionPatterns(getGrid());
+}
+
+
+void QrCode::build(const vector<uint8_t> &dataCodewords, int msk, bool parallelMask,
+		EncodeStats *stats, EncodeScratch &scratch) {
+	// Check arguments
+	if (version < MIN_VERSION || version > MAX_VERSION)
+		throw std::domain_error("Version value out of range");
 	if (msk < -1 || msk > 7)
 		throw std::domain_error("Mask value out of range");
-	size = ver * 4 + 17;
-	size_t sz = static_cast<size_t>(size);
-	modules    = vector<vector<bool> >(sz, vector<bool>(sz));  // Initially all white
-	isFunction = vector<vector<bool> >(sz, vector<bool>(sz));
+	std::chrono::steady_clock::time_point lap;
+	if (stats != nullptr) {
+		lap = std::chrono::steady_clock::now();
+		std::fill(stats->maskPenalties, stats->maskPenalties + 8, -1);
+	}
+	size = version * 4 + 17;
+	rowWords = (size + 63) / 64;
+	const VersionLayout &layout = getVersionLayout(version);
+	modules = layout.modules;  // The function patterns, the data modules initially all white
+	isFunction.swap(scratch.isFunction);  // Borrowed from the scratch buffers until the end
+	isFunction.assign(layout.isFunction.begin(), layout.isFunction.end());
 	
 	// Compute ECC, draw modules
-	drawFunctionPatterns();
-	const vector<uint8_t> allCodewords = addEccAndInterleave(dataCodewords);
-	drawCodewords(allCodewords);
+	if (stats != nullptr)
+		stats->drawNs += getLapNs(lap);
+	addEccAndInterleave(dataCodewords, scratch.allCodewords);
+	if (stats != nullptr)
+		stats->eccNs += getLapNs(lap);
+	drawCodewords(scratch.allCodewords);
+	if (stats != nullptr)
+		stats->drawNs += getLapNs(lap);
 	
 	// Do masking
-	if (msk == -1) {  // Automatically choose best mask
+	if (msk == -1 && parallelMask && version >= MaskPool::MIN_POOLED_VERSION && MaskPool::instance().hasWorkers()) {
+		// Automatically choose best mask, scoring each on a copy in the worker threads
+		long penalties[8];
+		MaskPool::instance().score(getGrid(), penalties);
+		long minPenalty = LONG_MAX;
+		for (int i = 0; i < 8; i++) {
+			long penalty = penalties[i];
+			if (stats != nullptr)
+				stats->maskPenalties[i] = penalty;
+			if (penalty < minPenalty) {
+				msk = i;
+				minPenalty = penalty;
+			}
+		}
+		if (stats != nullptr)
+			stats->penaltyNs += getLapNs(lap);
+	} else if (msk == -1) {  // Automatically choose best mask
+		Grid grid = getGrid();
+		vector<uint64_t> columns(modules.size());
 		long minPenalty = LONG_MAX;
 		for (int i = 0; i < 8; i++) {
-			applyMask(i);
-			drawFormatBits(i);
-			long penalty = getPenaltyScore();
+			applyMask(grid, i);
+			drawFormatBits(grid, i);
+			if (stats != nullptr)
+				stats->maskNs += getLapNs(lap);
+			long penalty = getPenaltyScore(grid, columns.data());
+			if (stats != nullptr) {
+				stats->penaltyNs += getLapNs(lap);
+				stats->maskPenalties[i] = penalty;
+			}
 			if (penalty < minPenalty) {
 				msk = i;
 				minPenalty = penalty;
 			}
-			applyMask(i);  // Undoes the mask due to XOR
+			applyMask(grid, i);  // Undoes the mask due to XOR
 		}
 	}
 	if (msk < 0 || msk > 7)
 		throw std::logic_error("Assertion error");
 	this->mask = msk;
-	applyMask(msk);  // Apply the final choice of mask
-	drawFormatBits(msk);  // Overwrite old format bits
+	applyMask(getGrid(), msk);  // Apply the final choice of mask
+	drawFormatBits(getGrid(), msk);  // Overwrite old format bits
 	
+	scratch.isFunction.swap(isFunction);  // Discarded by this object, kept for the next encode
 	isFunction.clear();
 	isFunction.shrink_to_fit();
+	if (stats != nullptr) {
+		stats->maskNs += getLapNs(lap);
+		stats->version = version;
+		stats->errorCorrectionLevel = errorCorrectionLevel;
+		stats->mask = mask;
+	}
+}
+
+
+long QrCode::getLapNs(std::chrono::steady_clock::time_point &lap) {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	long result = static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - lap).count());
+	lap = now;
+	return result;
 }
 
 
@@ -363,65 +1237,308 @@ bool QrCode::getModule(int x, int y) const {
 
 
 std::string QrCode::toSvgString(int border) const {
+	std::string result(toSvg(nullptr, 0, border), '\0');
+	toSvg(&result[0], result.size(), border);
+	return result;
+}
+
+
+struct QrCode::RenderBuffer final {
+	uint8_t *buffer;
+	size_t capacity;
+	size_t length;   // Bytes of the whole image so far, even those past the capacity
+	uint32_t crc;    // CRC-32 of the bytes since the last resetCrc(), for PNG chunks
+	
+	RenderBuffer(uint8_t *buf, size_t cap) :
+		buffer(buf), capacity(cap), length(0), crc(0xFFFFFFFF) {}
+	
+	void put(uint8_t b) {
+		if (length < capacity)
+			buffer[length] = b;
+		length++;
+		crc = getCrcTable()[(crc ^ b) & 0xFF] ^ (crc >> 8);
+	}
+	
+	void put(const char *text) {
+		for (; *text != '\0'; text++)
+			put(static_cast<uint8_t>(*text));
+	}
+	
+	void putNumber(long value) {
+		char digits[24];
+		int n = 0;
+		if (value < 0) {
+			put('-');
+			value = -value;
+		}
+		do {
+			digits[n++] = static_cast<char>('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+		while (n > 0)
+			put(static_cast<uint8_t>(digits[--n]));
+	}
+	
+	void putBigEndian(uint32_t value) {
+		for (int i = 24; i >= 0; i -= 8)
+			put(static_cast<uint8_t>(value >> i));
+	}
+	
+	void resetCrc() {
+		crc = 0xFFFFFFFF;
+	}
+	
+	static const uint32_t *getCrcTable() {
+		static const std::array<uint32_t,256> table = [] {
+			std::array<uint32_t,256> result;
+			for (uint32_t i = 0; i < 256; i++) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; k++)
+					c = (c & 1) != 0 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+				result[i] = c;
+			}
+			return result;
+		}();
+		return table.data();
+	}
+};
+
+
+size_t QrCode::toSvg(char *buffer, size_t capacity, int border) const {
 	if (border < 0)
 		throw std::domain_error("Border must be non-negative");
 	if (border > INT_MAX / 2 || border * 2 > INT_MAX - size)
 		throw std::overflow_error("Border too large");
 	
-	std::ostringstream sb;
-	sb << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
-	sb << "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n";
-	sb << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\" viewBox=\"0 0 ";
-	sb << (size + border * 2) << " " << (size + border * 2) << "\" stroke=\"none\">\n";
-	sb << "\t<rect width=\"100%\" height=\"100%\" fill=\"#FFFFFF\"/>\n";
-	sb << "\t<path d=\"";
+	RenderBuffer out(reinterpret_cast<uint8_t*>(buffer), capacity);
+	out.put("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	out.put("<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n");
+	out.put("<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\" viewBox=\"0 0 ");
+	out.putNumber(size + border * 2);
+	out.put(" ");
+	out.putNumber(size + border * 2);
+	out.put("\" stroke=\"none\">\n");
+	out.put("\t<rect width=\"100%\" height=\"100%\" fill=\"#FFFFFF\"/>\n");
+	out.put("\t<path d=\"");
+	bool first = true;
 	for (int y = 0; y < size; y++) {
-		for (int x = 0; x < size; x++) {
-			if (getModule(x, y)) {
-				if (x != 0 || y != 0)
-					sb << " ";
-				sb << "M" << (x + border) << "," << (y + border) << "h1v1h-1z";
+		const uint64_t *row = &modules[static_cast<size_t>(y * rowWords)];
+		for (int x = 0; x < size; ) {
+			// Skip to the next black module, then to the end of its run
+			uint64_t word = row[x >> 6] & (~uint64_t(0) << (x & 63));
+			if (word == 0) {
+				x = ((x >> 6) + 1) * 64;
+				continue;
+			}
+			int start = (x & ~63) + countTrailingZeros(word);
+			int end = start;
+			while (end < size) {
+				uint64_t white = ~row[end >> 6] & (~uint64_t(0) << (end & 63));
+				if (white != 0) {
+					end = (end & ~63) + countTrailingZeros(white);
+					break;
+				}
+				end = ((end >> 6) + 1) * 64;
 			}
+			end = std::min(end, size);
+			if (!first)
+				out.put(" ");
+			first = false;
+			out.put("M");
+			out.putNumber(start + border);
+			out.put(",");
+			out.putNumber(y + border);
+			out.put("h");
+			out.putNumber(end - start);
+			out.put("v1h-");
+			out.putNumber(end - start);
+			out.put("z");
+			x = end;
 		}
 	}
-	sb << "\" fill=\"#000000\"/>\n";
-	sb << "</svg>\n";
-	return sb.str();
+	out.put("\" fill=\"#000000\"/>\n");
+	out.put("</svg>\n");
+	return out.length;
+}
+
+
+size_t QrCode::toPng(uint8_t *buffer, size_t capacity, int scale, int border) const {
+	int width = getImageWidth(scale, border);
+	size_t rowBytes = (static_cast<size_t>(width) + 7) / 8;
+	size_t rawLength = static_cast<size_t>(width) * (1 + rowBytes);  // A filter type byte before each row
+	size_t numBlocks = std::max(static_cast<size_t>(1), (rawLength + 65534) / 65535);
+	size_t zlibLength = 2 + rawLength + numBlocks * 5 + 4;
+	if (zlibLength > 0x7FFFFFFF)
+		throw std::overflow_error("Image too large");
+	
+	RenderBuffer out(buffer, capacity);
+	const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	for (uint8_t b : signature)
+		out.put(b);
+	
+	// Header: width, height, bit depth 1, grayscale, no interlace
+	out.putBigEndian(13);
+	out.resetCrc();
+	out.put("IHDR");
+	out.putBigEndian(static_cast<uint32_t>(width));
+	out.putBigEndian(static_cast<uint32_t>(width));
+	const uint8_t header[] = {1, 0, 0, 0, 0};
+	for (uint8_t b : header)
+		out.put(b);
+	out.putBigEndian(~out.crc);
+	
+	// Image data: a zlib stream of stored deflate blocks of at most 65535 bytes, each
+	// block split from the raw rows as the stream goes
+	out.putBigEndian(static_cast<uint32_t>(zlibLength));
+	out.resetCrc();
+	out.put("IDAT");
+	out.put(0x78);
+	out.put(0x01);
+	uint32_t adlerA = 1, adlerB = 0;
+	size_t blockLeft = 0, rawLeft = rawLength;
+	std::vector<uint8_t> pixels;
+	for (int y = -border; y < size + border; y++) {
+		getPixelRow(y, scale, border, pixels);
+		for (int i = 0; i < scale; i++) {
+			for (size_t j = 0; j <= rowBytes; j++) {
+				if (blockLeft == 0) {  // Start a stored block
+					blockLeft = std::min(rawLeft, static_cast<size_t>(65535));
+					out.put(blockLeft == rawLeft ? 1 : 0);  // BFINAL on the last block, BTYPE 00
+					out.put(static_cast<uint8_t>(blockLeft));
+					out.put(static_cast<uint8_t>(blockLeft >> 8));
+					out.put(static_cast<uint8_t>(~blockLeft));
+					out.put(static_cast<uint8_t>(~blockLeft >> 8));
+				}
+				// Filter type 0, then the row inverted, as 0 is black in grayscale
+				uint8_t b = j == 0 ? 0 : static_cast<uint8_t>(~pixels[j - 1]);
+				out.put(b);
+				adlerA = (adlerA + b) % 65521;
+				adlerB = (adlerB + adlerA) % 65521;
+				blockLeft--;
+				rawLeft--;
+			}
+		}
+	}
+	out.putBigEndian(adlerB << 16 | adlerA);
+	out.putBigEndian(~out.crc);
+	
+	out.putBigEndian(0);
+	out.resetCrc();
+	out.put("IEND");
+	out.putBigEndian(~out.crc);
+	return out.length;
+}
+
+
+size_t QrCode::toPbm(uint8_t *buffer, size_t capacity, int scale, int border) const {
+	int width = getImageWidth(scale, border);
+	RenderBuffer out(buffer, capacity);
+	out.put("P4\n");
+	out.putNumber(width);
+	out.put(" ");
+	out.putNumber(width);
+	out.put("\n");
+	std::vector<uint8_t> pixels;
+	for (int y = -border; y < size + border; y++) {
+		getPixelRow(y, scale, border, pixels);
+		for (int i = 0; i < scale; i++) {
+			for (uint8_t b : pixels)
+				out.put(b);
+		}
+	}
+	return out.length;
+}
+
+
+size_t QrCode::toPgm(uint8_t *buffer, size_t capacity, int scale, int border) const {
+	int width = getImageWidth(scale, border);
+	RenderBuffer out(buffer, capacity);
+	out.put("P5\n");
+	out.putNumber(width);
+	out.put(" ");
+	out.putNumber(width);
+	out.put("\n255\n");
+	std::vector<uint8_t> pixels;
+	for (int y = -border; y < size + border; y++) {
+		getPixelRow(y, scale, border, pixels);
+		for (int i = 0; i < scale; i++) {
+			for (int x = 0; x < width; x++)
+				out.put(((pixels[static_cast<size_t>(x >> 3)] >> (7 - (x & 7))) & 1) != 0 ? 0 : 255);
+		}
+	}
+	return out.length;
+}
+
+
+int QrCode::getImageWidth(int scale, int border) const {
+	if (scale < 1)
+		throw std::domain_error("Scale must be positive");
+	if (border < 0)
+		throw std::domain_error("Border must be non-negative");
+	if (border > 4096 || static_cast<long>(size + border * 2) * scale > 32768)
+		throw std::overflow_error("Image too large");
+	return (size + border * 2) * scale;
+}
+
+
+void QrCode::getPixelRow(int y, int scale, int border, vector<uint8_t> &pixels) const {
+	int width = (size + border * 2) * scale;
+	pixels.assign((static_cast<size_t>(width) + 7) / 8, 0);
+	if (y < 0 || y >= size)
+		return;
+	for (int x = 0; x < size; x++) {
+		if (!module(x, y))
+			continue;
+		for (int p = (x + border) * scale, end = p + scale; p < end; p++)
+			pixels[static_cast<size_t>(p >> 3)] |= static_cast<uint8_t>(0x80 >> (p & 7));
+	}
+}
+
+
+QrCode::Grid QrCode::getGrid() {
+	return Grid{modules.data(), isFunction.data(), version, size, rowWords, errorCorrectionLevel};
 }
 
 
-void QrCode::drawFunctionPatterns() {
+void QrCode::drawFunctionPatterns(const Grid &grid) {
+	int size = grid.size;
+	// Mark the bits past the end of each row, so that masking leaves them 0
+	if (size % 64 != 0) {
+		for (int y = 0; y < size; y++)
+			grid.isFunction[(y + 1) * grid.rowWords - 1] = ~uint64_t(0) << (size % 64);
+	}
+	
 	// Draw horizontal and vertical timing patterns
 	for (int i = 0; i < size; i++) {
-		setFunctionModule(6, i, i % 2 == 0);
-		setFunctionModule(i, 6, i % 2 == 0);
+		setFunctionModule(grid, 6, i, i % 2 == 0);
+		setFunctionModule(grid, i, 6, i % 2 == 0);
 	}
 	
 	// Draw 3 finder patterns (all corners except bottom right; overwrites some timing modules)
-	drawFinderPattern(3, 3);
-	drawFinderPattern(size - 4, 3);
-	drawFinderPattern(3, size - 4);
+	drawFinderPattern(grid, 3, 3);
+	drawFinderPattern(grid, size - 4, 3);
+	drawFinderPattern(grid, 3, size - 4);
 	
 	// Draw numerous alignment patterns
-	const vector<int> alignPatPos = getAlignmentPatternPositions();
-	size_t numAlign = alignPatPos.size();
-	for (size_t i = 0; i < numAlign; i++) {
-		for (size_t j = 0; j < numAlign; j++) {
+	std::array<int,7> alignPatPos;
+	int numAlign = getAlignmentPatternPositions(grid.version, alignPatPos);
+	for (int i = 0; i < numAlign; i++) {
+		for (int j = 0; j < numAlign; j++) {
 			// Don't draw on the three finder corners
 			if (!((i == 0 && j == 0) || (i == 0 && j == numAlign - 1) || (i == numAlign - 1 && j == 0)))
-				drawAlignmentPattern(alignPatPos.at(i), alignPatPos.at(j));
+				drawAlignmentPattern(grid, alignPatPos[static_cast<size_t>(i)], alignPatPos[static_cast<size_t>(j)]);
 		}
 	}
 	
 	// Draw configuration data
-	drawFormatBits(0);  // Dummy mask value; overwritten later in the constructor
-	drawVersion();
+	drawFormatBits(grid, 0);  // Dummy mask value; overwritten later in the constructor
+	drawVersion(grid);
 }
 
 
-void QrCode::drawFormatBits(int msk) {
+void QrCode::drawFormatBits(const Grid &grid, int msk) {
 	// Calculate error correction code and pack bits
-	int data = getFormatBits(errorCorrectionLevel) << 3 | msk;  // errCorrLvl is uint2, msk is uint3
+	int data = getFormatBits(grid.errorCorrectionLevel) << 3 | msk;  // errCorrLvl is uint2, msk is uint3
 	int rem = data;
 	for (int i = 0; i < 10; i++)
 		rem = (rem << 1) ^ ((rem >> 9) * 0x537);
@@ -431,23 +1548,25 @@ void QrCode::drawFormatBits(int msk) {
 	
 	// Draw first copy
 	for (int i = 0; i <= 5; i++)
-		setFunctionModule(8, i, getBit(bits, i));
-	setFunctionModule(8, 7, getBit(bits, 6));
-	setFunctionModule(8, 8, getBit(bits, 7));
-	setFunctionModule(7, 8, getBit(bits, 8));
+		setFunctionModule(grid, 8, i, getBit(bits, i));
+	setFunctionModule(grid, 8, 7, getBit(bits, 6));
+	setFunctionModule(grid, 8, 8, getBit(bits, 7));
+	setFunctionModule(grid, 7, 8, getBit(bits, 8));
 	for (int i = 9; i < 15; i++)
-		setFunctionModule(14 - i, 8, getBit(bits, i));
+		setFunctionModule(grid, 14 - i, 8, getBit(bits, i));
 	
 	// Draw second copy
+	int size = grid.size;
 	for (int i = 0; i < 8; i++)
-		setFunctionModule(size - 1 - i, 8, getBit(bits, i));
+		setFunctionModule(grid, size - 1 - i, 8, getBit(bits, i));
 	for (int i = 8; i < 15; i++)
-		setFunctionModule(8, size - 15 + i, getBit(bits, i));
-	setFunctionModule(8, size - 8, true);  // Always black
+		setFunctionModule(grid, 8, size - 15 + i, getBit(bits, i));
+	setFunctionModule(grid, 8, size - 8, true);  // Always black
 }
 
 
-void QrCode::drawVersion() {
+void QrCode::drawVersion(const Grid &grid) {
+	int version = grid.version;
 	if (version < 7)
 		return;
 	
@@ -462,205 +1581,201 @@ void QrCode::drawVersion() {
 	// Draw two copies
 	for (int i = 0; i < 18; i++) {
 		bool bit = getBit(bits, i);
-		int a = size - 11 + i % 3;
+		int a = grid.size - 11 + i % 3;
 		int b = i / 3;
-		setFunctionModule(a, b, bit);
-		setFunctionModule(b, a, bit);
+		setFunctionModule(grid, a, b, bit);
+		setFunctionModule(grid, b, a, bit);
 	}
 }
 
 
-void QrCode::drawFinderPattern(int x, int y) {
+void QrCode::drawFinderPattern(const Grid &grid, int x, int y) {
 	for (int dy = -4; dy <= 4; dy++) {
 		for (int dx = -4; dx <= 4; dx++) {
 			int dist = std::max(std::abs(dx), std::abs(dy));  // Chebyshev/infinity norm
 			int xx = x + dx, yy = y + dy;
-			if (0 <= xx && xx < size && 0 <= yy && yy < size)
-				setFunctionModule(xx, yy, dist != 2 && dist != 4);
+			if (0 <= xx && xx < grid.size && 0 <= yy && yy < grid.size)
+				setFunctionModule(grid, xx, yy, dist != 2 && dist != 4);
 		}
 	}
 }
 
 
-void QrCode::drawAlignmentPattern(int x, int y) {
+void QrCode::drawAlignmentPattern(const Grid &grid, int x, int y) {
 	for (int dy = -2; dy <= 2; dy++) {
 		for (int dx = -2; dx <= 2; dx++)
-			setFunctionModule(x + dx, y + dy, std::max(std::abs(dx), std::abs(dy)) != 1);
+			setFunctionModule(grid, x + dx, y + dy, std::max(std::abs(dx), std::abs(dy)) != 1);
 	}
 }
 
 
-void QrCode::setFunctionModule(int x, int y, bool isBlack) {
-	size_t ux = static_cast<size_t>(x);
-	size_t uy = static_cast<size_t>(y);
-	modules   .at(uy).at(ux) = isBlack;
-	isFunction.at(uy).at(ux) = true;
+void QrCode::setFunctionModule(const Grid &grid, int x, int y, bool isBlack) {
+	int w = y * grid.rowWords + (x >> 6);
+	uint64_t bit = uint64_t(1) << (x & 63);
+	grid.modules[w] = isBlack ? (grid.modules[w] | bit) : (grid.modules[w] & ~bit);
+	grid.isFunction[w] |= bit;
 }
 
 
 bool QrCode::module(int x, int y) const {
-	return modules.at(static_cast<size_t>(y)).at(static_cast<size_t>(x));
+	return ((modules[static_cast<size_t>(y * rowWords + (x >> 6))] >> (x & 63)) & 1) != 0;
 }
 
 
-vector<uint8_t> QrCode::addEccAndInterleave(const vector<uint8_t> &data) const {
+void QrCode::addEccAndInterleave(const vector<uint8_t> &data, vector<uint8_t> &result) const {
 	if (data.size() != static_cast<unsigned int>(getNumDataCodewords(version, errorCorrectionLevel)))
 		throw std::invalid_argument("Invalid argument");
-	
+	result.resize(static_cast<size_t>(getNumRawDataModules(version) / 8));
+	addEccAndInterleave(version, errorCorrectionLevel, data.data(), result.data());
+}
+
+
+void QrCode::addEccAndInterleave(int ver, Ecc ecl, const uint8_t *data, uint8_t *result) {
 	// Calculate parameter numbers
-	int numBlocks = NUM_ERROR_CORRECTION_BLOCKS[static_cast<int>(errorCorrectionLevel)][version];
-	int blockEccLen = ECC_CODEWORDS_PER_BLOCK  [static_cast<int>(errorCorrectionLevel)][version];
-	int rawCodewords = getNumRawDataModules(version) / 8;
-	int numShortBlocks = numBlocks - rawCodewords % numBlocks;
-	int shortBlockLen = rawCodewords / numBlocks;
-	
-	// Split data into blocks and append ECC to each block
-	vector<vector<uint8_t> > blocks;
-	const vector<uint8_t> rsDiv = reedSolomonComputeDivisor(blockEccLen);
-	for (int i = 0, k = 0; i < numBlocks; i++) {
-		vector<uint8_t> dat(data.cbegin() + k, data.cbegin() + (k + shortBlockLen - blockEccLen + (i < numShortBlocks ? 0 : 1)));
-		k += static_cast<int>(dat.size());
-		const vector<uint8_t> ecc = reedSolomonComputeRemainder(dat, rsDiv);
-		if (i < numShortBlocks)
-			dat.push_back(0);
-		dat.insert(dat.end(), ecc.cbegin(), ecc.cend());
-		blocks.push_back(std::move(dat));
-	}
+	const BlockLayout &layout = getBlockLayout(ver, ecl);
+	int numBlocks = layout.numBlocks;
+	int blockEccLen = layout.blockEccLen;
+	int numShortBlocks = layout.numShortBlocks;
+	int shortDataLen = layout.shortBlockLen - blockEccLen;
+	size_t dataLen = static_cast<size_t>(getNumDataCodewords(ver, ecl));
 	
-	// Interleave (not concatenate) the bytes from every block into a single sequence
-	vector<uint8_t> result;
-	for (size_t i = 0; i < blocks.at(0).size(); i++) {
-		for (size_t j = 0; j < blocks.size(); j++) {
-			// Skip the padding byte in short blocks
-			if (i != static_cast<unsigned int>(shortBlockLen - blockEccLen) || j >= static_cast<unsigned int>(numShortBlocks))
-				result.push_back(blocks.at(j).at(i));
-		}
+	// Interleave (not concatenate) the bytes from every block into a single sequence, writing
+	// each block's data and ECC straight to their final positions. Long blocks have one more
+	// data byte, placed after the first shortDataLen bytes of all blocks
+	std::array<uint8_t,255> ecc;
+	for (int i = 0, k = 0; i < numBlocks; i++) {
+		int datLen = shortDataLen + (i < numShortBlocks ? 0 : 1);
+		for (int j = 0; j < shortDataLen; j++)
+			result[j * numBlocks + i] = data[k + j];
+		if (i >= numShortBlocks)
+			result[shortDataLen * numBlocks + i - numShortBlocks] = data[k + shortDataLen];
+		reedSolomonComputeRemainder(&data[k], static_cast<size_t>(datLen), layout.divisor, static_cast<size_t>(blockEccLen), ecc.data());
+		for (int j = 0; j < blockEccLen; j++)
+			result[dataLen + static_cast<size_t>(j * numBlocks + i)] = ecc[static_cast<size_t>(j)];
+		k += datLen;
 	}
-	if (result.size() != static_cast<unsigned int>(rawCodewords))
+	if (dataLen + static_cast<size_t>(numBlocks * blockEccLen) != static_cast<size_t>(getNumRawDataModules(ver) / 8))
 		throw std::logic_error("Assertion error");
-	return result;
 }
 
 
 void QrCode::drawCodewords(const vector<uint8_t> &data) {
-	if (data.size() != static_cast<unsigned int>(getNumRawDataModules(version) / 8))
+	const vector<uint16_t> &order = getVersionLayout(version).order;
+	if (data.size() * 8 != order.size())
 		throw std::invalid_argument("Invalid argument");
 	
+	// Scatter the bits to their positions in the zigzag scan, only the black ones as the
+	// data modules start white. If this QR Code has any remainder bits (0 to 7), they
+	// stay 0/false/white too
+	const uint16_t *pos = order.data();
+	for (uint8_t byte : data) {
+		for (int j = 7; j >= 0; j--, pos++) {
+			if (((byte >> j) & 1) != 0)
+				modules[*pos >> 6] |= uint64_t(1) << (*pos & 63);
+		}
+	}
+}
+
+
+void QrCode::drawCodewords(const Grid &grid, const uint8_t *data, size_t len) {
+	if (len != static_cast<size_t>(getNumRawDataModules(grid.version) / 8))
+		throw std::invalid_argument("Invalid argument");
 	size_t i = 0;  // Bit index into the data
+	walkZigzag(grid.size, 6, [&grid, data, len, &i](int x, int y) {
+		uint64_t bit = uint64_t(1) << (x & 63);
+		int w = y * grid.rowWords + (x >> 6);
+		if ((grid.isFunction[w] & bit) == 0 && i < len * 8) {
+			if (getBit(data[i >> 3], 7 - static_cast<int>(i & 7)))
+				grid.modules[w] |= bit;
+			i++;
+		}
+		// If this QR Code has any remainder bits (0 to 7), they were assigned as
+		// 0/false/white by the caller and are left unchanged by this method
+	});
+	if (i != len * 8)
+		throw std::logic_error("Assertion error");
+}
+
+
+template <typename Visit>
+void QrCode::walkZigzag(int size, int timingColumn, Visit visit) {
 	// Do the funny zigzag scan
+	bool upward = true;  // The first column pair is scanned upward, then the direction alternates
 	for (int right = size - 1; right >= 1; right -= 2) {  // Index of right column in each column pair
-		if (right == 6)
-			right = 5;
+		if (right == timingColumn)
+			right--;
 		for (int vert = 0; vert < size; vert++) {  // Vertical counter
-			for (int j = 0; j < 2; j++) {
-				size_t x = static_cast<size_t>(right - j);  // Actual x coordinate
-				bool upward = ((right + 1) & 2) == 0;
-				size_t y = static_cast<size_t>(upward ? size - 1 - vert : vert);  // Actual y coordinate
-				if (!isFunction.at(y).at(x) && i < data.size() * 8) {
-					modules.at(y).at(x) = getBit(data.at(i >> 3), 7 - static_cast<int>(i & 7));
-					i++;
-				}
-				// If this QR Code has any remainder bits (0 to 7), they were assigned as
-				// 0/false/white by the constructor and are left unchanged by this method
-			}
+			int y = upward ? size - 1 - vert : vert;  // Actual y coordinate
+			visit(right, y);
+			visit(right - 1, y);
 		}
+		upward = !upward;
 	}
-	if (i != data.size() * 8)
-		throw std::logic_error("Assertion error");
 }
 
 
-void QrCode::applyMask(int msk) {
+void QrCode::applyMask(const Grid &grid, int msk) {
 	if (msk < 0 || msk > 7)
 		throw std::domain_error("Mask value out of range");
-	size_t sz = static_cast<size_t>(size);
-	for (size_t y = 0; y < sz; y++) {
-		for (size_t x = 0; x < sz; x++) {
-			bool invert;
-			switch (msk) {
-				case 0:  invert = (x + y) % 2 == 0;                    break;
-				case 1:  invert = y % 2 == 0;                          break;
-				case 2:  invert = x % 3 == 0;                          break;
-				case 3:  invert = (x + y) % 3 == 0;                    break;
-				case 4:  invert = (x / 3 + y / 2) % 2 == 0;            break;
-				case 5:  invert = x * y % 2 + x * y % 3 == 0;          break;
-				case 6:  invert = (x * y % 2 + x * y % 3) % 2 == 0;    break;
-				case 7:  invert = ((x + y) % 2 + x * y % 3) % 2 == 0;  break;
-				default:  throw std::logic_error("Assertion error");
-			}
-			modules.at(y).at(x) = modules.at(y).at(x) ^ (invert & !isFunction.at(y).at(x));
-		}
+	// Function modules, and the bits past the end of each row, are set in isFunction and stay unchanged
+	for (int y = 0; y < grid.size; y++) {
+		const uint64_t *pattern = getMaskPattern(msk, y);
+		int row = y * grid.rowWords;
+		for (int w = 0; w < grid.rowWords; w++)
+			grid.modules[row + w] ^= pattern[w] & ~grid.isFunction[row + w];
 	}
 }
 
 
-long QrCode::getPenaltyScore() const {
+long QrCode::getPenaltyScore(const Grid &grid, uint64_t *columns) {
+	const uint64_t *modules = grid.modules;
+	int size = grid.size;
+	int rowWords = grid.rowWords;
 	long result = 0;
 	
 	// Adjacent modules in row having same color, and finder-like patterns
-	for (int y = 0; y < size; y++) {
-		bool runColor = false;
-		int runX = 0;
-		std::array<int,7> runHistory = {};
-		for (int x = 0; x < size; x++) {
-			if (module(x, y) == runColor) {
-				runX++;
-				if (runX == 5)
-					result += PENALTY_N1;
-				else if (runX > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runX, runHistory);
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory) * PENALTY_N3;
-				runColor = module(x, y);
-				runX = 1;
-			}
-		}
-		result += finderPenaltyTerminateAndCount(runColor, runX, runHistory) * PENALTY_N3;
-	}
-	// Adjacent modules in column having same color, and finder-like patterns
-	for (int x = 0; x < size; x++) {
-		bool runColor = false;
-		int runY = 0;
-		std::array<int,7> runHistory = {};
-		for (int y = 0; y < size; y++) {
-			if (module(x, y) == runColor) {
-				runY++;
-				if (runY == 5)
-					result += PENALTY_N1;
-				else if (runY > 5)
-					result++;
-			} else {
-				finderPenaltyAddHistory(runY, runHistory);
-				if (!runColor)
-					result += finderPenaltyCountPatterns(runHistory) * PENALTY_N3;
-				runColor = module(x, y);
-				runY = 1;
+	for (int y = 0; y < size; y++)
+		result += getLinePenaltyScore(&modules[y * rowWords], size, rowWords);
+	
+	// Adjacent modules in column having same color, and finder-like patterns,
+	// scored as the rows of the transposed grid
+	std::array<uint64_t,64> block;
+	for (int by = 0; by < rowWords; by++) {
+		for (int bx = 0; bx < rowWords; bx++) {
+			for (int i = 0; i < 64; i++) {
+				int y = by * 64 + i;
+				block[static_cast<size_t>(i)] = y < size ? modules[y * rowWords + bx] : 0;
 			}
+			transposeBlock(block);
+			for (int i = 0; i < 64 && bx * 64 + i < size; i++)
+				columns[(bx * 64 + i) * rowWords + by] = block[static_cast<size_t>(i)];
 		}
-		result += finderPenaltyTerminateAndCount(runColor, runY, runHistory) * PENALTY_N3;
 	}
+	for (int x = 0; x < size; x++)
+		result += getLinePenaltyScore(&columns[x * rowWords], size, rowWords);
 	
-	// 2*2 blocks of modules having same color
+	// 2*2 blocks of modules having same color, counted a word at a time. Bit x of 'same'
+	// is set if modules x and x + 1 of both rows have the same color
 	for (int y = 0; y < size - 1; y++) {
-		for (int x = 0; x < size - 1; x++) {
-			bool  color = module(x, y);
-			if (  color == module(x + 1, y) &&
-			      color == module(x, y + 1) &&
-			      color == module(x + 1, y + 1))
-				result += PENALTY_N2;
+		const uint64_t *top    = &modules[y * rowWords];
+		const uint64_t *bottom = top + rowWords;
+		for (int w = 0; w < rowWords; w++) {
+			uint64_t nextTop    = w + 1 < rowWords ? top   [w + 1] : 0;
+			uint64_t nextBottom = w + 1 < rowWords ? bottom[w + 1] : 0;
+			uint64_t topRight    = top   [w] >> 1 | nextTop    << 63;
+			uint64_t bottomRight = bottom[w] >> 1 | nextBottom << 63;
+			uint64_t same = ~(top[w] ^ bottom[w]) & ~(top[w] ^ topRight) & ~(bottom[w] ^ bottomRight);
+			int valid = size - 1 - w * 64;  // Only x < size - 1 starts a block
+			if (valid < 64)
+				same &= (uint64_t(1) << valid) - 1;
+			result += popCount(same) * PENALTY_N2;
 		}
 	}
 	
 	// Balance of black and white modules
 	int black = 0;
-	for (const vector<bool> &row : modules) {
-		for (bool color : row) {
-			if (color)
-				black++;
-		}
-	}
+	for (int w = 0; w < size * rowWords; w++)
+		black += popCount(modules[w]);
 	int total = size * size;  // Note that size is odd, so black/total != 1/2
 	// Compute the smallest integer k >= 0 such that (45-5k)% <= black/total <= (55+5k)%
 	int k = static_cast<int>((std::abs(black * 20L - total * 10L) + total - 1) / total) - 1;
@@ -669,22 +1784,140 @@ long QrCode::getPenaltyScore() const {
 }
 
 
-vector<int> QrCode::getAlignmentPatternPositions() const {
-	if (version == 1)
-		return vector<int>();
-	else {
-		int numAlign = version / 7 + 2;
-		int step = (version == 32) ? 26 :
-			(version*4 + numAlign*2 + 1) / (numAlign*2 - 2) * 2;
-		vector<int> result;
-		for (int i = 0, pos = size - 7; i < numAlign - 1; i++, pos -= step)
-			result.insert(result.begin(), pos);
-		result.insert(result.begin(), 6);
+long QrCode::getMaskPenaltyScore(const Grid &grid, int msk, uint64_t *buffer, uint64_t *columns) {
+	// drawFormatBits() marks the function modules too, so both grids are copied
+	int words = grid.size * grid.rowWords;
+	Grid trial = grid;
+	trial.modules = std::copy(grid.modules, grid.modules + words, buffer) - words;
+	trial.isFunction = std::copy(grid.isFunction, grid.isFunction + words, buffer + words) - words;
+	applyMask(trial, msk);
+	drawFormatBits(trial, msk);
+	return getPenaltyScore(trial, columns);
+}
+
+
+long QrCode::getLinePenaltyScore(const uint64_t *line, int size, int rowWords) {
+	long result = 0;
+	bool runColor = false;
+	std::array<int,7> runHistory = {};
+	int start = 0;
+	while (true) {
+		// Find the end of the run starting at 'start', the first module of the other color
+		int end = start;
+		uint64_t flip = runColor ? ~uint64_t(0) : 0;
+		for (int w = start >> 6; w < rowWords; w++) {
+			uint64_t differ = line[w] ^ flip;
+			if (w == start >> 6)
+				differ &= ~uint64_t(0) << (start & 63);
+			if (differ != 0) {
+				end = w * 64 + countTrailingZeros(differ);
+				break;
+			}
+			end = (w + 1) * 64;
+		}
+		if (end > size)
+			end = size;
+		
+		int runLength = end - start;
+		if (runLength >= 5)
+			result += PENALTY_N1 + runLength - 5;
+		if (end == size) {
+			result += finderPenaltyTerminateAndCount(runColor, runLength, runHistory, size) * PENALTY_N3;
+			return result;
+		}
+		finderPenaltyAddHistory(runLength, runHistory, size);
+		if (!runColor)
+			result += finderPenaltyCountPatterns(runHistory, size) * PENALTY_N3;
+		runColor = !runColor;
+		start = end;
+	}
+}
+
+
+const uint64_t *QrCode::getMaskPattern(int msk, int y) {
+	// Every mask repeats every 12 rows, and a row has at most 3 words
+	static const std::array<uint64_t, 8 * 12 * 3> patterns = [] {
+		std::array<uint64_t, 8 * 12 * 3> result = {};
+		for (int m = 0; m < 8; m++) {
+			for (int yy = 0; yy < 12; yy++) {
+				for (int x = 0; x < 3 * 64; x++) {
+					bool invert;
+					switch (m) {
+						case 0:  invert = (x + yy) % 2 == 0;                     break;
+						case 1:  invert = yy % 2 == 0;                           break;
+						case 2:  invert = x % 3 == 0;                            break;
+						case 3:  invert = (x + yy) % 3 == 0;                     break;
+						case 4:  invert = (x / 3 + yy / 2) % 2 == 0;             break;
+						case 5:  invert = x * yy % 2 + x * yy % 3 == 0;          break;
+						case 6:  invert = (x * yy % 2 + x * yy % 3) % 2 == 0;    break;
+						case 7:  invert = ((x + yy) % 2 + x * yy % 3) % 2 == 0;  break;
+						default:  throw std::logic_error("Assertion error");
+					}
+					if (invert)
+						result[static_cast<size_t>((m * 12 + yy) * 3 + x / 64)] |= uint64_t(1) << (x % 64);
+				}
+			}
+		}
 		return result;
+	}();
+	return &patterns[static_cast<size_t>((msk * 12 + y % 12) * 3)];
+}
+
+
+void QrCode::transposeBlock(std::array<uint64_t,64> &block) {
+	// Swap the off-diagonal halves, then quarters, and so on down to single bits
+	uint64_t m = 0x00000000FFFFFFFFULL;
+	for (int j = 32; j != 0; j >>= 1, m ^= m << j) {
+		for (int k = 0; k < 64; k = (k + j + 1) & ~j) {
+			uint64_t t = ((block[static_cast<size_t>(k)] >> j) ^ block[static_cast<size_t>(k + j)]) & m;
+			block[static_cast<size_t>(k)]     ^= t << j;
+			block[static_cast<size_t>(k + j)] ^= t;
+		}
 	}
 }
 
 
+int QrCode::getAlignmentPatternPositions(int ver, std::array<int,7> &result) {
+	if (ver == 1)
+		return 0;
+	int numAlign = ver / 7 + 2;
+	int step = (ver == 32) ? 26 :
+		(ver*4 + numAlign*2 + 1) / (numAlign*2 - 2) * 2;
+	result[0] = 6;
+	for (int i = numAlign - 1, pos = ver * 4 + 10; i >= 1; i--, pos -= step)
+		result[static_cast<size_t>(i)] = pos;
+	return numAlign;
+}
+
+
+const QrCode::VersionLayout &QrCode::getVersionLayout(int ver) {
+	if (ver < MIN_VERSION || ver > MAX_VERSION)
+		throw std::domain_error("Version number out of range");
+	// Drawn from an empty symbol of every version
+	static const vector<VersionLayout> layouts = [] {
+		vector<VersionLayout> result(MAX_VERSION + 1);
+		for (int v = MIN_VERSION; v <= MAX_VERSION; v++) {
+			QrCode qr(v);
+			VersionLayout &layout = result.at(static_cast<size_t>(v));
+			int rowBits = qr.rowWords * 64;
+			// Do the funny zigzag scan, once per version
+			walkZigzag(qr.size, 6, [&qr, &layout, rowBits](int x, int y) {
+				if (((qr.isFunction[static_cast<size_t>(y * qr.rowWords + (x >> 6))] >> (x & 63)) & 1) == 0)
+					layout.order.push_back(static_cast<uint16_t>(y * rowBits + x));
+			});
+			if (static_cast<int>(layout.order.size()) != getNumRawDataModules(v))
+				throw std::logic_error("Assertion error");
+			layout.order.resize(layout.order.size() / 8 * 8);  // The remainder bits stay white
+			layout.order.shrink_to_fit();
+			layout.modules = std::move(qr.modules);
+			layout.isFunction = std::move(qr.isFunction);
+		}
+		return result;
+	}();
+	return layouts[static_cast<size_t>(ver)];
+}
+
+
 int QrCode::getNumRawDataModules(int ver) {
 	if (ver < MIN_VERSION || ver > MAX_VERSION)
 		throw std::domain_error("Version number out of range");
@@ -708,13 +1941,50 @@ int QrCode::getNumDataCodewords(int ver, Ecc ecl) {
 }
 
 
-vector<uint8_t> QrCode::reedSolomonComputeDivisor(int degree) {
+const QrCode::BlockLayout &QrCode::getBlockLayout(int ver, Ecc ecl) {
+	if (ver < MIN_VERSION || ver > MAX_VERSION)
+		throw std::domain_error("Version number out of range");
+	// Built on first use. The initialization of a local static is thread-safe, and
+	// the tables are never changed afterwards, so they are shared without locking.
+	// The other lazily built tables of this file rely on the same
+	static const std::array<std::array<uint8_t, 30>, 31> divisors = [] {
+		std::array<std::array<uint8_t, 30>, 31> result = {};  // Indexed by degree, at most 30
+		for (int e = 0; e < 4; e++) {
+			for (int v = MIN_VERSION; v <= MAX_VERSION; v++) {
+				int degree = ECC_CODEWORDS_PER_BLOCK[e][v];
+				reedSolomonComputeDivisor(degree, result.at(static_cast<size_t>(degree)).data());
+			}
+		}
+		return result;
+	}();
+	static const std::array<BlockLayout, 4 * (MAX_VERSION + 1)> layouts = [] {
+		std::array<BlockLayout, 4 * (MAX_VERSION + 1)> result = {};
+		for (int e = 0; e < 4; e++) {
+			for (int v = MIN_VERSION; v <= MAX_VERSION; v++) {
+				BlockLayout &layout = result.at(static_cast<size_t>(e * (MAX_VERSION + 1) + v));
+				int rawCodewords = getNumRawDataModules(v) / 8;
+				if (v == MAX_VERSION && rawCodewords != MAX_CODEWORDS)
+					throw std::logic_error("Assertion error");
+				layout.numBlocks = NUM_ERROR_CORRECTION_BLOCKS[e][v];
+				layout.blockEccLen = ECC_CODEWORDS_PER_BLOCK[e][v];
+				layout.numShortBlocks = layout.numBlocks - rawCodewords % layout.numBlocks;
+				layout.shortBlockLen = rawCodewords / layout.numBlocks;
+				layout.divisor = divisors.at(static_cast<size_t>(layout.blockEccLen)).data();
+			}
+		}
+		return result;
+	}();
+	return layouts[static_cast<size_t>(static_cast<int>(ecl) * (MAX_VERSION + 1) + ver)];
+}
+
+
+void QrCode::reedSolomonComputeDivisor(int degree, uint8_t *result) {
 	if (degree < 1 || degree > 255)
 		throw std::domain_error("Degree out of range");
 	// Polynomial coefficients are stored from highest to lowest power, excluding the leading term which is always 1.
 	// For example the polynomial x^3 + 255x^2 + 8x + 93 is stored as the uint8 array {255, 8, 93}.
-	vector<uint8_t> result(static_cast<size_t>(degree));
-	result.at(result.size() - 1) = 1;  // Start off with the monomial x^0
+	std::fill(result, result + degree - 1, 0);
+	result[degree - 1] = 1;  // Start off with the monomial x^0
 	
 	// Compute the product polynomial (x - r^0) * (x - r^1) * (x - r^2) * ... * (x - r^{degree-1}),
 	// and drop the highest monomial term which is always 1x^degree.
@@ -722,44 +1992,59 @@ vector<uint8_t> QrCode::reedSolomonComputeDivisor(int degree) {
 	uint8_t root = 1;
 	for (int i = 0; i < degree; i++) {
 		// Multiply the current product by (x - r^i)
-		for (size_t j = 0; j < result.size(); j++) {
-			result.at(j) = reedSolomonMultiply(result.at(j), root);
-			if (j + 1 < result.size())
-				result.at(j) ^= result.at(j + 1);
+		for (int j = 0; j < degree; j++) {
+			result[j] = reedSolomonMultiply(result[j], root);
+			if (j + 1 < degree)
+				result[j] ^= result[j + 1];
 		}
 		root = reedSolomonMultiply(root, 0x02);
 	}
-	return result;
 }
 
 
-vector<uint8_t> QrCode::reedSolomonComputeRemainder(const vector<uint8_t> &data, const vector<uint8_t> &divisor) {
-	vector<uint8_t> result(divisor.size());
-	for (uint8_t b : data) {  // Polynomial division
-		uint8_t factor = b ^ result.at(0);
-		result.erase(result.begin());
-		result.push_back(0);
-		for (size_t i = 0; i < result.size(); i++)
-			result.at(i) ^= reedSolomonMultiply(divisor.at(i), factor);
+void QrCode::reedSolomonComputeRemainder(const uint8_t *data, size_t len, const uint8_t *divisor, size_t degree, uint8_t *result) {
+	if (degree < 1 || degree > 255)
+		throw std::domain_error("Degree out of range");
+	// Logarithms of the divisor's coefficients, -1 for a zero coefficient
+	std::array<int,255> divisorLog;
+	for (size_t i = 0; i < degree; i++)
+		divisorLog[i] = divisor[i] == 0 ? -1 : GF_LOG[divisor[i]];
+	
+	// The remainder is kept in a circular buffer starting at 'head', so that
+	// dropping its first term for every data byte does not shift it
+	std::array<uint8_t,255> remainder = {};
+	size_t head = 0;
+	for (size_t n = 0; n < len; n++) {  // Polynomial division
+		uint8_t factor = data[n] ^ remainder[head];
+		remainder[head] = 0;  // The dropped term becomes the new last term, 0
+		head = head + 1 == degree ? 0 : head + 1;
+		if (factor == 0)
+			continue;
+		int factorLog = GF_LOG[factor];
+		size_t split = degree - head;  // Terms before the buffer wraps around
+		for (size_t i = 0; i < split; i++) {
+			if (divisorLog[i] >= 0)
+				remainder[head + i] ^= GF_EXP[divisorLog[i] + factorLog];
+		}
+		for (size_t i = split; i < degree; i++) {
+			if (divisorLog[i] >= 0)
+				remainder[i - split] ^= GF_EXP[divisorLog[i] + factorLog];
+		}
 	}
-	return result;
+	for (size_t i = 0; i < degree; i++)
+		result[i] = remainder[(head + i) % degree];
 }
 
 
 uint8_t QrCode::reedSolomonMultiply(uint8_t x, uint8_t y) {
-	// Russian peasant multiplication
-	int z = 0;
-	for (int i = 7; i >= 0; i--) {
-		z = (z << 1) ^ ((z >> 7) * 0x11D);
-		z ^= ((y >> i) & 1) * x;
-	}
-	if (z >> 8 != 0)
-		throw std::logic_error("Assertion error");
-	return static_cast<uint8_t>(z);
+	// Sum of the logarithms, the antilogarithm table is doubled so that it needs no modulo
+	if (x == 0 || y == 0)
+		return 0;
+	return GF_EXP[GF_LOG[x] + GF_LOG[y]];
 }
 
 
-int QrCode::finderPenaltyCountPatterns(const std::array<int,7> &runHistory) const {
+int QrCode::finderPenaltyCountPatterns(const std::array<int,7> &runHistory, int size) {
 	int n = runHistory.at(1);
 	if (n > size * 3)
 		throw std::logic_error("Assertion error");
@@ -769,18 +2054,18 @@ int QrCode::finderPenaltyCountPatterns(const std::array<int,7> &runHistory) cons
 }
 
 
-int QrCode::finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, std::array<int,7> &runHistory) const {
+int QrCode::finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, std::array<int,7> &runHistory, int size) {
 	if (currentRunColor) {  // Terminate black run
-		finderPenaltyAddHistory(currentRunLength, runHistory);
+		finderPenaltyAddHistory(currentRunLength, runHistory, size);
 		currentRunLength = 0;
 	}
 	currentRunLength += size;  // Add white border to final run
-	finderPenaltyAddHistory(currentRunLength, runHistory);
-	return finderPenaltyCountPatterns(runHistory);
+	finderPenaltyAddHistory(currentRunLength, runHistory, size);
+	return finderPenaltyCountPatterns(runHistory, size);
 }
 
 
-void QrCode::finderPenaltyAddHistory(int currentRunLength, std::array<int,7> &runHistory) const {
+void QrCode::finderPenaltyAddHistory(int currentRunLength, std::array<int,7> &runHistory, int size) {
 	if (runHistory.at(0) == 0)
 		currentRunLength += size;  // Add white border to initial run
 	std::copy_backward(runHistory.cbegin(), runHistory.cend() - 1, runHistory.end());
@@ -793,6 +2078,30 @@ bool QrCode::getBit(long x, int i) {
 }
 
 
+int QrCode::popCount(uint64_t x) {
+#if defined(__GNUC__)
+	return __builtin_popcountll(x);
+#else
+	int result = 0;
+	for (; x != 0; x &= x - 1)
+		result++;
+	return result;
+#endif
+}
+
+
+int QrCode::countTrailingZeros(uint64_t x) {
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int result = 0;
+	for (; (x & 1) == 0; x >>= 1)
+		result++;
+	return result;
+#endif
+}
+
+
 /*---- Tables of constants ----*/
 
 const int QrCode::PENALTY_N1 =  3;
@@ -820,22 +2129,920 @@ const int8_t QrCode::NUM_ERROR_CORRECTION_BLOCKS[4][41] = {
 };
 
 
+// Antilogarithms in GF(2^8 / 0x11D), GF_EXP[i] = 0x02^i, stored twice so that the sum of two logarithms is an index
+const uint8_t QrCode::GF_EXP[510] = {
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1D, 0x3A, 0x74, 0xE8, 0xCD, 0x87, 0x13, 0x26,
+	0x4C, 0x98, 0x2D, 0x5A, 0xB4, 0x75, 0xEA, 0xC9, 0x8F, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xC0,
+	0x9D, 0x27, 0x4E, 0x9C, 0x25, 0x4A, 0x94, 0x35, 0x6A, 0xD4, 0xB5, 0x77, 0xEE, 0xC1, 0x9F, 0x23,
+	0x46, 0x8C, 0x05, 0x0A, 0x14, 0x28, 0x50, 0xA0, 0x5D, 0xBA, 0x69, 0xD2, 0xB9, 0x6F, 0xDE, 0xA1,
+	0x5F, 0xBE, 0x61, 0xC2, 0x99, 0x2F, 0x5E, 0xBC, 0x65, 0xCA, 0x89, 0x0F, 0x1E, 0x3C, 0x78, 0xF0,
+	0xFD, 0xE7, 0xD3, 0xBB, 0x6B, 0xD6, 0xB1, 0x7F, 0xFE, 0xE1, 0xDF, 0xA3, 0x5B, 0xB6, 0x71, 0xE2,
+	0xD9, 0xAF, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0D, 0x1A, 0x34, 0x68, 0xD0, 0xBD, 0x67, 0xCE,
+	0x81, 0x1F, 0x3E, 0x7C, 0xF8, 0xED, 0xC7, 0x93, 0x3B, 0x76, 0xEC, 0xC5, 0x97, 0x33, 0x66, 0xCC,
+	0x85, 0x17, 0x2E, 0x5C, 0xB8, 0x6D, 0xDA, 0xA9, 0x4F, 0x9E, 0x21, 0x42, 0x84, 0x15, 0x2A, 0x54,
+	0xA8, 0x4D, 0x9A, 0x29, 0x52, 0xA4, 0x55, 0xAA, 0x49, 0x92, 0x39, 0x72, 0xE4, 0xD5, 0xB7, 0x73,
+	0xE6, 0xD1, 0xBF, 0x63, 0xC6, 0x91, 0x3F, 0x7E, 0xFC, 0xE5, 0xD7, 0xB3, 0x7B, 0xF6, 0xF1, 0xFF,
+	0xE3, 0xDB, 0xAB, 0x4B, 0x96, 0x31, 0x62, 0xC4, 0x95, 0x37, 0x6E, 0xDC, 0xA5, 0x57, 0xAE, 0x41,
+	0x82, 0x19, 0x32, 0x64, 0xC8, 0x8D, 0x07, 0x0E, 0x1C, 0x38, 0x70, 0xE0, 0xDD, 0xA7, 0x53, 0xA6,
+	0x51, 0xA2, 0x59, 0xB2, 0x79, 0xF2, 0xF9, 0xEF, 0xC3, 0x9B, 0x2B, 0x56, 0xAC, 0x45, 0x8A, 0x09,
+	0x12, 0x24, 0x48, 0x90, 0x3D, 0x7A, 0xF4, 0xF5, 0xF7, 0xF3, 0xFB, 0xEB, 0xCB, 0x8B, 0x0B, 0x16,
+	0x2C, 0x58, 0xB0, 0x7D, 0xFA, 0xE9, 0xCF, 0x83, 0x1B, 0x36, 0x6C, 0xD8, 0xAD, 0x47, 0x8E, 0x01,
+	0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1D, 0x3A, 0x74, 0xE8, 0xCD, 0x87, 0x13, 0x26, 0x4C,
+	0x98, 0x2D, 0x5A, 0xB4, 0x75, 0xEA, 0xC9, 0x8F, 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0xC0, 0x9D,
+	0x27, 0x4E, 0x9C, 0x25, 0x4A, 0x94, 0x35, 0x6A, 0xD4, 0xB5, 0x77, 0xEE, 0xC1, 0x9F, 0x23, 0x46,
+	0x8C, 0x05, 0x0A, 0x14, 0x28, 0x50, 0xA0, 0x5D, 0xBA, 0x69, 0xD2, 0xB9, 0x6F, 0xDE, 0xA1, 0x5F,
+	0xBE, 0x61, 0xC2, 0x99, 0x2F, 0x5E, 0xBC, 0x65, 0xCA, 0x89, 0x0F, 0x1E, 0x3C, 0x78, 0xF0, 0xFD,
+	0xE7, 0xD3, 0xBB, 0x6B, 0xD6, 0xB1, 0x7F, 0xFE, 0xE1, 0xDF, 0xA3, 0x5B, 0xB6, 0x71, 0xE2, 0xD9,
+	0xAF, 0x43, 0x86, 0x11, 0x22, 0x44, 0x88, 0x0D, 0x1A, 0x34, 0x68, 0xD0, 0xBD, 0x67, 0xCE, 0x81,
+	0x1F, 0x3E, 0x7C, 0xF8, 0xED, 0xC7, 0x93, 0x3B, 0x76, 0xEC, 0xC5, 0x97, 0x33, 0x66, 0xCC, 0x85,
+	0x17, 0x2E, 0x5C, 0xB8, 0x6D, 0xDA, 0xA9, 0x4F, 0x9E, 0x21, 0x42, 0x84, 0x15, 0x2A, 0x54, 0xA8,
+	0x4D, 0x9A, 0x29, 0x52, 0xA4, 0x55, 0xAA, 0x49, 0x92, 0x39, 0x72, 0xE4, 0xD5, 0xB7, 0x73, 0xE6,
+	0xD1, 0xBF, 0x63, 0xC6, 0x91, 0x3F, 0x7E, 0xFC, 0xE5, 0xD7, 0xB3, 0x7B, 0xF6, 0xF1, 0xFF, 0xE3,
+	0xDB, 0xAB, 0x4B, 0x96, 0x31, 0x62, 0xC4, 0x95, 0x37, 0x6E, 0xDC, 0xA5, 0x57, 0xAE, 0x41, 0x82,
+	0x19, 0x32, 0x64, 0xC8, 0x8D, 0x07, 0x0E, 0x1C, 0x38, 0x70, 0xE0, 0xDD, 0xA7, 0x53, 0xA6, 0x51,
+	0xA2, 0x59, 0xB2, 0x79, 0xF2, 0xF9, 0xEF, 0xC3, 0x9B, 0x2B, 0x56, 0xAC, 0x45, 0x8A, 0x09, 0x12,
+	0x24, 0x48, 0x90, 0x3D, 0x7A, 0xF4, 0xF5, 0xF7, 0xF3, 0xFB, 0xEB, 0xCB, 0x8B, 0x0B, 0x16, 0x2C,
+	0x58, 0xB0, 0x7D, 0xFA, 0xE9, 0xCF, 0x83, 0x1B, 0x36, 0x6C, 0xD8, 0xAD, 0x47, 0x8E,
+};
+
+// Logarithms in GF(2^8 / 0x11D), the inverse of GF_EXP. GF_LOG[0] is undefined and set to 0
+const uint8_t QrCode::GF_LOG[256] = {
+	0x00, 0x00, 0x01, 0x19, 0x02, 0x32, 0x1A, 0xC6, 0x03, 0xDF, 0x33, 0xEE, 0x1B, 0x68, 0xC7, 0x4B,
+	0x04, 0x64, 0xE0, 0x0E, 0x34, 0x8D, 0xEF, 0x81, 0x1C, 0xC1, 0x69, 0xF8, 0xC8, 0x08, 0x4C, 0x71,
+	0x05, 0x8A, 0x65, 0x2F, 0xE1, 0x24, 0x0F, 0x21, 0x35, 0x93, 0x8E, 0xDA, 0xF0, 0x12, 0x82, 0x45,
+	0x1D, 0xB5, 0xC2, 0x7D, 0x6A, 0x27, 0xF9, 0xB9, 0xC9, 0x9A, 0x09, 0x78, 0x4D, 0xE4, 0x72, 0xA6,
+	0x06, 0xBF, 0x8B, 0x62, 0x66, 0xDD, 0x30, 0xFD, 0xE2, 0x98, 0x25, 0xB3, 0x10, 0x91, 0x22, 0x88,
+	0x36, 0xD0, 0x94, 0xCE, 0x8F, 0x96, 0xDB, 0xBD, 0xF1, 0xD2, 0x13, 0x5C, 0x83, 0x38, 0x46, 0x40,
+	0x1E, 0x42, 0xB6, 0xA3, 0xC3, 0x48, 0x7E, 0x6E, 0x6B, 0x3A, 0x28, 0x54, 0xFA, 0x85, 0xBA, 0x3D,
+	0xCA, 0x5E, 0x9B, 0x9F, 0x0A, 0x15, 0x79, 0x2B, 0x4E, 0xD4, 0xE5, 0xAC, 0x73, 0xF3, 0xA7, 0x57,
+	0x07, 0x70, 0xC0, 0xF7, 0x8C, 0x80, 0x63, 0x0D, 0x67, 0x4A, 0xDE, 0xED, 0x31, 0xC5, 0xFE, 0x18,
+	0xE3, 0xA5, 0x99, 0x77, 0x26, 0xB8, 0xB4, 0x7C, 0x11, 0x44, 0x92, 0xD9, 0x23, 0x20, 0x89, 0x2E,
+	0x37, 0x3F, 0xD1, 0x5B, 0x95, 0xBC, 0xCF, 0xCD, 0x90, 0x87, 0x97, 0xB2, 0xDC, 0xFC, 0xBE, 0x61,
+	0xF2, 0x56, 0xD3, 0xAB, 0x14, 0x2A, 0x5D, 0x9E, 0x84, 0x3C, 0x39, 0x53, 0x47, 0x6D, 0x41, 0xA2,
+	0x1F, 0x2D, 0x43, 0xD8, 0xB7, 0x7B, 0xA4, 0x76, 0xC4, 0x17, 0x49, 0xEC, 0x7F, 0x0C, 0x6F, 0xF6,
+	0x6C, 0xA1, 0x3B, 0x52, 0x29, 0x9D, 0x55, 0xAA, 0xFB, 0x60, 0x86, 0xB1, 0xBB, 0xCC, 0x3E, 0x5A,
+	0xCB, 0x59, 0x5F, 0xB0, 0x9C, 0xA9, 0xA0, 0x51, 0x0B, 0xF5, 0x16, 0xEB, 0x7A, 0x75, 0x2C, 0xD7,
+	0x4F, 0xAE, 0xD5, 0xE9, 0xE6, 0xE7, 0xAD, 0xE8, 0x74, 0xD6, 0xF4, 0xEA, 0xA8, 0x50, 0x58, 0xAF,
+};
+
+
 data_too_long::data_too_long(const std::string &msg) :
 	std::length_error(msg) {}
 
 
+MicroQrCode MicroQrCode::encodeText(const char *text, QrCode::Ecc ecl) {
+	// Segment with the header lengths of the smallest QR Codes, which are a little
+	// longer than those of Micro QR Codes and so never split a run too eagerly
+	vector<QrSegment> segs = QrSegment::makeSegmentsOptimally(text, QrCode::MIN_VERSION);
+	return encodeSegments(segs, ecl);
+}
+
+
+MicroQrCode MicroQrCode::encodeSegments(const vector<QrSegment> &segs, QrCode::Ecc ecl,
+		int minVersion, int maxVersion, int mask, bool boostEcl) {
+	if (!(MIN_VERSION <= minVersion && minVersion <= maxVersion && maxVersion <= MAX_VERSION) || mask < -1 || mask > 3
+			|| ecl == QrCode::Ecc::HIGH)
+		throw std::invalid_argument("Invalid value");
+	for (const QrSegment &seg : segs) {
+		int modeBits = seg.getMode().getModeBits();
+		if (modeBits == QrSegment::Mode::ECI.getModeBits() || modeBits == QrSegment::Mode::STRUCTURED_APPEND.getModeBits())
+			throw std::invalid_argument("Segment mode not supported by Micro QR Code");
+	}
+	
+	// Find the minimal version number to use, skipping those without the error correction level
+	int version, dataUsedBits;
+	for (version = minVersion; ; version++) {
+		int symbol = getSymbolNumber(version, ecl);
+		int dataCapacityBits = symbol == -1 ? 0 : NUM_DATA_BITS[symbol];
+		dataUsedBits = getTotalBits(segs, version);
+		if (symbol != -1 && dataUsedBits != -1 && dataUsedBits <= dataCapacityBits)
+			break;  // This version number is found to be suitable
+		if (version >= maxVersion) {  // All versions in the range could not fit the given data
+			std::ostringstream sb;
+			if (dataUsedBits == -1)
+				sb << "Segment too long or mode not available";
+			else {
+				sb << "Data length = " << dataUsedBits << " bits, ";
+				sb << "Max capacity = " << dataCapacityBits << " bits";
+			}
+			throw data_too_long(sb.str());
+		}
+	}
+	
+	// Increase the error correction level while the data still fits in the current version number
+	for (QrCode::Ecc newEcl : {QrCode::Ecc::MEDIUM, QrCode::Ecc::QUARTILE}) {  // From low to high
+		int symbol = getSymbolNumber(version, newEcl);
+		if (boostEcl && symbol != -1 && dataUsedBits <= NUM_DATA_BITS[symbol])
+			ecl = newEcl;
+	}
+	
+	// Concatenate all segments to create the data bit string. The mode indicator
+	// is version - 1 bits long, and is the QR Code one's bit position
+	BitBuffer bb;
+	for (const QrSegment &seg : segs) {
+		bb.appendBits(static_cast<uint32_t>(QrCode::countTrailingZeros(seg.getMode().getModeBits())), version - 1);
+		bb.appendBits(static_cast<uint32_t>(seg.getNumChars()), getNumCharCountBits(seg.getMode(), version));
+		bb.appendData(seg.getData());
+	}
+	if (bb.size() != static_cast<unsigned int>(dataUsedBits))
+		throw std::logic_error("Assertion error");
+	
+	// Add the terminator (version * 2 + 1 bits) and pad up to a byte if applicable
+	size_t dataCapacityBits = static_cast<size_t>(NUM_DATA_BITS[getSymbolNumber(version, ecl)]);
+	bb.appendBits(0, std::min(version * 2 + 1, static_cast<int>(dataCapacityBits - bb.size())));
+	bb.appendBits(0, std::min((8 - static_cast<int>(bb.size() % 8)) % 8, static_cast<int>(dataCapacityBits - bb.size())));
+	
+	// Pad with alternating bytes, and in M1 and M3 fill the last 4-bit codeword with 0s
+	for (uint8_t padByte = 0xEC; bb.size() + 8 <= dataCapacityBits; padByte ^= 0xEC ^ 0x11)
+		bb.appendBits(padByte, 8);
+	bb.appendBits(0, static_cast<int>(dataCapacityBits - bb.size()));
+	
+	// The bits are already packed into bytes in big endian
+	return MicroQrCode(version, ecl, bb.getBytes(), mask);
+}
+
+
+MicroQrCode::MicroQrCode(int ver, QrCode::Ecc ecl, const vector<uint8_t> &dataCodewords, int msk) :
+		// Initialize fields
+		version(ver),
+		errorCorrectionLevel(ecl) {
+	// Check arguments
+	if (ver < MIN_VERSION || ver > MAX_VERSION)
+		throw std::domain_error("Version value out of range");
+	if (msk < -1 || msk > 3)
+		throw std::domain_error("Mask value out of range");
+	int symbol = getSymbolNumber(ver, ecl);
+	if (symbol == -1)
+		throw std::domain_error("Error correction level not available at this version");
+	int dataBits = NUM_DATA_BITS[symbol];
+	size_t dataLen = static_cast<size_t>(dataBits + 7) / 8;
+	size_t eccLen = static_cast<size_t>(NUM_ECC_CODEWORDS[symbol]);
+	if (dataCodewords.size() != dataLen)
+		throw std::invalid_argument("Invalid argument");
+	size = ver * 2 + 9;
+	
+	// Compute the ECC of the single block. A 4-bit last data codeword is the
+	// value of its 4 bits in the Reed-Solomon code
+	static const std::array<std::array<uint8_t,14>,8> divisors = [] {
+		std::array<std::array<uint8_t,14>,8> result = {};
+		for (size_t i = 0; i < result.size(); i++)
+			QrCode::reedSolomonComputeDivisor(NUM_ECC_CODEWORDS[i], result[i].data());
+		return result;
+	}();
+	std::array<uint8_t,16> data;
+	std::copy(dataCodewords.begin(), dataCodewords.end(), data.begin());
+	bool shortLast = dataBits % 8 != 0;
+	if (shortLast)
+		data[dataLen - 1] >>= 4;
+	std::array<uint8_t,14> ecc;
+	QrCode::reedSolomonComputeRemainder(data.data(), dataLen, divisors[static_cast<size_t>(symbol)].data(), eccLen, ecc.data());
+	
+	// Draw the codewords onto the function patterns, in the order of the version layout
+	const QrCode::VersionLayout &layout = getVersionLayout(ver);
+	modules = layout.modules;
+	const uint16_t *pos = layout.order.data();
+	for (size_t i = 0; i < dataLen + eccLen; i++) {
+		uint8_t codeword = i < dataLen ? data[i] : ecc[i - dataLen];
+		for (int j = (shortLast && i == dataLen - 1 ? 4 : 8) - 1; j >= 0; j--, pos++) {
+			if (((codeword >> j) & 1) != 0)
+				modules[*pos >> 6] |= uint64_t(1) << (*pos & 63);
+		}
+	}
+	if (pos != layout.order.data() + layout.order.size())
+		throw std::logic_error("Assertion error");
+	
+	// Do masking with the QR Code mask patterns, choosing the mask of the highest score
+	vector<uint64_t> isFunction(layout.isFunction);
+	QrCode::Grid grid{modules.data(), isFunction.data(), version, size, 1, errorCorrectionLevel};
+	if (msk == -1) {
+		int maxScore = -1;
+		for (int i = 0; i < 4; i++) {
+			QrCode::applyMask(grid, MASK_PATTERNS[i]);
+			int score = getMaskScore(grid);
+			if (score > maxScore) {
+				msk = i;
+				maxScore = score;
+			}
+			QrCode::applyMask(grid, MASK_PATTERNS[i]);  // Undoes the mask due to XOR
+		}
+	}
+	if (msk < 0 || msk > 3)
+		throw std::logic_error("Assertion error");
+	this->mask = msk;
+	QrCode::applyMask(grid, MASK_PATTERNS[msk]);  // Apply the final choice of mask
+	drawFormatBits(grid, symbol, msk);  // Overwrite the dummy format bits
+}
+
+
+int MicroQrCode::getVersion() const {
+	return version;
+}
+
+
+int MicroQrCode::getSize() const {
+	return size;
+}
+
+
+QrCode::Ecc MicroQrCode::getErrorCorrectionLevel() const {
+	return errorCorrectionLevel;
+}
+
+
+int MicroQrCode::getMask() const {
+	return mask;
+}
+
+
+bool MicroQrCode::getModule(int x, int y) const {
+	return 0 <= x && x < size && 0 <= y && y < size
+		&& ((modules[static_cast<size_t>(y)] >> x) & 1) != 0;
+}
+
+
+std::string MicroQrCode::toSvgString(int border) const {
+	if (border < 0)
+		throw std::domain_error("Border must be non-negative");
+	if (border > INT_MAX / 2 || border * 2 > INT_MAX - size)
+		throw std::overflow_error("Border too large");
+	
+	std::ostringstream sb;
+	sb << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+	sb << "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n";
+	sb << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\" viewBox=\"0 0 ";
+	sb << (size + border * 2) << " " << (size + border * 2) << "\" stroke=\"none\">\n";
+	sb << "\t<rect width=\"100%\" height=\"100%\" fill=\"#FFFFFF\"/>\n";
+	sb << "\t<path d=\"";
+	bool first = true;
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			if (!getModule(x, y))
+				continue;
+			int start = x;  // One path segment for each horizontal run of black modules
+			while (getModule(x + 1, y))
+				x++;
+			if (!first)
+				sb << " ";
+			first = false;
+			sb << "M" << (start + border) << "," << (y + border);
+			sb << "h" << (x + 1 - start) << "v1h-" << (x + 1 - start) << "z";
+		}
+	}
+	sb << "\" fill=\"#000000\"/>\n";
+	sb << "</svg>\n";
+	return sb.str();
+}
+
+
+int MicroQrCode::getSymbolNumber(int ver, QrCode::Ecc ecl) {
+	if (ver < MIN_VERSION || ver > MAX_VERSION)
+		throw std::domain_error("Version number out of range");
+	static const std::int8_t SYMBOL_NUMBERS[4][3] = {
+		// LOW, MEDIUM, QUARTILE
+		{0, -1, -1},  // M1, error detection only
+		{1,  2, -1},  // M2
+		{3,  4, -1},  // M3
+		{5,  6,  7},  // M4
+	};
+	int level = static_cast<int>(ecl);
+	return level > 2 ? -1 : SYMBOL_NUMBERS[ver - 1][level];
+}
+
+
+int MicroQrCode::getTotalBits(const vector<QrSegment> &segs, int ver) {
+	long result = 0;
+	for (const QrSegment &seg : segs) {
+		int ccbits = getNumCharCountBits(seg.getMode(), ver);
+		if (ccbits == -1 || seg.getNumChars() >= (1L << ccbits))
+			return -1;  // The mode is not available, or the segment's length doesn't fit the field's bit width
+		result += (ver - 1) + ccbits + static_cast<long>(seg.getData().size());
+		if (result > INT_MAX)
+			return -1;  // The sum will overflow an int type
+	}
+	return static_cast<int>(result);
+}
+
+
+int MicroQrCode::getNumCharCountBits(const QrSegment::Mode &mode, int ver) {
+	// The mode of bit position n (numeric, alphanumeric, byte, kanji) is available
+	// from version n + 1, with a field of 3, 3, 4 and 3 bits at M1 to M4 growing by
+	// 1 bit per version
+	static const int FIRST_VERSION[4] = {1, 2, 3, 3};
+	static const int FIRST_WIDTH[4] = {3, 3, 4, 3};
+	int modeBits = mode.getModeBits();
+	if (modeBits == 0 || (modeBits & (modeBits - 1)) != 0 || modeBits > 8)
+		return -1;  // ECI and Structured Append
+	int n = QrCode::countTrailingZeros(static_cast<uint64_t>(modeBits));
+	return ver < FIRST_VERSION[n] ? -1 : FIRST_WIDTH[n] + ver - FIRST_VERSION[n];
+}
+
+
+const QrCode::VersionLayout &MicroQrCode::getVersionLayout(int ver) {
+	if (ver < MIN_VERSION || ver > MAX_VERSION)
+		throw std::domain_error("Version number out of range");
+	static const vector<QrCode::VersionLayout> layouts = [] {
+		vector<QrCode::VersionLayout> result(MAX_VERSION + 1);
+		for (int v = MIN_VERSION; v <= MAX_VERSION; v++) {
+			QrCode::VersionLayout &layout = result.at(static_cast<size_t>(v));
+			int size = v * 2 + 9;
+			layout.modules.assign(static_cast<size_t>(size), 0);
+			layout.isFunction.assign(static_cast<size_t>(size), 0);
+			QrCode::Grid grid{layout.modules.data(), layout.isFunction.data(), v, size, 1, QrCode::Ecc::LOW};
+			drawFunctionPatterns(grid);
+			// Do the funny zigzag scan, without the QR Code's timing column, once per version
+			QrCode::walkZigzag(size, 0, [&layout](int x, int y) {
+				if (((layout.isFunction[static_cast<size_t>(y)] >> x) & 1) == 0)
+					layout.order.push_back(static_cast<uint16_t>(y * 64 + x));
+			});
+			int symbol = getSymbolNumber(v, QrCode::Ecc::LOW);
+			if (static_cast<int>(layout.order.size()) != NUM_DATA_BITS[symbol] + NUM_ECC_CODEWORDS[symbol] * 8)
+				throw std::logic_error("Assertion error");  // No remainder bits in any version
+		}
+		return result;
+	}();
+	return layouts[static_cast<size_t>(ver)];
+}
+
+
+void MicroQrCode::drawFunctionPatterns(const QrCode::Grid &grid) {
+	int size = grid.size;
+	// Mark the bits past the end of each row, so that masking leaves them 0
+	for (int y = 0; y < size; y++)
+		grid.isFunction[y] = ~uint64_t(0) << size;
+	
+	// Draw the finder pattern with its separator in the top left corner only
+	QrCode::drawFinderPattern(grid, 3, 3);
+	
+	// Draw the timing patterns along the top row and the left column
+	for (int i = 8; i < size; i++) {
+		QrCode::setFunctionModule(grid, i, 0, i % 2 == 0);
+		QrCode::setFunctionModule(grid, 0, i, i % 2 == 0);
+	}
+	
+	// Draw configuration data
+	drawFormatBits(grid, 0, 0);  // Dummy symbol and mask values; overwritten later in the constructor
+}
+
+
+void MicroQrCode::drawFormatBits(const QrCode::Grid &grid, int symbolNumber, int msk) {
+	// Calculate error correction code and pack bits, as for QR Code with another XOR mask
+	int data = symbolNumber << 2 | msk;  // symbolNumber is uint3, msk is uint2
+	int rem = data;
+	for (int i = 0; i < 10; i++)
+		rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+	int bits = (data << 10 | rem) ^ 0x4445;  // uint15
+	if (bits >> 15 != 0)
+		throw std::logic_error("Assertion error");
+	
+	// Draw the single copy, down column 8 then leftward along row 8
+	for (int i = 0; i < 8; i++)
+		QrCode::setFunctionModule(grid, 8, i + 1, QrCode::getBit(bits, i));
+	for (int i = 8; i < 15; i++)
+		QrCode::setFunctionModule(grid, 15 - i, 8, QrCode::getBit(bits, i));
+}
+
+
+int MicroQrCode::getMaskScore(const QrCode::Grid &grid) {
+	int size = grid.size;
+	int bottom = QrCode::popCount(grid.modules[size - 1] & ~uint64_t(1));
+	int right = 0;
+	for (int y = 1; y < size; y++)
+		right += static_cast<int>((grid.modules[y] >> (size - 1)) & 1);
+	return std::min(bottom, right) * 16 + std::max(bottom, right);
+}
+
+
+const int MicroQrCode::MASK_PATTERNS[4] = {1, 4, 6, 7};
+
+const std::int16_t MicroQrCode::NUM_DATA_BITS[8] = {
+	// M1, M2-L, M2-M, M3-L, M3-M, M4-L, M4-M, M4-Q
+	20, 40, 32, 84, 68, 128, 112, 80,
+};
+
+const std::int8_t MicroQrCode::NUM_ECC_CODEWORDS[8] = {
+	// M1, M2-L, M2-M, M3-L, M3-M, M4-L, M4-M, M4-Q
+	2, 5, 6, 6, 8, 8, 10, 14,
+};
+
+
+QrCodeCache::QrCodeCache(size_t budget) :
+	maxBytes(budget),
+	bytes(0),
+	hits(0),
+	misses(0) {}
+
+
+QrCode QrCodeCache::encodeText(const char *text, QrCode::Ecc ecl) {
+	std::string key = "T";
+	key += static_cast<char>(ecl);
+	key += text;
+	return lookup(key, [text, ecl]() { return QrCode::encodeText(text, ecl); });
+}
+
+
+QrCode QrCodeCache::encodeSegments(const vector<QrSegment> &segs, QrCode::Ecc ecl,
+		int minVersion, int maxVersion, int mask, bool boostEcl) {
+	// Fixed-width fields, then every segment's mode, character count, bit length and packed bits
+	std::string key = "S";
+	const int fields[] = {static_cast<int>(ecl), minVersion, maxVersion, mask, boostEcl ? 1 : 0};
+	key.append(reinterpret_cast<const char*>(fields), sizeof(fields));
+	for (const QrSegment &seg : segs) {
+		const int header[] = {seg.getMode().getModeBits(), seg.getNumChars(), static_cast<int>(seg.getData().size())};
+		key.append(reinterpret_cast<const char*>(header), sizeof(header));
+		const vector<uint8_t> &data = seg.getData().getBytes();
+		key.append(data.begin(), data.end());
+	}
+	return lookup(key, [&segs, ecl, minVersion, maxVersion, mask, boostEcl]() {
+		return QrCode::encodeSegments(segs, ecl, minVersion, maxVersion, mask, boostEcl);
+	});
+}
+
+
+template <typename Encode>
+QrCode QrCodeCache::lookup(const std::string &key, Encode encode) {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		auto found = index.find(key);
+		if (found != index.end()) {
+			hits++;
+			entries.splice(entries.begin(), entries, found->second);  // Now the most recently used
+			return found->second->second;
+		}
+		misses++;
+	}
+	
+	// Encode without the lock. An exception such as data_too_long leaves the cache unchanged
+	QrCode qr = encode();
+	size_t entryBytes = getEntryBytes(key, qr);
+	if (entryBytes > maxBytes)
+		return qr;
+	
+	std::lock_guard<std::mutex> guard(lock);
+	if (index.find(key) == index.end()) {  // Another thread may have added it meanwhile
+		entries.emplace_front(key, qr);
+		index[key] = entries.begin();
+		bytes += entryBytes;
+		while (bytes > maxBytes) {  // Evict the least recently used
+			bytes -= getEntryBytes(entries.back().first, entries.back().second);
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+	}
+	return qr;
+}
+
+
+void QrCodeCache::clear() {
+	std::lock_guard<std::mutex> guard(lock);
+	entries.clear();
+	index.clear();
+	bytes = 0;
+}
+
+
+size_t QrCodeCache::getCount() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return entries.size();
+}
+
+
+size_t QrCodeCache::getBytes() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return bytes;
+}
+
+
+unsigned long QrCodeCache::getHits() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return hits;
+}
+
+
+unsigned long QrCodeCache::getMisses() const {
+	std::lock_guard<std::mutex> guard(lock);
+	return misses;
+}
+
+
+size_t QrCodeCache::getEntryBytes(const std::string &key, const QrCode &qr) {
+	// The key twice (list and index), the packed grid, and the nodes and object themselves
+	size_t gridWords = static_cast<size_t>(qr.getSize()) * static_cast<size_t>((qr.getSize() + 63) / 64);
+	return key.size() * 2 + gridWords * sizeof(uint64_t) + sizeof(QrCode) + 128;
+}
+
+
+decode_error::decode_error(const std::string &msg) :
+	std::runtime_error(msg) {}
+
+
+
+vector<QrSegment> QrDecoder::decode(const QrCode &qr, int *corrected) {
+	return decodeGrid(qr.modules, qr.size, corrected);
+}
+
+
+vector<QrSegment> QrDecoder::decodeStructuredAppend(const vector<QrCode> &symbols, int *corrected) {
+	if (symbols.empty())
+		throw decode_error("No symbols");
+	vector<vector<QrSegment> > parts(symbols.size());
+	vector<bool> seen(symbols.size());
+	int parity = -1;
+	int totalCorrected = 0;
+	for (const QrCode &qr : symbols) {
+		int fixed = 0;
+		vector<QrSegment> segs = decode(qr, &fixed);
+		totalCorrected += fixed;
+		if (segs.empty() || segs.front().getMode().getModeBits() != QrSegment::Mode::STRUCTURED_APPEND.getModeBits()) {
+			if (symbols.size() != 1)
+				throw decode_error("Symbol without a structured append header");
+			if (corrected != nullptr)
+				*corrected = totalCorrected;
+			return segs;
+		}
+		
+		// The header holds the position, the count minus 1 and the parity, 4, 4 and 8 bits
+		const BitBuffer &header = segs.front().getData();
+		int index = 0, count = 0, par = 0;
+		for (size_t i = 0; i < 16; i++) {
+			int &field = i < 4 ? index : i < 8 ? count : par;
+			field = field << 1 | static_cast<int>(header.at(i));
+		}
+		if (count + 1 != static_cast<int>(symbols.size()))
+			throw decode_error("Structured append symbols missing or extra");
+		if (parity != -1 && par != parity)
+			throw decode_error("Symbols of different structured append sequences");
+		if (index > count || seen.at(static_cast<size_t>(index)))
+			throw decode_error("Structured append position repeated");
+		seen.at(static_cast<size_t>(index)) = true;
+		parity = par;
+		parts.at(static_cast<size_t>(index)).assign(segs.begin() + 1, segs.end());
+	}
+	vector<QrSegment> result;
+	for (const vector<QrSegment> &part : parts)
+		result.insert(result.end(), part.begin(), part.end());
+	if (corrected != nullptr)
+		*corrected = totalCorrected;
+	return result;
+}
+
+
+vector<QrSegment> QrDecoder::decode(const vector<bool> &modules, int size, int *corrected) {
+	if (size < 21 || size > 177 || (size - 17) % 4 != 0)
+		throw decode_error("Invalid size");
+	if (modules.size() != static_cast<size_t>(size * size))
+		throw std::invalid_argument("Grid size does not match");
+	int rowWords = (size + 63) / 64;
+	vector<uint64_t> packed(static_cast<size_t>(size * rowWords));
+	for (int y = 0; y < size; y++) {
+		for (int x = 0; x < size; x++) {
+			if (modules[static_cast<size_t>(y * size + x)])
+				packed[static_cast<size_t>(y * rowWords + (x >> 6))] |= uint64_t(1) << (x & 63);
+		}
+	}
+	return decodeGrid(packed, size, corrected);
+}
+
+
+vector<QrSegment> QrDecoder::decodeGrid(const vector<uint64_t> &modules, int size, int *corrected) {
+	if (size < 21 || size > 177 || (size - 17) % 4 != 0)
+		throw decode_error("Invalid size");
+	int version = (size - 17) / 4;
+	int rowWords = (size + 63) / 64;
+	
+	// Read both copies of the format bits, at the positions drawFormatBits() draws them
+	long format0 = 0, format1 = 0;
+	for (int i = 0; i <= 5; i++)
+		format0 |= static_cast<long>(getModule(modules, rowWords, 8, i)) << i;
+	format0 |= static_cast<long>(getModule(modules, rowWords, 8, 7)) << 6;
+	format0 |= static_cast<long>(getModule(modules, rowWords, 8, 8)) << 7;
+	format0 |= static_cast<long>(getModule(modules, rowWords, 7, 8)) << 8;
+	for (int i = 9; i < 15; i++)
+		format0 |= static_cast<long>(getModule(modules, rowWords, 14 - i, 8)) << i;
+	for (int i = 0; i < 8; i++)
+		format1 |= static_cast<long>(getModule(modules, rowWords, size - 1 - i, 8)) << i;
+	for (int i = 8; i < 15; i++)
+		format1 |= static_cast<long>(getModule(modules, rowWords, 8, size - 15 + i)) << i;
+	vector<std::pair<int,long> > formats;
+	for (int data = 0; data < 32; data++) {
+		int rem = data;
+		for (int i = 0; i < 10; i++)
+			rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+		formats.push_back(std::make_pair(data, static_cast<long>((data << 10 | rem) ^ 0x5412)));
+	}
+	int format = findClosest(formats, format0, format1);
+	if (format == -1)
+		throw decode_error("Format bits unreadable");
+	int msk = format & 7;
+	QrCode::Ecc ecl;
+	switch (format >> 3) {  // The inverse of QrCode::getFormatBits()
+		case 1:  ecl = QrCode::Ecc::LOW;       break;
+		case 0:  ecl = QrCode::Ecc::MEDIUM;    break;
+		case 3:  ecl = QrCode::Ecc::QUARTILE;  break;
+		case 2:  ecl = QrCode::Ecc::HIGH;      break;
+		default:  throw std::logic_error("Assertion error");
+	}
+	
+	// Check the version bits against the size
+	if (version >= 7) {
+		long version0 = 0, version1 = 0;
+		for (int i = 0; i < 18; i++) {
+			int a = size - 11 + i % 3;
+			int b = i / 3;
+			version0 |= static_cast<long>(getModule(modules, rowWords, a, b)) << i;
+			version1 |= static_cast<long>(getModule(modules, rowWords, b, a)) << i;
+		}
+		vector<std::pair<int,long> > versions;
+		for (int v = 7; v <= QrCode::MAX_VERSION; v++) {
+			int rem = v;
+			for (int i = 0; i < 12; i++)
+				rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
+			versions.push_back(std::make_pair(v, static_cast<long>(v) << 12 | rem));
+		}
+		if (findClosest(versions, version0, version1) != version)
+			throw decode_error("Version bits unreadable or do not match the size");
+	}
+	
+	// Read the data modules in the zigzag order of QrCode::drawCodewords(), undoing the mask
+	const vector<uint16_t> &order = QrCode::getVersionLayout(version).order;
+	size_t numCodewords = order.size() / 8;
+	vector<uint8_t> raw(numCodewords);
+	int rowBits = rowWords * 64;
+	for (size_t i = 0; i < order.size(); i++) {
+		int x = order[i] % rowBits;
+		int y = order[i] / rowBits;
+		uint64_t bit = (modules[order[i] >> 6] ^ QrCode::getMaskPattern(msk, y)[x >> 6]) >> (x & 63) & 1;
+		raw[i >> 3] |= static_cast<uint8_t>(bit << (7 - (i & 7)));
+	}
+	
+	// De-interleave the blocks as laid out by QrCode::addEccAndInterleave(), and correct each one
+	const QrCode::BlockLayout &layout = QrCode::getBlockLayout(version, ecl);
+	int numBlocks = layout.numBlocks;
+	int blockEccLen = layout.blockEccLen;
+	int numShortBlocks = layout.numShortBlocks;
+	int shortDataLen = layout.shortBlockLen - blockEccLen;
+	size_t dataLen = static_cast<size_t>(QrCode::getNumDataCodewords(version, ecl));
+	vector<uint8_t> data(dataLen);
+	std::array<uint8_t,256> block;
+	int totalCorrected = 0;
+	for (int b = 0, k = 0; b < numBlocks; b++) {
+		int datLen = shortDataLen + (b < numShortBlocks ? 0 : 1);
+		for (int j = 0; j < shortDataLen; j++)
+			block[static_cast<size_t>(j)] = raw[static_cast<size_t>(j * numBlocks + b)];
+		if (b >= numShortBlocks)
+			block[static_cast<size_t>(shortDataLen)] = raw[static_cast<size_t>(shortDataLen * numBlocks + b - numShortBlocks)];
+		for (int j = 0; j < blockEccLen; j++)
+			block[static_cast<size_t>(datLen + j)] = raw[dataLen + static_cast<size_t>(j * numBlocks + b)];
+		totalCorrected += correctBlock(block.data(), datLen + blockEccLen, blockEccLen);
+		std::copy(block.begin(), block.begin() + datLen, data.begin() + k);
+		k += datLen;
+	}
+	if (corrected != nullptr)
+		*corrected = totalCorrected;
+	return parseSegments(data, version);
+}
+
+
+bool QrDecoder::getModule(const vector<uint64_t> &modules, int rowWords, int x, int y) {
+	return ((modules[static_cast<size_t>(y * rowWords + (x >> 6))] >> (x & 63)) & 1) != 0;
+}
 
-BitBuffer::BitBuffer()
-	: std::vector<bool>() {}
+
+int QrDecoder::findClosest(const vector<std::pair<int,long> > &candidates, long copy0, long copy1) {
+	int result = -1;
+	int bestDistance = 4;  // Both format and version codes correct up to 3 bit errors
+	for (const std::pair<int,long> &candidate : candidates) {
+		int distance = std::min(QrCode::popCount(static_cast<uint64_t>(candidate.second ^ copy0)),
+		                        QrCode::popCount(static_cast<uint64_t>(candidate.second ^ copy1)));
+		if (distance < bestDistance) {
+			result = candidate.first;
+			bestDistance = distance;
+		}
+	}
+	return result;
+}
+
+
+int QrDecoder::correctBlock(uint8_t *codeword, int length, int eccLen) {
+	const uint8_t *exp = QrCode::GF_EXP;
+	const uint8_t *log = QrCode::GF_LOG;
+	// The codeword is a polynomial with the first byte as the highest power, and the
+	// generator's roots are 0x02^0 to 0x02^(eccLen - 1). Syndrome i is its value at root i
+	std::array<uint8_t,256> syndromes;
+	bool clean = true;
+	for (int i = 0; i < eccLen; i++) {
+		uint8_t value = 0;
+		for (int j = 0; j < length; j++)  // Horner's method, multiplying by 0x02^i
+			value = static_cast<uint8_t>((value == 0 ? 0 : exp[log[value] + i]) ^ codeword[j]);
+		syndromes[static_cast<size_t>(i)] = value;
+		clean = clean && value == 0;
+	}
+	if (clean)
+		return 0;
+	
+	// Berlekamp-Massey: the shortest error locator polynomial, lowest power first
+	std::array<uint8_t,256> locator = {}, previous = {}, temp;
+	locator[0] = previous[0] = 1;
+	int errors = 0, shift = 1;
+	uint8_t previousDelta = 1;
+	for (int r = 0; r < eccLen; r++) {
+		uint8_t delta = syndromes[static_cast<size_t>(r)];
+		for (int i = 1; i <= errors; i++)
+			delta ^= QrCode::reedSolomonMultiply(locator[static_cast<size_t>(i)], syndromes[static_cast<size_t>(r - i)]);
+		if (delta == 0) {
+			shift++;
+			continue;
+		}
+		uint8_t factor = exp[log[delta] + 255 - log[previousDelta]];  // delta / previousDelta
+		temp = locator;
+		for (int i = 0; i + shift <= eccLen; i++)
+			locator[static_cast<size_t>(i + shift)] ^= QrCode::reedSolomonMultiply(factor, previous[static_cast<size_t>(i)]);
+		if (2 * errors <= r) {
+			errors = r + 1 - errors;
+			previous = temp;
+			previousDelta = delta;
+			shift = 1;
+		} else
+			shift++;
+	}
+	if (2 * errors > eccLen)
+		throw decode_error("Too many errors in a block");
+	
+	// Error evaluator: syndromes times locator, modulo x^eccLen
+	std::array<uint8_t,256> evaluator = {};
+	for (int k = 0; k < eccLen; k++) {
+		for (int i = 0; i <= std::min(k, errors); i++)
+			evaluator[static_cast<size_t>(k)] ^= QrCode::reedSolomonMultiply(locator[static_cast<size_t>(i)], syndromes[static_cast<size_t>(k - i)]);
+	}
+	
+	// Chien search for the error positions, and Forney's formula for their values
+	int found = 0;
+	for (int j = 0; j < length; j++) {
+		int power = length - 1 - j;               // Byte j is the coefficient of x^power
+		int inverseLog = (255 - power) % 255;     // Logarithm of X^-1, where X = 0x02^power
+		uint8_t locatorValue = 0, derivativeValue = 0, evaluatorValue = 0;
+		for (int i = 0; i <= errors; i++) {
+			uint8_t term = locator[static_cast<size_t>(i)] == 0 ? 0 :
+				exp[(log[locator[static_cast<size_t>(i)]] + inverseLog * i) % 255];
+			locatorValue ^= term;
+			if (i % 2 == 1)  // The formal derivative keeps the odd powers, lowered by one
+				derivativeValue ^= locator[static_cast<size_t>(i)] == 0 ? 0 :
+					exp[(log[locator[static_cast<size_t>(i)]] + inverseLog * (i - 1)) % 255];
+		}
+		if (locatorValue != 0)
+			continue;
+		for (int i = 0; i < eccLen; i++) {
+			if (evaluator[static_cast<size_t>(i)] != 0)
+				evaluatorValue ^= exp[(log[evaluator[static_cast<size_t>(i)]] + inverseLog * i) % 255];
+		}
+		if (derivativeValue == 0)
+			throw decode_error("Too many errors in a block");
+		// Value = X * evaluator(X^-1) / derivative(X^-1)
+		if (evaluatorValue != 0)
+			codeword[j] ^= exp[(power + log[evaluatorValue] + 255 - log[derivativeValue]) % 255];
+		found++;
+	}
+	if (found != errors)
+		throw decode_error("Too many errors in a block");
+	return errors;
+}
+
+
+vector<QrSegment> QrDecoder::parseSegments(const vector<uint8_t> &data, int version) {
+	size_t totalBits = data.size() * 8;
+	size_t pos = 0;
+	auto readBits = [&data, &pos](int len) {
+		uint32_t result = 0;
+		for (int i = 0; i < len; i++, pos++)
+			result = result << 1 | ((data[pos >> 3] >> (7 - (pos & 7))) & 1);
+		return result;
+	};
+	vector<QrSegment> result;
+	while (pos + 4 <= totalBits) {
+		int modeBits = static_cast<int>(readBits(4));
+		if (modeBits == 0)  // Terminator
+			break;
+		const QrSegment::Mode *mode;
+		switch (modeBits) {
+			case 0x1:  mode = &QrSegment::Mode::NUMERIC;       break;
+			case 0x2:  mode = &QrSegment::Mode::ALPHANUMERIC;  break;
+			case 0x4:  mode = &QrSegment::Mode::BYTE;          break;
+			case 0x8:  mode = &QrSegment::Mode::KANJI;         break;
+			case 0x7:  mode = &QrSegment::Mode::ECI;           break;
+			case 0x3:  mode = &QrSegment::Mode::STRUCTURED_APPEND;  break;
+			default:  throw decode_error("Unsupported segment mode");
+		}
+		
+		// The length of the data bits follows from the mode and the character count
+		int numChars = 0;
+		size_t dataBits;
+		if (mode == &QrSegment::Mode::ECI) {
+			if (pos + 8 > totalBits)
+				throw decode_error("Truncated segment");
+			size_t next = (pos >> 3) + 1;  // The first byte of the designator may straddle two codewords
+			int first = (data[pos >> 3] << (pos & 7) | ((pos & 7) != 0 && next < data.size() ? data[next] >> (8 - (pos & 7)) : 0)) & 0xFF;
+			dataBits = (first & 0x80) == 0 ? 8 : (first & 0xC0) == 0x80 ? 16 : 24;
+		} else if (mode == &QrSegment::Mode::STRUCTURED_APPEND) {
+			dataBits = 16;  // Position, count minus 1 and parity
+		} else {
+			int ccBits = mode->numCharCountBits(version);
+			if (pos + static_cast<size_t>(ccBits) > totalBits)
+				throw decode_error("Truncated segment");
+			numChars = static_cast<int>(readBits(ccBits));
+			size_t n = static_cast<size_t>(numChars);
+			if (mode == &QrSegment::Mode::NUMERIC)
+				dataBits = n / 3 * 10 + (n % 3 == 0 ? 0 : n % 3 * 3 + 1);
+			else if (mode == &QrSegment::Mode::ALPHANUMERIC)
+				dataBits = n / 2 * 11 + n % 2 * 6;
+			else if (mode == &QrSegment::Mode::BYTE)
+				dataBits = n * 8;
+			else
+				dataBits = n * 13;
+		}
+		if (pos + dataBits > totalBits)
+			throw decode_error("Truncated segment");
+		BitBuffer bb;
+		for (size_t left = dataBits; left > 0; ) {
+			int len = static_cast<int>(std::min(left, static_cast<size_t>(24)));
+			bb.appendBits(readBits(len), len);
+			left -= static_cast<size_t>(len);
+		}
+		result.push_back(QrSegment(*mode, numChars, std::move(bb)));
+	}
+	return result;
+}
+
+
+
+BitBuffer::BitBuffer() :
+	bitLength(0) {}
 
 
 void BitBuffer::appendBits(std::uint32_t val, int len) {
 	if (len < 0 || len > 31 || val >> len != 0)
 		throw std::domain_error("Value out of range");
-	for (int i = len - 1; i >= 0; i--)  // Append bit by bit
-		this->push_back(((val >> i) & 1) != 0);
+	// Gather the bits of the partial last byte and the new bits in an accumulator,
+	// then write out whole bytes
+	int used = static_cast<int>(bitLength % 8);
+	std::uint64_t accum = 0;
+	if (used != 0) {
+		accum = bytes.back() >> (8 - used);
+		bytes.pop_back();
+	}
+	accum = accum << len | val;
+	int pending = used + len;
+	for (; pending >= 8; pending -= 8)
+		bytes.push_back(static_cast<uint8_t>(accum >> (pending - 8)));
+	if (pending > 0)
+		bytes.push_back(static_cast<uint8_t>(accum << (8 - pending)));
+	bitLength += static_cast<size_t>(len);
+}
+
+
+void BitBuffer::appendData(const BitBuffer &other) {
+	size_t whole = other.bitLength / 8;
+	appendBytes(other.bytes.data(), whole);
+	int rest = static_cast<int>(other.bitLength % 8);
+	if (rest != 0)
+		appendBits(static_cast<std::uint32_t>(other.bytes[whole] >> (8 - rest)), rest);
 }
 
 
+void BitBuffer::appendBytes(const uint8_t *data, size_t count) {
+	int used = static_cast<int>(bitLength % 8);
+	if (used == 0)  // Byte aligned, a plain copy
+		bytes.insert(bytes.end(), data, data + count);
+	else {  // Each byte straddles the partial last byte and a new one
+		for (size_t i = 0; i < count; i++) {
+			bytes.back() |= static_cast<uint8_t>(data[i] >> used);
+			bytes.push_back(static_cast<uint8_t>(data[i] << (8 - used)));
+		}
+	}
+	bitLength += count * 8;
+}
+
 
+size_t BitBuffer::size() const {
+	return bitLength;
 }
+
+
+bool BitBuffer::at(size_t index) const {
+	if (index >= bitLength)
+		throw std::out_of_range("Bit index out of range");
+	return ((bytes[index >> 3] >> (7 - (index & 7))) & 1) != 0;
+}
+
+
+const vector<uint8_t> &BitBuffer::getBytes() const {
+	return bytes;
+}
+
+
+void BitBuffer::clear() {
+	bytes.clear();
+	bitLength = 0;
+}
+
+
+
+}
\ No newline at end of file
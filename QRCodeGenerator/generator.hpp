@@ -1,13 +1,82 @@
 #include <vector>
 #include <array>
+#include <chrono>
+#include <cstddef>
 #include <string>
 #include <cstdint>
+#include <list>
+#include <mutex>
 #include <stdexcept>
+#include <unordered_map>
+#include <utility>
 
 
 
 namespace qrcodegen {
 
+/*
+ * An appendable sequence of bits (0s and 1s). Mainly used by QrSegment.
+ * The bits are packed into bytes in big endian as they are appended, the
+ * first bit being the most significant bit of the first byte. Unused bits
+ * of the last byte are always 0.
+*/
+class BitBuffer final {
+    /* ---- Constructor ---- */
+    
+    /*
+     * Creates an empty bits buffer (length 0)
+    */
+    public: BitBuffer();
+
+    /* ---- Methods ---- */
+
+    /*
+     * Appends the given number of low-order bits of the given value
+     * to this buffer. Requires 0 <= len <= 31 and val <= 2 ^ len
+    */
+    public: void appendBits(std::uint32_t val, int len);
+
+    /*
+     * Appends all bits of the given buffer to this buffer
+    */
+    public: void appendData(const BitBuffer &other);
+
+    /*
+     * Appends the given bytes, 8 bits each, to this buffer
+    */
+    public: void appendBytes(const std::uint8_t *data, std::size_t count);
+
+    /*
+     * Returns the number of bits in this buffer
+    */
+    public: std::size_t size() const;
+
+    /*
+     * Returns the bit at the given index, which must be less than size()
+    */
+    public: bool at(std::size_t index) const;
+
+    /*
+     * Returns the packed bytes, (size() + 7) / 8 of them
+    */
+    public: const std::vector<std::uint8_t> &getBytes() const;
+
+    /*
+     * Removes all bits, keeping the memory for reuse
+    */
+    public: void clear();
+
+    /* ---- Fields ---- */
+
+    // The packed bits
+    private: std::vector<std::uint8_t> bytes;
+
+    // The number of bits
+    private: std::size_t bitLength;
+    
+};
+
+
 /*
  * A segment of character/binary/control data in a QR Code symbol.
  * Instances of this class are immutable.
@@ -24,6 +93,10 @@ namespace qrcodegen {
 */
 
 class QrSegment final {
+
+    // Reads the alphanumeric character set in the allocation-free encode
+    friend class QrCode;
+
 /*
  * Public helper enumeration
  * 
@@ -37,6 +110,7 @@ class QrSegment final {
         public: static const Mode BYTE;
         public: static const Mode KANJI;
         public: static const Mode ECI;
+        public: static const Mode STRUCTURED_APPEND;
 
         /* ---- Fields ---- */ 
 
@@ -90,19 +164,45 @@ class QrSegment final {
     */
     public: static QrSegment makeAlphanumeric(const char* text);
 
+    /*
+     * Returns a segment representing the given text string encoded in kanji
+     * mode, 13 bits per character. Every character must be in the Shift JIS
+     * double-byte range used by QR Codes (JIS X 0208 kanji, kana, symbols, and
+     * full-width Latin, Greek and Cyrillic letters)
+    */
+    public: static QrSegment makeKanji(const char* text);
+
     /*
      * Returns a list of zero or more segments to represent the given 
      * text string. The result may use various segment modes and switch
-     * modes to optimize the length of the bit stream
+     * modes to optimize the length of the bit stream. The lengths are
+     * those of the smallest versions (1 to 9), see makeSegmentsOptimally()
     */
     public: static std::vector<QrSegment> makeSegments(const char *text);
 
+    /*
+     * Returns a list of zero or more segments to represent the given UTF-8 text
+     * string with the fewest bits at the given version, switching between numeric,
+     * alphanumeric, byte and kanji modes wherever the saving outweighs the cost
+     * of a new segment header. Only the version's range (1 to 9, 10 to 26 or 27
+     * to 40) matters, as it sets the width of the character count fields. Bytes
+     * which are not valid UTF-8 are encoded in byte mode unchanged
+    */
+    public: static std::vector<QrSegment> makeSegmentsOptimally(const char *text, int version);
+
     /*
      * Returns a segment representing an Extended Channel Interpretation
      * (ECI) designator with the given assignment value
     */
     public: static QrSegment makeEci(long assignVal);
 
+    /*
+     * Returns a Structured Append header segment, which must be the first segment of
+     * the symbol: the symbol's 0-based position in the sequence, the number of symbols
+     * (1 to 16), and the parity byte (the XOR of every byte of the whole payload)
+    */
+    public: static QrSegment makeStructuredAppend(int index, int total, int parity);
+
 
     /* ---- Public static helper functions ---- */
 
@@ -140,9 +240,9 @@ class QrSegment final {
     private: int numChars;
 
     /*
-     * The data bits of this segment. Accessed through getData().
+     * The data bits of this segment, packed into bytes. Accessed through getData().
     */
-    private: std::vector<bool> data;
+    private: BitBuffer data;
 
 
     /* ---- Constructors (low level) ---- */
@@ -153,7 +253,7 @@ class QrSegment final {
      * buffer length, but the constraint isn't checked. The given bit buffer
      * is copied and stroed.
     */
-    public: QrSegment(Mode md, int numCh, const std::vector<bool> &dt);
+    public: QrSegment(Mode md, int numCh, const BitBuffer &dt);
 
     /*
      * Create a new QR Code segment with the given attributes and data.
@@ -161,7 +261,7 @@ class QrSegment final {
      * buffer length, but the constraint isn't checked. The given bit buffer
      * is copied and stroed.
     */
-    public: QrSegment(Mode md, int numCh, std::vector<bool> &&dt);
+    public: QrSegment(Mode md, int numCh, BitBuffer &&dt);
 
     
     /* ---- Method ---- */
@@ -179,7 +279,7 @@ class QrSegment final {
     /*
      * Returns the data bits of this segment.
     */
-    public: const std::vector<bool> &getData() const;
+    public: const BitBuffer &getData() const;
 
     /*
      * (Package Private)
@@ -200,6 +300,19 @@ class QrSegment final {
      * string. 
     */
     private: static const char* ALPHANUMERIC_CHARSET;
+
+    /*
+     * Returns the kanji mode value (13 bits) of each Unicode code point below
+     * 0x10000, or -1 if it has none. Decoded from KANJI_TO_UNICODE once per
+     * process, thread-safely
+    */
+    private: static const std::vector<std::int16_t> &getUnicodeToKanji();
+
+    /*
+     * The Unicode code point of each kanji mode value, as big endian 16-bit
+     * values in base 64, 0xFFFF for unused values. Taken from Shift JIS
+    */
+    private: static const char* KANJI_TO_UNICODE;
 };
 
 
@@ -224,6 +337,12 @@ class QrSegment final {
 */
 class QrCode final {
 
+    // Reads the grids, tables and layouts of this class
+    friend class QrDecoder;
+
+    // Draws with the function pattern, codeword, masking and Reed-Solomon helpers of this class
+    friend class MicroQrCode;
+
 
     /* ---- Public helper enumeration ---- */
 
@@ -242,18 +361,73 @@ class QrCode final {
     */
     private: static int getFormatBits(Ecc ecl);
 
+    /*
+     * What an encode chose and where its time went, filled in by encodeText() and
+     * encodeSegments() when given one. Measuring costs a few clock reads per stage
+    */
+    public: struct EncodeStats final {
+        int version;                // Version chosen
+        Ecc errorCorrectionLevel;   // Error correction level, after boosting
+        int mask;                   // Mask applied
+        long maskPenalties[8];      // Penalty score of each mask, -1 for the masks not scored
+        long segmentNs;             // Splitting the text into segments (encodeText() only),
+                                    // choosing the version and building the data codewords
+        long eccNs;                 // Computing and interleaving the error correction codewords
+        long drawNs;                // Drawing the function patterns and the codewords
+        long maskNs;                // Applying the masks and drawing their format bits
+        long penaltyNs;             // Scoring the masks. When parallelMask scores them on the
+                                    // worker threads, the wall time of applying and scoring all masks
+    };
+
+
+    /*
+     * The modules of one version which do not depend on the data: the function patterns
+     * (with dummy format bits) and their marks, and the position of every codeword bit in
+     * the zigzag scan, as the bit index y * rowWords * 64 + x into the module grid.
+     * See getVersionLayout()
+    */
+    private: struct VersionLayout final {
+        std::vector<std::uint64_t> modules;     // Function patterns, the data modules white
+        std::vector<std::uint64_t> isFunction;  // Function modules and the bits past each row end
+        std::vector<std::uint16_t> order;       // Position of codeword bit i, remainder bits excluded
+    };
+
+    /*
+     * Returns the layout of the given version. All layouts are built once per process
+     * on first use, thread-safely, and shared by every encode and decode afterwards.
+    */
+    private: static const VersionLayout &getVersionLayout(int ver);
+
+    /*
+     * Buffers reused by the encodes of one thread: the bit string, the codewords
+     * and the function module grid. Defined in generator.cpp
+    */
+    private: struct EncodeScratch;
+
+    /*
+     * The threads scoring the masks of the encodes with parallelMask, started on first
+     * use and kept for the life of the process. Defined in generator.cpp
+    */
+    private: class MaskPool;
+
 
     /* ---- Static factory functions (high level) ---- */
 
     /*
      * Returns a QR Code representing the given Unicode text string at the given error correction level.
+     * The text is split into segments of the modes taking the fewest bits for the chosen version.
      * As a conservation upper bound, this function is guaranteed to succeed for strings 
      * that have 2953 or fewer UTF-8 code units (not Unicode code points) if the 
      * low error correctino level is used. The smallest possible QR Code version is automatically 
      * chosen for the output. The ECC level of the result may be higher than the ECL argument if
      * it can be done without increasing the version.
     */
-    public: static QrCode encodeText(const char* text, Ecc ecl);
+    public: static QrCode encodeText(const char* text, Ecc ecl, EncodeStats *stats = nullptr);
+
+    /*
+     * encodeText() working in the given scratch buffers, adding to stats if not null
+    */
+    private: static QrCode encodeText(const char* text, Ecc ecl, EncodeStats *stats, EncodeScratch &scratch);
 
     /*
      * Returns a QR Code representing the given binary data at the given error correction level.
@@ -264,6 +438,60 @@ class QrCode final {
     */
     public: static QrCode encodeBinary(const std::vector<std::uint8_t> &data, Ecc ecl);
 
+    /*
+     * Encodes the given text into the caller's buffers without allocating any memory,
+     * for a fixed memory budget and a predictable latency. The text is encoded in one
+     * segment of the most compact of the numeric, alphanumeric and byte modes it allows,
+     * at the smallest version in the range, the other parameters as in encodeSegments().
+     * tempBuffer must hold TEMP_BUFFER_LEN_MAX bytes and qrcodeOut BUFFER_LEN_MAX bytes.
+     * qrcodeOut receives the size in byte 0, then module (x, y) in bit i % 8 (from the
+     * lowest) of byte 1 + i / 8 where i = y * size + x, see getSize() and getModule().
+     * Returns false, with byte 0 set to 0, if the text does not fit any version in range.
+    */
+    public: static bool encodeText(const char *text, Ecc ecl, std::uint8_t *tempBuffer, std::uint8_t *qrcodeOut,
+                                   int minVersion = MIN_VERSION, int maxVersion = MAX_VERSION, int mask = -1, bool boostEcl = true);
+
+    /*
+     * Returns the size of a QR Code written by the allocation-free encodeText(), or 0
+    */
+    public: static int getSize(const std::uint8_t *qrcode);
+
+    /*
+     * Returns the color of the module (x, y) of a QR Code written by the allocation-free
+     * encodeText(): false for white or out of bounds, true for black
+    */
+    public: static bool getModule(const std::uint8_t *qrcode, int x, int y);
+
+
+    /*
+     * Returns the QR Codes representing the given Unicode text strings at the given error
+     * correction level, in the same order, each as returned by encodeText(). The texts
+     * are split into one contiguous chunk per worker thread, and each worker reuses one
+     * set of scratch buffers for all its codes. The number of threads is the hardware
+     * concurrency if threads is 0. If any text does not fit, the exception is rethrown.
+    */
+    public: static std::vector<QrCode> encodeBatch(const std::vector<std::string> &texts, Ecc ecl, int threads = 0);
+
+    /*
+     * Returns the QR Codes representing the given Unicode text string split across up to
+     * 16 symbols with Structured Append, in sequence order. Every symbol but the last is
+     * filled at maxVersion, the text being cut between UTF-8 characters and each part
+     * encoded in its optimal segments after the Structured Append header. The parity is
+     * the XOR of all bytes of the text. A text fitting in one symbol of at most maxVersion
+     * gives one ordinary QR Code. The symbols are encoded in parallel as by encodeBatch().
+     * Throws data_too_long if 16 symbols of maxVersion do not hold the text.
+    */
+    public: static std::vector<QrCode> encodeStructuredAppend(const char *text, Ecc ecl,
+                                                              int maxVersion = MAX_VERSION, int threads = 0);
+
+    /*
+     * Returns count QR Codes, code i made by encode(i, scratch), in one contiguous chunk
+     * per worker thread (the hardware concurrency if threads is 0), each worker with its
+     * own scratch buffers. The first exception of a worker is rethrown
+    */
+    private: template <typename Encode>
+             static std::vector<QrCode> encodeParallel(std::size_t count, int threads, Encode encode);
+
 
     /* ---- Static factory functions (mid level) ---- */
 
@@ -276,11 +504,23 @@ class QrCode final {
 	 * mask, or -1 to automatically choose an appropriate mask (which may be slow).
 	 * This function allows the user to create a custom sequence of segments that switches
 	 * between modes (such as alphanumeric and byte) to encode text in less space.
+	 * Iff parallelMask is true, the automatic mask choice of a large version scores
+	 * the 8 masks on a pool of worker threads, which lowers its latency. Small versions
+	 * and single-core machines score them sequentially as without the option.
+	 * Iff stats is not null, it receives the choices and the time of every stage.
 	 * This is a mid-level API; the high-level API is encodeText() and encodeBinary().
 	*/
     public: static QrCode encodeSegments(const std::vector<QrSegment> &segs, Ecc ecl, 
                                          int minVersion = 1, int maxVersion = 40, int mask = -1,
-                                         bool boostEcl = true);         // All optional parameters
+                                         bool boostEcl = true, bool parallelMask = false,
+                                         EncodeStats *stats = nullptr);         // All optional parameters
+
+
+    /*
+     * encodeSegments() working in the given scratch buffers, adding to stats if not null
+    */
+    private: static QrCode encodeSegments(const std::vector<QrSegment> &segs, Ecc ecl, int minVersion, int maxVersion,
+                                          int mask, bool boostEcl, bool parallelMask, EncodeStats *stats, EncodeScratch &scratch);
     
 
     /* ---- Instance fields ---- */
@@ -312,19 +552,27 @@ class QrCode final {
     */
     private: int mask;
 
-    // Private grids of modules/pixels, with dimensions of size * size
+    // Private grids of modules/pixels, with dimensions of size * size.
+    // Each grid is one contiguous array of bit-packed rows: row y starts at
+    // word y * rowWords, and module x is bit (x % 64) of word x / 64 in the row.
+    // Bits past the end of a row are always 0 in modules
+
+    /*
+     * The number of 64-bit words in each row of the grids, between 1 and 3
+    */
+    private: int rowWords;
 
     /*
-     * The modules of this QR Code (false = white, true = black)
+     * The modules of this QR Code (0 = white, 1 = black)
      * Immutable after constructor finishes. Accessed through getModule()
     */
-    private: std::vector<std::vector<bool>> modules;
+    private: std::vector<std::uint64_t> modules;
 
     /*
-     * Indicates function modules that are not subjected to masking. 
-     * Discarded when constructor finished
+     * Indicates function modules that are not subjected to masking,
+     * and the bits past the end of each row. Discarded when constructor finished
     */
-    private: std::vector<std::vector<bool>> isFunction;
+    private: std::vector<std::uint64_t> isFunction;
 
 
     /* ---- Constructure (low level) ---- */
@@ -332,11 +580,36 @@ class QrCode final {
     /*
      * Creates a new QR Code with the given version number, error
      * correction level, data codeword bytes, and mask number.
+     * If the mask is -1 and parallelMask is true, the 8 masks of a large
+     * version are scored on the shared mask scoring threads.
      * This is a low-level API that most users shoule not use 
      * directly. 
      * A mid-level API is the encodeSegment() function.
     */
-    public: QrCode(int ver, Ecc ecl, const std::vector<std::uint8_t> &dataCodeWords, int msk);
+    public: QrCode(int ver, Ecc ecl, const std::vector<std::uint8_t> &dataCodeWords, int msk, bool parallelMask = false);
+
+    /*
+     * Creates a new QR Code as the constructor above, working in the given scratch buffers
+    */
+    private: QrCode(int ver, Ecc ecl, const std::vector<std::uint8_t> &dataCodeWords, int msk, bool parallelMask,
+                    EncodeStats *stats, EncodeScratch &scratch);
+
+    /*
+     * Creates a QR Code of the given version with only the function patterns drawn,
+     * and keeps isFunction. Used to build the version layouts, see getVersionLayout()
+    */
+    private: explicit QrCode(int ver);
+
+    /*
+     * Draws and masks the modules, the body of the constructors, adding to stats if not null
+    */
+    private: void build(const std::vector<std::uint8_t> &dataCodewords, int msk, bool parallelMask,
+                        EncodeStats *stats, EncodeScratch &scratch);
+
+    /*
+     * Returns the nanoseconds since lap, and moves lap to now. Times the stages for EncodeStats
+    */
+    private: static long getLapNs(std::chrono::steady_clock::time_point &lap);
 
 
     /* ---- Public instance methods ---- */
@@ -376,43 +649,113 @@ class QrCode final {
     */
     public: std::string toSvgString(int border) const;
 
+    // Renderers writing into a caller-supplied buffer. Each one returns the length of
+    // the whole image, and writes the first min(length, capacity) bytes of it, so a
+    // call with capacity 0 measures the buffer needed. Nothing is allocated, and the
+    // output is not terminated by '\0'
+
+    /*
+     * Writes SVG code for an image depicting this QR Code with the given number of
+     * border modules. Each horizontal run of black modules is one path segment.
+    */
+    public: std::size_t toSvg(char *buffer, std::size_t capacity, int border) const;
+
+    /*
+     * Writes a PNG image, 1-bit grayscale and stored uncompressed, with each module
+     * scale * scale pixels wide and the given number of border modules.
+    */
+    public: std::size_t toPng(std::uint8_t *buffer, std::size_t capacity, int scale, int border) const;
+
+    /*
+     * Writes a binary PBM (P4) image, with each module scale * scale pixels wide
+     * and the given number of border modules.
+    */
+    public: std::size_t toPbm(std::uint8_t *buffer, std::size_t capacity, int scale, int border) const;
+
+    /*
+     * Writes a binary PGM (P5) image, 8 bits per pixel, with each module
+     * scale * scale pixels wide and the given number of border modules.
+    */
+    public: std::size_t toPgm(std::uint8_t *buffer, std::size_t capacity, int scale, int border) const;
+
+
+    /* ---- Private helper methods for the renderers ---- */
+
+    /*
+     * Bounded output of the renderers, counting the bytes of the whole image
+     * and keeping those within the capacity. Defined in generator.cpp
+    */
+    private: struct RenderBuffer;
+
+    /*
+     * Checks the scale and border of a raster image, and returns its width
+     * and height in pixels
+    */
+    private: int getImageWidth(int scale, int border) const;
+
+    /*
+     * Sets pixels to one row of the image for module row y, which may be in the
+     * border, 1 bit per pixel in big endian with 1 = black, padded to whole bytes
+    */
+    private: void getPixelRow(int y, int scale, int border, std::vector<std::uint8_t> &pixels) const;
+
 
     /* ---- Private helper methods for constructor: Drawing function modules ---- */
 
     /*
-     * Reads this object's version field, and draws and marks all function modules
+     * The module grids being drawn, packed as the fields modules and isFunction, in
+     * the memory of a QrCode or in the caller's buffer of the allocation-free
+     * encodeText(). Does not own the memory
+    */
+    private: struct Grid final {
+        std::uint64_t *modules;
+        std::uint64_t *isFunction;
+        int version;
+        int size;
+        int rowWords;
+        Ecc errorCorrectionLevel;
+    };
+
+    /*
+     * Returns the grid of this object's fields
     */
-    private: void drawFunctionPatterns();
+    private: Grid getGrid();
+
+    /*
+     * Reads the grid's version, and draws and marks all function modules, and marks
+     * the bits past the end of each row. The grid must be all 0 before
+    */
+    private: static void drawFunctionPatterns(const Grid &grid);
 
     /*
      * Draws two copies of the format bits (with its own error correction code)
-     * based on the given mask and this object's error correction level field.
+     * based on the given mask and the grid's error correction level.
     */
-    private: void drawFormatBits(int msk);
+    private: static void drawFormatBits(const Grid &grid, int msk);
 
     /*
      * Draws two copies of the version bits (with its own error correction code)
-     * based on this object's version field, if 7 <= version <= 40 
+     * based on the grid's version, if 7 <= version <= 40 
     */
-    private: void drawVersion();
+    private: static void drawVersion(const Grid &grid);
 
     /*
      * Draws a 9 * 9 finder pattern including the border separator, 
      * with the center module at (x, y). Modules can be out of bounds.
     */
-    private: void drawFinderPattern(int x, int y);
+    private: static void drawFinderPattern(const Grid &grid, int x, int y);
 
     /*
      * Draws a 5 * 5 alignment pattern, with the center module at (x, y).
      * All modules must be in bounds.
     */
-    private: void drawAlignmentPattern(int x, int y);
+    private: static void drawAlignmentPattern(const Grid &grid, int x, int y);
 
     /*
      * Sets the color of a module and marks it as a function module.
      * Only used by the constructor. Coordinates must by in bound.
     */
-    private: void setFunctionModule(int x, int y, bool isBlack);
+    private: static void setFunctionModule(const Grid &grid, int x, int y, bool isBlack);
 
     /*
      * Returns the color of the module at the given coordinates, 
@@ -424,45 +767,91 @@ class QrCode final {
     /* ---- Private helper methods for constructor: Codewords and masking ---- */
 
     /*
-     * Returns a new byte string representing the given data with the 
+     * Writes to result a byte string representing the given data with the 
      * appropiate error correction codewords appended to it, based on
      * this object's version and error correction level
     */
-    private: std::vector<std::uint8_t> addEccAndInterleave(const std::vector<std::uint8_t> &data) const;
+    private: void addEccAndInterleave(const std::vector<std::uint8_t> &data, std::vector<std::uint8_t> &result) const;
+
+    /*
+     * addEccAndInterleave() for the given version and error correction level, from
+     * the data codewords to all getNumRawDataModules(ver) / 8 codewords in result
+    */
+    private: static void addEccAndInterleave(int ver, Ecc ecl, const std::uint8_t *data, std::uint8_t *result);
 
     /*
      * Draws the given sequence of 8-bit codewords (data and error correction)
-     * onto the entire data area of this QR Code. Function modules need to be
-     * marked off before this is called.
+     * onto the entire data area of this QR Code, in the order of the version
+     * layout. The data modules need to be white before this is called.
     */
     private: void drawCodewords(const std::vector<std::uint8_t> &data);
 
     /*
-     * XORs the codewords modules in this QR Code with the given mask pattern.
+     * Draws the given codewords onto the data area of the grid as drawCodewords(),
+     * finding the data modules by the zigzag scan and the function module marks
+    */
+    private: static void drawCodewords(const Grid &grid, const std::uint8_t *data, std::size_t len);
+
+    /*
+     * Calls visit(x, y) for every module of a grid of the given size in the order of
+     * the zigzag scan, function modules included, skipping the vertical timing pattern
+     * at the given column (6 in a QR Code, 0 in a Micro QR Code)
+    */
+    private: template <typename Visit> static void walkZigzag(int size, int timingColumn, Visit visit);
+
+    /*
+     * XORs the codewords modules in the grid with the given mask pattern.
      * The function modules must be masked and the codeword bits must be drawn
      * before masking. Due to the arithmetic of XOR, calling applyMask() with 
      * the same mask value a second time will undo the mask. A final well-formed
      * QR Code needs exactly one (not zero, two, etc) mask applied. 
     */
-    private: void applyMask(int msk);
+    private: static void applyMask(const Grid &grid, int msk);
 
     /*
-     * Calculate and returns the penalty score based on state of this QR Code's
+     * Calculate and returns the penalty score based on state of the grid's
      * current modules. This is used by the automatic mask choice algorithm
-     * to find the mask pattern that fields are lowest score.
+     * to find the mask pattern that fields are lowest score. The columns are
+     * transposed into the given buffer of size * rowWords words.
     */
-    private: long getPenaltyScore() const;
+    private: static long getPenaltyScore(const Grid &grid, std::uint64_t *columns);
+
+    /*
+     * Returns the penalty score of the grid with the given mask and its format bits
+     * drawn, computed on a copy of the grid in the buffer of 2 * size * rowWords words
+     * so that the grid is only read. The columns buffer holds size * rowWords words.
+     * Used to score the masks in parallel on one shared grid.
+    */
+    private: static long getMaskPenaltyScore(const Grid &grid, int msk, std::uint64_t *buffer, std::uint64_t *columns);
+
+    /*
+     * Returns the run length and finder-like penalties of one line (row or column)
+     * of bit-packed modules, walking it run by run instead of module by module.
+     * A helper function for getPenaltyScore()
+    */
+    private: static long getLinePenaltyScore(const std::uint64_t *line, int size, int rowWords);
+
+    /*
+     * Returns the 3 words of the given mask's pattern for row y, with bit x set
+     * where the mask inverts module x. Built once, the patterns repeat every 12 rows
+    */
+    private: static const std::uint64_t* getMaskPattern(int msk, int y);
+
+    /*
+     * Transposes a 64 * 64 matrix of bits, where bit j of word i is row i,
+     * column j. A helper function for getPenaltyScore()
+    */
+    private: static void transposeBlock(std::array<std::uint64_t, 64> &block);
 
 
     /* ---- Private helper functions ---- */
 
     /*
-     * Returns an ascending list of positions of alignment patterns for this version 
-     * number. Each position is in the range [0, 177), and are used on both x and y 
-     * axes. This could be implemented as lookup table of 40 variable-length lists
-     * of unsigned bytes.
+     * Writes the ascending list of positions of alignment patterns for the given
+     * version number to result, and returns their number (0 or 2 to 7). Each position
+     * is in the range [0, 177), and are used on both x and y axes.
     */
-    private: std::vector<int> getAlignmentPatternPositions() const;
+    private: static int getAlignmentPatternPositions(int ver, std::array<int, 7> &result);
 
     /*
      * Returns the number of data bits that can be stored in a QR Code of the given 
@@ -481,21 +870,41 @@ class QrCode final {
     private: static int getNumDataCodewords(int ver, Ecc ecl);
 
     /*
-     * Returns a Reed-Solomon ECC generator polynomial for the given degree. This could
-     * be implemented as a lookup table over all possible parameter values, instead of as 
-     * an algorithm
+     * The error correction block structure of one version and error correction level,
+     * with its ready-to-use generator polynomial. See getBlockLayout()
+    */
+    private: struct BlockLayout final {
+        int numBlocks;              // Number of error correction blocks
+        int blockEccLen;            // Error correction codewords in each block
+        int numShortBlocks;         // Blocks with one data codeword less than the others
+        int shortBlockLen;          // Data and error correction codewords in a short block
+        const std::uint8_t *divisor;  // Generator polynomial of degree blockEccLen
+    };
+
+    /*
+     * Returns the block layout of the given version and error correction level. All
+     * layouts and divisors are built once per process on first use, thread-safely, in
+     * static storage (not on the heap), and shared by every encode afterwards.
     */
-    private: static std::vector<std::uint8_t> reedSolomonComputeDivisor(int degree);
+    private: static const BlockLayout &getBlockLayout(int ver, Ecc ecl);
 
     /*
-     * Returns the Reed-Solomon error correction codeword for the given data and divisor
-     * polynomial.
+     * Writes the Reed-Solomon ECC generator polynomial of the given degree to result,
+     * which must hold degree bytes. This could be implemented as a lookup table over all
+     * possible parameter values, instead of as an algorithm
     */
-    private: static std::vector<std::uint8_t> reedSolomonComputeRemainder(const std::vector<std::uint8_t> &data, const std::vector<std::uint8_t> &divisor);
+    private: static void reedSolomonComputeDivisor(int degree, std::uint8_t *result);
+
+    /*
+     * Writes the Reed-Solomon error correction codewords for the given data and divisor
+     * polynomial to result, which must hold degree bytes. Allocates no memory.
+    */
+    private: static void reedSolomonComputeRemainder(const std::uint8_t *data, std::size_t len,
+                                                     const std::uint8_t *divisor, std::size_t degree, std::uint8_t *result);
 
     /*
      * Returns the product of the two given field elements module GF(2^8 / 0x11D)
-     * All input are valid. This could be implement as a 256 * 256 lookup table.
+     * All input are valid. Implemented with the log/antilog tables GF_LOG and GF_EXP.
     */
     private: static std::uint8_t reedSolomonMultiply(std::uint8_t x, std::uint8_t y);
 
@@ -503,25 +912,35 @@ class QrCode final {
      * Can only be called immediately after a white run is added, and returns
      * either 0, 1, or 2. A helper function for getPenaltyScore()
     */
-    private: int finderPenaltyCountPatterns(const std::array<int, 7> &runHistory) const;
+    private: static int finderPenaltyCountPatterns(const std::array<int, 7> &runHistory, int size);
 
     /*
      * Must be called at the end of a line (row or column) of modules. 
      * A helper function for getPenaltyScore()
     */
-    private: int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, std::array<int, 7> &runHistory) const;
+    private: static int finderPenaltyTerminateAndCount(bool currentRunColor, int currentRunLength, std::array<int, 7> &runHistory, int size);
 
     /*
      * Pushes the given value to the front and drops the last value. 
      * A helper function for getPenaltyScore()
     */
-    private: void finderPenaltyAddHistory(int currentRunLength, std::array<int, 7> &runHistory) const;
+    private: static void finderPenaltyAddHistory(int currentRunLength, std::array<int, 7> &runHistory, int size);
 
     /*
      * Returns true if the i'th bit of x is set to 1
     */
     private: static bool getBit(long x, int i);
 
+    /*
+     * Returns the number of bits set to 1 in x
+    */
+    private: static int popCount(std::uint64_t x);
+
+    /*
+     * Returns the index of the lowest bit set to 1 in x, which must not be 0
+    */
+    private: static int countTrailingZeros(std::uint64_t x);
+
 
     /* ---- Constants and Tables ---- */
 
@@ -535,6 +954,23 @@ class QrCode final {
     */
     public: static constexpr int MAX_VERSION = 40;
 
+    /*
+     * The number of codewords of version 40, getNumRawDataModules(MAX_VERSION) / 8 by
+     * the same formula, which getBlockLayout() checks. Sizes TEMP_BUFFER_LEN_MAX
+    */
+    private: static constexpr int MAX_CODEWORDS = ((16 * MAX_VERSION + 128) * MAX_VERSION + 64
+        - ((25 * (MAX_VERSION / 7 + 2) - 10) * (MAX_VERSION / 7 + 2) - 55) - 36) / 8;
+
+    /*
+     * The bytes of the buffers of the allocation-free encodeText(): the size and modules
+     * of the largest QR Code, and the temporary 64-bit word grids (modules, function
+     * module marks and the columns for scoring, with 8 bytes to align them) and
+     * codewords (the data and all codewords of version 40)
+    */
+    public: static constexpr std::size_t BUFFER_LEN_MAX = 1 + ((MAX_VERSION * 4 + 17) * (MAX_VERSION * 4 + 17) + 7) / 8;
+    public: static constexpr std::size_t TEMP_BUFFER_LEN_MAX =
+        8 + 3 * (MAX_VERSION * 4 + 17) * ((MAX_VERSION * 4 + 17 + 63) / 64) * 8 + 2 * MAX_CODEWORDS;
+
     /*
      * For use in getPenaltyScore(), when evaluating which mask is best
     */
@@ -546,6 +982,13 @@ class QrCode final {
     private: static const std::int8_t ECC_CODEWORDS_PER_BLOCK[4][41];
     private: static const std::int8_t NUM_ERROR_CORRECTION_BLOCKS[4][41];
 
+    /*
+     * Antilogarithm and logarithm tables of GF(2^8 / 0x11D) with generator 0x02,
+     * for reedSolomonMultiply() and reedSolomonComputeRemainder()
+    */
+    private: static const std::uint8_t GF_EXP[510];
+    private: static const std::uint8_t GF_LOG[256];
+
 };
 
 
@@ -567,24 +1010,334 @@ class data_too_long : public std::length_error {
 };
 
 /*
- * An appendable sequence of bits (0s and 1s). Mainly used by QrSegment
+ * A Micro QR Code symbol, the small variant of the QR Code described in the
+ * ISO/IEC 18004 standard, with a single finder pattern and versions M1 to M4
+ * (11 * 11 to 17 * 17 modules). It holds up to 35 digits, 21 alphanumeric
+ * characters or 15 bytes, and suits short identifiers on small parts.
+ * Instances of this class represent an immutable square grid of black and
+ * white cells, built from the same segments, Reed-Solomon code and mask
+ * patterns as a QrCode, with the capacities, segment headers, format bits
+ * and mask evaluation of Micro QR Code.
+ * 
+ * Only the LOW, MEDIUM and QUARTILE error correction levels exist, and not at
+ * every version: M1 only detects errors (taken as LOW), M2 and M3 have LOW and
+ * MEDIUM, and M4 has all three. ECI and Structured Append are not supported.
+*/
+class MicroQrCode final {
+
+    /* ---- Static factory functions ---- */
+
+    /*
+     * Returns a Micro QR Code representing the given Unicode text string at the given
+     * error correction level, at the smallest version it fits in. The ECC level of the
+     * result may be higher than the ecl argument if it can be done without increasing
+     * the version. Throws data_too_long if the text does not fit in M4.
+    */
+    public: static MicroQrCode encodeText(const char *text, QrCode::Ecc ecl);
+
+    /*
+     * Returns a Micro QR Code representing the given segments with the given encoding
+     * parameters, as QrCode::encodeSegments(). The smallest possible version within the
+     * given range (1 to 4, for M1 to M4) is chosen, and the mask is chosen automatically
+     * if it is -1, or else taken from 0 to 3. Numeric segments can be used at every
+     * version, alphanumeric from M2, and byte and kanji from M3.
+    */
+    public: static MicroQrCode encodeSegments(const std::vector<QrSegment> &segs, QrCode::Ecc ecl,
+                                              int minVersion = 1, int maxVersion = 4, int mask = -1,
+                                              bool boostEcl = true);   // All optional parameters
+
+
+    /* ---- Constructor (low level) ---- */
+
+    /*
+     * Creates a new Micro QR Code with the given version number (1 to 4), error correction
+     * level, data codeword bytes and mask number (-1 for automatic, or 0 to 3). The data
+     * codewords include the segment headers and final padding, packed in big endian; in
+     * M1 and M3 the last data codeword is 4 bits long, held in the high nibble of the
+     * last byte.
+    */
+    public: MicroQrCode(int ver, QrCode::Ecc ecl, const std::vector<std::uint8_t> &dataCodewords, int msk);
+
+
+    /* ---- Public instance methods ---- */
+
+    /*
+     * Returns this Micro QR Code's version, in the range [1, 4] for M1 to M4
+    */
+    public: int getVersion() const;
+
+    /*
+     * Returns this Micro QR Code's size, in the range [11, 17]
+    */
+    public: int getSize() const;
+
+    /*
+     * Returns this Micro QR Code's error correction level
+    */
+    public: QrCode::Ecc getErrorCorrectionLevel() const;
+
+    /*
+     * Returns this Micro QR Code's mask, in the range [0, 3]
+    */
+    public: int getMask() const;
+
+    /*
+     * Returns the color of the module at the given coordinates, false for white or true
+     * for black, and false (white) if the coordinates are out of bounds
+    */
+    public: bool getModule(int x, int y) const;
+
+    /*
+     * Returns a string of SVG code for an image depicting this Micro QR Code, with the
+     * given number of border modules (the standard asks for at least 2), in the same
+     * form as QrCode::toSvgString()
+    */
+    public: std::string toSvgString(int border) const;
+
+
+    /* ---- Private helper functions ---- */
+
+    /*
+     * Returns the symbol number of the given version and error correction level, in the
+     * range [0, 7], which indexes the tables below and is drawn in the format bits,
+     * or -1 if the version has no such level
+    */
+    private: static int getSymbolNumber(int ver, QrCode::Ecc ecl);
+
+    /*
+     * Returns the number of bits needed to encode the given segments at the given
+     * version, or -1 if a segment's mode is not available at the version or it has
+     * too many characters for its length field
+    */
+    private: static int getTotalBits(const std::vector<QrSegment> &segs, int ver);
+
+    /*
+     * Returns the width of the character count field of the mode at the given version,
+     * or -1 if the mode is not available at the version
+    */
+    private: static int getNumCharCountBits(const QrSegment::Mode &mode, int ver);
+
+    /*
+     * Returns the function modules and the zigzag order of the data modules of the
+     * given version, as for QrCode. Built once per process on first use, thread-safely
+    */
+    private: static const QrCode::VersionLayout &getVersionLayout(int ver);
+
+    /*
+     * Draws and marks the finder pattern with its separator, the timing patterns
+     * along the top row and left column, and the format area, and marks the bits
+     * past the end of each row. The grid must be all 0 before
+    */
+    private: static void drawFunctionPatterns(const QrCode::Grid &grid);
+
+    /*
+     * Draws the one copy of the format bits for the given symbol number and mask
+    */
+    private: static void drawFormatBits(const QrCode::Grid &grid, int symbolNumber, int msk);
+
+    /*
+     * Returns the score of the grid's current modules for the mask choice, which takes
+     * the highest: the black modules on the right and bottom edges, the timing pattern
+     * excluded, weighting the side with fewer 16 times
+    */
+    private: static int getMaskScore(const QrCode::Grid &grid);
+
+
+    /* ---- Instance fields ---- */
+
+    // The version number of this Micro QR Code, in the range [1, 4]
+    private: int version;
+
+    // The width and height of this Micro QR Code, version * 2 + 9
+    private: int size;
+
+    // The error correction level used in this Micro QR Code
+    private: QrCode::Ecc errorCorrectionLevel;
+
+    // The index of the mask pattern used in this Micro QR Code, in the range [0, 3]
+    private: int mask;
+
+    // The modules of this Micro QR Code, one 64-bit word per row with bit x for
+    // column x (false = white, true = black)
+    private: std::vector<std::uint64_t> modules;
+
+
+    /* ---- Constants and Tables ---- */
+
+    /*
+     * The minimum and maximum version numbers, for M1 and M4
+    */
+    public: static constexpr int MIN_VERSION = 1;
+    public: static constexpr int MAX_VERSION = 4;
+
+    /*
+     * The QR Code mask (0 to 7) of each Micro QR Code mask, which uses 4 of them
+    */
+    private: static const int MASK_PATTERNS[4];
+
+    /*
+     * The data bits (a multiple of 8 plus 4 for M1 and M3, whose last data codeword
+     * is 4 bits long) and the error correction codewords of each symbol number
+    */
+    private: static const std::int16_t NUM_DATA_BITS[8];
+    private: static const std::int8_t NUM_ECC_CODEWORDS[8];
+};
+
+/*
+ * A thread-safe cache of encoded QR Codes in front of QrCode::encodeText() and
+ * QrCode::encodeSegments(). An entry is keyed by its content: the payload (the text,
+ * or the mode, character count and data bits of every segment) together with the
+ * error correction level, version range, mask and ECC boosting. The least recently
+ * used entries are evicted to keep the entries' memory within the budget.
+ * The QR Codes are encoded outside the lock, so a miss does not block other threads.
 */
-class BitBuffer final : public std::vector<bool> {
+class QrCodeCache final {
+
     /* ---- Constructor ---- */
-    
+
     /*
-     * Creates an empty bits buffer (length 0)
+     * Creates an empty cache holding at most budget bytes of keys and module grids
     */
-    public: BitBuffer();
+    public: explicit QrCodeCache(std::size_t budget);
+
 
     /* ---- Methods ---- */
 
     /*
-     * Appends the given number of low-order bits of the given value
-     * to this buffer. Requires 0 <= len <= 31 and val <= 2 ^ len
+     * Returns QrCode::encodeText(text, ecl), from the cache if it holds it
     */
-    public: void appendBits(std::uint32_t val, int len);
-    
+    public: QrCode encodeText(const char *text, QrCode::Ecc ecl);
+
+    /*
+     * Returns QrCode::encodeSegments() of the same arguments, from the cache if it holds it
+    */
+    public: QrCode encodeSegments(const std::vector<QrSegment> &segs, QrCode::Ecc ecl,
+                                  int minVersion = 1, int maxVersion = 40, int mask = -1, bool boostEcl = true);
+
+    /*
+     * Removes all entries
+    */
+    public: void clear();
+
+    /*
+     * Returns the number of entries, and the bytes counted against the budget
+    */
+    public: std::size_t getCount() const;
+    public: std::size_t getBytes() const;
+
+    /*
+     * Returns the number of requests answered from the cache, and encoded
+    */
+    public: unsigned long getHits() const;
+    public: unsigned long getMisses() const;
+
+
+    /* ---- Private helper methods ---- */
+
+    /*
+     * Returns the cached QR Code of the key, encoding it with the function on a miss
+    */
+    private: template <typename Encode> QrCode lookup(const std::string &key, Encode encode);
+
+    /*
+     * Returns the bytes an entry counts against the budget
+    */
+    private: static std::size_t getEntryBytes(const std::string &key, const QrCode &qr);
+
+
+    /* ---- Fields ---- */
+
+    // Entries, the most recently used first
+    private: std::list<std::pair<std::string, QrCode>> entries;
+
+    // Entries by key
+    private: std::unordered_map<std::string, std::list<std::pair<std::string, QrCode>>::iterator> index;
+
+    private: std::size_t maxBytes;
+    private: std::size_t bytes;
+    private: unsigned long hits;
+    private: unsigned long misses;
+
+    // Guards all the fields above
+    private: mutable std::mutex lock;
+
+};
+
+
+/*
+ * Thrown when QrDecoder cannot read a QR Code: the grid has an invalid size, the
+ * format or version bits are too damaged, a block has more errors than its error
+ * correction codewords can correct, or the bit stream is malformed.
+*/
+class decode_error : public std::runtime_error {
+    public: explicit decode_error(const std::string &msg);
+};
+
+
+/*
+ * Reads the segments back from the modules of a QR Code, for example to verify
+ * a generated symbol. The format and version bits are read from the grid (with
+ * their own error correction), the mask is undone, the codewords are
+ * de-interleaved into blocks, and each block is corrected with Reed-Solomon
+ * decoding (Berlekamp-Massey and Forney) in the same GF(2^8 / 0x11D) as QrCode.
+*/
+class QrDecoder final {
+
+    /* ---- Static decoding functions ---- */
+
+    /*
+     * Returns the segments of the given QR Code. If corrected is not null, the
+     * number of codewords corrected is stored in it. Throws decode_error.
+    */
+    public: static std::vector<QrSegment> decode(const QrCode &qr, int *corrected = nullptr);
+
+    /*
+     * Returns the segments of a QR Code given as its modules in row major order,
+     * modules[y * size + x] (false = white, true = black). If corrected is not null,
+     * the number of codewords corrected is stored in it. Throws decode_error.
+    */
+    public: static std::vector<QrSegment> decode(const std::vector<bool> &modules, int size, int *corrected = nullptr);
+
+    /*
+     * Returns the segments of the given Structured Append symbols, given in any order,
+     * joined in sequence order without their headers. The symbols must be the whole
+     * sequence, all with the same count and parity; a single symbol may have no header.
+     * If corrected is not null, the number of codewords corrected in all symbols is
+     * stored in it. Throws decode_error.
+    */
+    public: static std::vector<QrSegment> decodeStructuredAppend(const std::vector<QrCode> &symbols, int *corrected = nullptr);
+
+
+    /* ---- Private helper functions ---- */
+
+    /*
+     * Decodes a grid packed into 64-bit row words as in QrCode
+    */
+    private: static std::vector<QrSegment> decodeGrid(const std::vector<std::uint64_t> &modules, int size, int *corrected);
+
+    /*
+     * Returns the module at the given coordinates of a packed grid
+    */
+    private: static bool getModule(const std::vector<std::uint64_t> &modules, int rowWords, int x, int y);
+
+    /*
+     * Returns the valid value among the given candidates (pairs of value and
+     * codeword) closest to either of the two read copies, if at most 3 bits differ
+    */
+    private: static int findClosest(const std::vector<std::pair<int, long>> &candidates, long copy0, long copy1);
+
+    /*
+     * Corrects the given Reed-Solomon codeword (data then error correction bytes)
+     * in place, and returns the number of bytes corrected. Throws decode_error
+     * if there are more errors than eccLen / 2.
+    */
+    private: static int correctBlock(std::uint8_t *codeword, int length, int eccLen);
+
+    /*
+     * Splits the data codewords into segments at the given version
+    */
+    private: static std::vector<QrSegment> parseSegments(const std::vector<std::uint8_t> &data, int version);
+
 };
 
 } // namespace qrcodeGen
\ No newline at end of file
@@ -1,8 +1,12 @@
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include "generator.hpp"
 
@@ -11,12 +15,36 @@ using qrcodegen::QrCode;
 using qrcodegen::QrSegment;
 
 
+static const std::vector<QrCode::Ecc> ECC_LEVELS {
+    QrCode::Ecc::LOW,
+    QrCode::Ecc::MEDIUM,
+    QrCode::Ecc::QUARTILE,
+    QrCode::Ecc::HIGH,  
+};
+
+
 // Function prototypes
 static void doBasicDemo();
 static void doVarietyDemo();
 static void doSegmentDemo();
 static void doMaskDemo();
+static void doSegmentTest();
+static void doDecoderTest();
+static void doStructuredAppendTest();
+static void doAllocationFreeTest();
+static void doImageTest();
+static void doCacheTest();
+static void doStatsTest();
+static void doMicroQrTest();
 static void printQr(const QrCode &qr);
+static void check(bool condition, const char *message);
+static std::vector<bool> getModules(const QrCode &qr);
+static bool sameSegments(const std::vector<QrSegment> &a, const std::vector<QrSegment> &b);
+static void checkPng(const QrCode &qr, int scale, int border);
+static std::uint32_t getCrc32(const uint8_t *data, std::size_t length);
+static std::uint32_t getBigEndian(const uint8_t *data);
+static std::string describeSegments(const std::vector<QrSegment> &segs);
+static std::string getByteText(const std::vector<QrSegment> &segs, std::size_t first);
 
 
 // The main application program.
@@ -25,6 +53,14 @@ int main() {
 	doVarietyDemo();
 	doSegmentDemo();
 	doMaskDemo();
+	doSegmentTest();
+	doDecoderTest();
+	doStructuredAppendTest();
+	doAllocationFreeTest();
+	doImageTest();
+	doCacheTest();
+	doStatsTest();
+	doMicroQrTest();
 	return EXIT_SUCCESS;
 }
 
@@ -157,6 +193,435 @@ static void doMaskDemo() {
 
 
 
+/*---- Test suite ----*/
+
+// Checks the mixed-mode segments of texts and the versions encodeText() chooses with them.
+static void doSegmentTest() {
+	// Segments as "mode:characters:data bits", and the total bits at version 1 and 10
+	check(describeSegments(QrSegment::makeSegments("ABCDEFG123456789012345abc")) == "2:7:39 1:15:50 4:3:24",
+		"alphanumeric, numeric and byte");
+	check(QrSegment::getTotalBits(QrSegment::makeSegments("ABCDEFG123456789012345abc"), 1) == 152, "mixed bits");
+	check(QrSegment::getTotalBits(QrSegment::makeSegmentsOptimally("ABCDEFG123456789012345abc", 10), 10) == 164,
+		"mixed bits with wider counts");
+	const char *kanjiText = "\xE7\x82\xB9\xE8\x8C\x97" "0123456789abc";  // Kanji "dot" and "tea bud" in UTF-8
+	check(describeSegments(QrSegment::makeSegments(kanjiText)) == "8:2:26 1:10:34 4:3:24", "kanji, numeric and byte");
+	check(QrSegment::getTotalBits(QrSegment::makeSegments(kanjiText), 1) == 122, "kanji mix bits");
+	check(describeSegments(QrSegment::makeSegments("12345\xE7\x82\xB9")) == "1:5:17 8:1:13", "numeric and kanji");
+	
+	// The kanji values of Shift JIS 0x935F and 0xE4AA, 0xD9F and 0x1AAA in 13 bits each
+	const QrSegment kanji = QrSegment::makeKanji("\xE7\x82\xB9\xE8\x8C\x97");
+	check(kanji.getNumChars() == 2 && kanji.getData().getBytes() == std::vector<uint8_t>({0x6C, 0xFE, 0xAA, 0x80}),
+		"kanji values");
+	
+	// Bytes which are not valid UTF-8 stay in byte mode, unchanged
+	const std::vector<QrSegment> invalid = QrSegment::makeSegments("\x93\x5F\xFF" "12");
+	check(describeSegments(invalid) == "4:5:40" && getByteText(invalid, 0) == "\x93\x5F\xFF" "12", "invalid UTF-8");
+	check(describeSegments(QrSegment::makeSegments("a\xE7\x82")) == "4:3:24", "truncated UTF-8");
+	
+	// Runs of 7 digits among letters are worth numeric segments only with the character count
+	// widths of versions 1 to 9, and runs of 8 only up to version 26. At each width boundary
+	// the version chosen differs from encoding the text in byte mode, or in the segments
+	// made for the widths of versions 1 to 9
+	auto repeat = [](const char *unit, int count) {
+		std::string result;
+		for (int i = 0; i < count; i++)
+			result += unit;
+		return result;
+	};
+	const struct {
+		std::string text;
+		int version;        // Chosen by encodeText()
+		int otherVersion;   // Of the byte mode segment, or of the segments of makeSegments()
+		bool bytes;
+	} boundaries[] = {
+		{repeat("abc1234567" , 25),  9, 10, true },
+		{repeat("abc1234567" , 27), 10, 11, false},
+		{repeat("abc12345678", 125), 26, 27, true },
+		{repeat("abc1234567" , 137), 27, 28, false},
+	};
+	for (const auto &boundary : boundaries) {
+		const std::vector<QrSegment> segs = boundary.bytes
+			? std::vector<QrSegment>{QrSegment::makeBytes(std::vector<uint8_t>(boundary.text.begin(), boundary.text.end()))}
+			: QrSegment::makeSegments(boundary.text.c_str());
+		check(QrCode::encodeText(boundary.text.c_str(), QrCode::Ecc::LOW).getVersion() == boundary.version
+			&& QrCode::encodeSegments(segs, QrCode::Ecc::LOW, 1, 40, -1, false).getVersion() == boundary.otherVersion,
+			"version at a character count width boundary");
+	}
+	check(QrSegment::makeSegmentsOptimally(boundaries[1].text.c_str(), 9).size() == 54, "numeric runs split at version 9");
+	check(QrSegment::makeSegmentsOptimally(boundaries[1].text.c_str(), 10).size() == 2, "numeric runs merged at version 10");
+}
+
+
+// Decodes QR Codes clean, with as many damaged codewords as their ECC can correct, and with too many.
+static void doDecoderTest() {
+	using qrcodegen::QrDecoder;
+	const std::vector<QrSegment> segs = QrSegment::makeSegments("HELLO 123");
+	for (int ver : {1, 7, 40}) {
+		for (QrCode::Ecc ecl : ECC_LEVELS) {
+			const QrCode qr = QrCode::encodeSegments(segs, ecl, ver, ver, -1, false);
+			int corrected = -1;
+			check(sameSegments(QrDecoder::decode(qr, &corrected), segs), "clean round trip");
+			check(corrected == 0, "clean symbol has no corrections");
+		}
+	}
+	
+	// One module of each of the first 12 codewords of version 1, which fill the 4 rightmost
+	// column pairs of rows 9 to 20 in the zigzag order, 4 rows of a column pair per codeword
+	const int damage[12][2] = {
+		{20, 20}, {20, 16}, {20, 12},  // Upward
+		{18,  9}, {18, 13}, {18, 17},  // Downward
+		{16, 20}, {16, 16}, {16, 12},
+		{14,  9}, {14, 13}, {14, 17},
+	};
+	const int correctable[] = {3, 5, 6, 8};  // Half the 7, 10, 13 and 17 ECC codewords
+	for (std::size_t i = 0; i < ECC_LEVELS.size(); i++) {
+		const QrCode qr = QrCode::encodeSegments(segs, ECC_LEVELS[i], 1, 1, -1, false);
+		std::vector<bool> modules = getModules(qr);
+		for (int j = 0; j < correctable[i]; j++)
+			modules[static_cast<std::size_t>(damage[j][1] * qr.getSize() + damage[j][0])].flip();
+		int corrected = -1;
+		check(sameSegments(QrDecoder::decode(modules, qr.getSize(), &corrected), segs), "damaged round trip");
+		check(corrected == correctable[i], "damaged codewords counted");
+	}
+	
+	// Past the ECC capacity the decoder must fail rather than return other data
+	const QrCode qr = QrCode::encodeSegments(segs, QrCode::Ecc::LOW, 1, 1, -1, false);
+	std::vector<bool> modules = getModules(qr);
+	for (const int (&module)[2] : damage)
+		modules[static_cast<std::size_t>(module[1] * qr.getSize() + module[0])].flip();
+	bool failed = false;
+	try {
+		QrDecoder::decode(modules, qr.getSize());
+	} catch (const qrcodegen::decode_error &) {
+		failed = true;
+	}
+	check(failed, "too damaged symbol is a decode_error");
+}
+
+
+// Splits text across Structured Append symbols and reads back their headers and the text.
+static void doStructuredAppendTest() {
+	using qrcodegen::QrDecoder;
+	
+	// The 20-bit header: mode 0011, index, count - 1 and parity
+	const QrSegment header = QrSegment::makeStructuredAppend(2, 5, 0xAB);
+	check(header.getMode().getModeBits() == 0x3 && header.getNumChars() == 0, "header mode");
+	check(header.getData().getBytes() == std::vector<uint8_t>({0x24, 0xAB}), "header index, count and parity");
+	check(QrSegment::getTotalBits({header}, 1) == 20, "header is 20 bits");
+	
+	// Lowercase text is one byte segment, 15 bytes after the header in a version 1-L symbol
+	std::string text;
+	for (int i = 0; i < 240; i++)
+		text += static_cast<char>('a' + i * 7 % 26);
+	int parity = 0;
+	for (char c : text)
+		parity ^= static_cast<uint8_t>(c);
+	const std::vector<QrCode> symbols = QrCode::encodeStructuredAppend(text.c_str(), QrCode::Ecc::LOW, 1);
+	check(symbols.size() == 16, "16 symbols of version 1");
+	std::string joined;
+	for (std::size_t i = 0; i < symbols.size(); i++) {
+		const std::vector<QrSegment> segs = QrDecoder::decode(symbols[i]);
+		check(segs.at(0).getMode().getModeBits() == 0x3, "symbol starts with its header");
+		const std::vector<uint8_t> &bytes = segs.at(0).getData().getBytes();
+		check(bytes.at(0) >> 4 == static_cast<int>(i) && (bytes.at(0) & 0xF) == 15, "header index and count");
+		check(bytes.at(1) == parity, "header parity is the XOR of the text");
+		joined += getByteText(segs, 1);
+	}
+	check(joined == text, "symbols hold the text in sequence order");
+	
+	// Given in reverse order, the decoder joins the parts in sequence order
+	const std::vector<QrCode> reversed(symbols.rbegin(), symbols.rend());
+	check(getByteText(QrDecoder::decodeStructuredAppend(reversed), 0) == text, "reverse order round trip");
+	
+	// One more byte needs a 17th symbol
+	bool tooLong = false;
+	try {
+		QrCode::encodeStructuredAppend((text + "a").c_str(), QrCode::Ecc::LOW, 1);
+	} catch (const qrcodegen::data_too_long &) {
+		tooLong = true;
+	}
+	check(tooLong, "at most 16 symbols");
+	
+	// A text fitting one symbol of maxVersion is an ordinary QR Code without a header
+	const std::vector<QrCode> single = QrCode::encodeStructuredAppend("hello", QrCode::Ecc::LOW, 1);
+	check(single.size() == 1 && getModules(single[0]) == getModules(QrCode::encodeText("hello", QrCode::Ecc::LOW)),
+		"single symbol is encodeText()");
+	check(QrDecoder::decode(single[0]).at(0).getMode().getModeBits() == 0x4, "single symbol has no header");
+}
+
+
+// Checks that the allocation-free encodeText() draws the same symbols as encodeSegments().
+static void doAllocationFreeTest() {
+	static uint8_t temp[QrCode::TEMP_BUFFER_LEN_MAX];
+	static uint8_t qrcode[QrCode::BUFFER_LEN_MAX];
+	const std::string bytes(2953, 'x');  // The most bytes of version 40-L, filling the buffers
+	const char *texts[] = {"", "0123456789", "HELLO WORLD", "Hello, world!", bytes.c_str()};
+	for (const char *text : texts) {
+		std::vector<QrSegment> segs;
+		if (QrSegment::isNumeric(text))
+			segs.push_back(QrSegment::makeNumeric(text));
+		else if (QrSegment::isAlphanumeric(text))
+			segs.push_back(QrSegment::makeAlphanumeric(text));
+		else
+			segs.push_back(QrSegment::makeBytes(std::vector<uint8_t>(text, text + std::strlen(text))));
+		for (QrCode::Ecc ecl : ECC_LEVELS) {
+			for (int mask : {-1, 3}) {
+				bool fits = QrCode::encodeText(text, ecl, temp, qrcode, 1, 40, mask, true);
+				bool expected = true;
+				QrCode qr = QrCode::encodeText("", ecl);
+				try {
+					qr = QrCode::encodeSegments(segs, ecl, 1, 40, mask, true);
+				} catch (const qrcodegen::data_too_long &) {
+					expected = false;
+				}
+				check(fits == expected, "allocation-free fits as encodeSegments()");
+				if (!fits)
+					continue;
+				check(QrCode::getSize(qrcode) == qr.getSize(), "allocation-free size");
+				for (int y = 0; y < qr.getSize(); y++) {
+					for (int x = 0; x < qr.getSize(); x++)
+						check(QrCode::getModule(qrcode, x, y) == qr.getModule(x, y), "allocation-free modules");
+				}
+			}
+		}
+	}
+	
+	// A text too long for the versions allowed reports false and an empty symbol
+	check(!QrCode::encodeText("Hello, world! Hello, world!", QrCode::Ecc::HIGH, temp, qrcode, 1, 2), "too long fails");
+	check(qrcode[0] == 0 && QrCode::getSize(qrcode) == 0, "too long leaves no symbol");
+	check(!QrCode::getModule(qrcode, 0, 0), "empty symbol has no modules");
+}
+
+
+// Checks the SVG, PNG, PBM and PGM renderers against the modules of the symbol.
+static void doImageTest() {
+	const QrCode qr = QrCode::encodeText("Hello, world!", QrCode::Ecc::LOW);  // Version 1, 21 modules
+	const int size = qr.getSize();
+	
+	// The SVG path has one "M<x>,<y>h<n>v1h-<n>z" per horizontal run of black modules
+	const std::string svg = qr.toSvgString(4);
+	check(svg.size() == qr.toSvg(nullptr, 0, 4), "SVG length");
+	std::vector<bool> covered(static_cast<std::size_t>(size * size), false);
+	std::size_t pos = svg.find("<path d=\"");
+	check(pos != std::string::npos, "SVG path");
+	for (pos += 9; svg[pos] == 'M'; ) {
+		int x, y, width, back, length;
+		check(std::sscanf(&svg[pos], "M%d,%dh%dv1h-%dz%n", &x, &y, &width, &back, &length) == 4 && width == back,
+			"SVG path segment");
+		for (int i = 0; i < width; i++) {
+			std::size_t index = static_cast<std::size_t>((y - 4) * size + x - 4 + i);
+			check(x - 4 + i < size && !covered.at(index), "SVG run inside the symbol, drawn once");
+			covered.at(index) = true;
+		}
+		pos += static_cast<std::size_t>(length);
+		if (svg[pos] == ' ')
+			pos++;
+	}
+	check(covered == getModules(qr), "SVG runs cover the black modules");
+	
+	// PNG of one stored block, and of several at version 33
+	checkPng(qr, 1, 0);
+	checkPng(QrCode::encodeSegments({QrSegment::makeNumeric("0")}, QrCode::Ecc::LOW, 33, 33), 10, 4);
+	
+	// PBM and PGM at scale 3 with a border of 2 modules
+	const int scale = 3, border = 2;
+	const int width = (size + border * 2) * scale;
+	const std::string header = std::to_string(width) + " " + std::to_string(width) + "\n";
+	std::vector<uint8_t> pbm(qr.toPbm(nullptr, 0, scale, border));
+	check(qr.toPbm(pbm.data(), pbm.size(), scale, border) == pbm.size(), "PBM length");
+	std::vector<uint8_t> pgm(qr.toPgm(nullptr, 0, scale, border));
+	check(qr.toPgm(pgm.data(), pgm.size(), scale, border) == pgm.size(), "PGM length");
+	const std::string pbmHeader = "P4\n" + header;
+	const std::string pgmHeader = "P5\n" + header + "255\n";
+	const std::size_t rowBytes = (static_cast<std::size_t>(width) + 7) / 8;
+	check(pbm.size() == pbmHeader.size() + rowBytes * static_cast<std::size_t>(width)
+		&& std::equal(pbmHeader.begin(), pbmHeader.end(), pbm.begin()), "PBM header");
+	check(pgm.size() == pgmHeader.size() + static_cast<std::size_t>(width * width)
+		&& std::equal(pgmHeader.begin(), pgmHeader.end(), pgm.begin()), "PGM header");
+	for (int y = 0; y < width; y++) {
+		for (int x = 0; x < width; x++) {
+			bool black = qr.getModule(x / scale - border, y / scale - border);
+			std::size_t bit = pbmHeader.size() + static_cast<std::size_t>(y) * rowBytes + static_cast<std::size_t>(x / 8);
+			check(((pbm[bit] >> (7 - x % 8) & 1) != 0) == black, "PBM pixels");
+			check(pgm[pgmHeader.size() + static_cast<std::size_t>(y * width + x)] == (black ? 0 : 255), "PGM pixels");
+		}
+	}
+	
+	// A partial capacity still returns the length of the whole image
+	uint8_t small[16];
+	check(qr.toPng(small, sizeof(small), 1, 0) == qr.toPng(nullptr, 0, 1, 0) && qr.toPbm(small, sizeof(small), scale, border) == pbm.size()
+		&& std::memcmp(small, pbm.data(), sizeof(small)) == 0, "partial capacity");
+	
+	// The scale must be positive and the image at most 32768 pixels wide
+	bool badScale = false;
+	try {
+		qr.toPbm(nullptr, 0, 0, 4);
+	} catch (const std::domain_error &) {
+		badScale = true;
+	}
+	check(badScale, "scale 0 is an error");
+	bool badBorder = false;
+	try {
+		qr.toPng(nullptr, 0, 1, 20000);
+	} catch (const std::overflow_error &) {
+		badBorder = true;
+	}
+	check(badBorder, "oversized border is an error");
+}
+
+
+// Checks the hits, keys, LRU eviction and byte budget of QrCodeCache.
+static void doCacheTest() {
+	using qrcodegen::QrCodeCache;
+	QrCodeCache cache(1 << 20);
+	check(getModules(cache.encodeText("text1", QrCode::Ecc::LOW)) == getModules(QrCode::encodeText("text1", QrCode::Ecc::LOW)),
+		"cached encodeText()");
+	cache.encodeText("text1", QrCode::Ecc::LOW);
+	check(cache.getHits() == 1 && cache.getMisses() == 1 && cache.getCount() == 1, "hit on a repeated text");
+	const std::size_t entryBytes = cache.getBytes();  // Of every version 1 symbol of a 5-byte text
+	
+	// Every argument is part of the key
+	cache.encodeText("text1", QrCode::Ecc::MEDIUM);
+	check(cache.getMisses() == 2 && cache.getCount() == 2, "another ECC level is another entry");
+	const std::vector<QrSegment> segs = QrSegment::makeSegments("text1");
+	cache.encodeSegments(segs, QrCode::Ecc::LOW);
+	cache.encodeSegments(segs, QrCode::Ecc::LOW);
+	check(cache.getHits() == 2 && cache.getMisses() == 3, "hit on repeated segments");
+	cache.encodeSegments(segs, QrCode::Ecc::LOW, 2, 40);
+	cache.encodeSegments(segs, QrCode::Ecc::LOW, 1, 39);
+	cache.encodeSegments(segs, QrCode::Ecc::LOW, 1, 40, 3);
+	check(cache.getHits() == 2 && cache.getMisses() == 6 && cache.getCount() == 6, "versions and mask are in the key");
+	cache.clear();
+	check(cache.getCount() == 0 && cache.getBytes() == 0, "clear() empties the cache");
+	
+	// With room for 3 entries, the least recently used one is evicted
+	QrCodeCache lru(entryBytes * 3);
+	lru.encodeText("text1", QrCode::Ecc::LOW);
+	lru.encodeText("text2", QrCode::Ecc::LOW);
+	lru.encodeText("text3", QrCode::Ecc::LOW);
+	lru.encodeText("text1", QrCode::Ecc::LOW);  // Now text2 is the least recently used
+	lru.encodeText("text4", QrCode::Ecc::LOW);
+	check(lru.getCount() == 3 && lru.getBytes() <= entryBytes * 3, "eviction keeps the budget");
+	lru.encodeText("text1", QrCode::Ecc::LOW);
+	lru.encodeText("text3", QrCode::Ecc::LOW);
+	lru.encodeText("text4", QrCode::Ecc::LOW);
+	check(lru.getHits() == 4 && lru.getMisses() == 4, "recently used entries kept");
+	lru.encodeText("text2", QrCode::Ecc::LOW);
+	check(lru.getMisses() == 5, "least recently used entry evicted");
+	
+	// An entry larger than the whole budget is returned but not stored
+	QrCodeCache tiny(entryBytes - 1);
+	tiny.encodeText("text1", QrCode::Ecc::LOW);
+	tiny.encodeText("text1", QrCode::Ecc::LOW);
+	check(tiny.getCount() == 0 && tiny.getBytes() == 0 && tiny.getMisses() == 2, "oversized entry not stored");
+}
+
+
+// Checks that EncodeStats reports the choices of the encode and the scores of the masks.
+static void doStatsTest() {
+	// The choices, with the ECC level boosted from LOW
+	QrCode::EncodeStats stats = {};
+	const QrCode boosted = QrCode::encodeText("HELLO", QrCode::Ecc::LOW, &stats);
+	check(boosted.getErrorCorrectionLevel() != QrCode::Ecc::LOW, "ECC level boosted");
+	check(stats.version == boosted.getVersion() && stats.errorCorrectionLevel == boosted.getErrorCorrectionLevel()
+		&& stats.mask == boosted.getMask(), "stats of encodeText()");
+	
+	// The automatic mask is the one of the least penalty, scored serially or by parallelMask
+	const std::vector<QrSegment> segs = QrSegment::makeSegments("HELLO");
+	for (bool parallelMask : {false, true}) {
+		stats = QrCode::EncodeStats();
+		const QrCode qr = QrCode::encodeSegments(segs, QrCode::Ecc::MEDIUM, 15, 15, -1, false, parallelMask, &stats);
+		check(stats.version == 15 && stats.errorCorrectionLevel == QrCode::Ecc::MEDIUM && stats.mask == qr.getMask(),
+			"stats of encodeSegments()");
+		for (long penalty : stats.maskPenalties)
+			check(penalty >= 0 && stats.maskPenalties[stats.mask] <= penalty, "chosen mask has the least penalty");
+	}
+	
+	// A forced mask scores none
+	stats = QrCode::EncodeStats();
+	const QrCode forced = QrCode::encodeSegments(segs, QrCode::Ecc::MEDIUM, 1, 40, 5, true, false, &stats);
+	check(stats.mask == 5 && forced.getMask() == 5, "forced mask");
+	for (long penalty : stats.maskPenalties)
+		check(penalty == -1, "forced mask scores no mask");
+}
+
+
+// Checks Micro QR Codes against known answers: version and ECC choice, size, format bits and capacities.
+static void doMicroQrTest() {
+	using qrcodegen::MicroQrCode;
+	
+	// Version and ECC level selection, boosting within the version
+	const MicroQrCode m1 = MicroQrCode::encodeText("12345", QrCode::Ecc::LOW);
+	check(m1.getVersion() == 1 && m1.getErrorCorrectionLevel() == QrCode::Ecc::LOW, "M1 for 5 digits");
+	const MicroQrCode m2 = MicroQrCode::encodeText("01234567", QrCode::Ecc::LOW);
+	check(m2.getVersion() == 2 && m2.getErrorCorrectionLevel() == QrCode::Ecc::MEDIUM, "M2-M for 8 digits");
+	const MicroQrCode m4 = MicroQrCode::encodeText("1", QrCode::Ecc::QUARTILE);
+	check(m4.getVersion() == 4 && m4.getErrorCorrectionLevel() == QrCode::Ecc::QUARTILE, "only M4 has QUARTILE");
+	bool invalid = false;
+	try {
+		MicroQrCode::encodeText("1", QrCode::Ecc::HIGH);
+	} catch (const std::invalid_argument &) {
+		invalid = true;
+	}
+	check(invalid, "no HIGH level");
+	
+	// The format bits of every symbol number (M1, M2-L, M2-M, M3-L, M3-M, M4-L, M4-M, M4-Q)
+	// and mask, from ISO/IEC 18004 table C.1: bits 0 to 7 down column 8 from row 1, then
+	// bits 8 to 14 leftward along row 8 from column 7
+	const int formats[8][4] = {
+		{0x4445, 0x4172, 0x4E2B, 0x4B1C},
+		{0x55AE, 0x5099, 0x5FC0, 0x5AF7},
+		{0x6793, 0x62A4, 0x6DFD, 0x68CA},
+		{0x7678, 0x734F, 0x7C16, 0x7921},
+		{0x06DE, 0x03E9, 0x0CB0, 0x0987},
+		{0x1735, 0x1202, 0x1D5B, 0x186C},
+		{0x2508, 0x203F, 0x2F66, 0x2A51},
+		{0x34E3, 0x31D4, 0x3E8D, 0x3BBA},
+	};
+	const int symbols[][2] = {{1, 0}, {2, 0}, {2, 1}, {3, 0}, {3, 1}, {4, 0}, {4, 1}, {4, 2}};  // Version, ECC level
+	for (int symbol = 0; symbol < 8; symbol++) {
+		int ver = symbols[symbol][0];
+		for (int mask = 0; mask < 4; mask++) {
+			const MicroQrCode qr = MicroQrCode::encodeSegments({QrSegment::makeNumeric("1")},
+				ECC_LEVELS.at(static_cast<std::size_t>(symbols[symbol][1])), ver, ver, mask, false);
+			check(qr.getSize() == ver * 2 + 9 && qr.getMask() == mask, "Micro QR size and mask");
+			int bits = 0;
+			for (int i = 0; i < 8; i++)
+				bits |= qr.getModule(8, i + 1) << i;
+			for (int i = 8; i < 15; i++)
+				bits |= qr.getModule(15 - i, 8) << i;
+			check(bits == formats[symbol][mask], "Micro QR format bits");
+		}
+	}
+	
+	// Capacities, at the edges of the 4-bit final data codeword of M1 (20 bits) and M3 (84 and
+	// 68 bits), and the 35 digits and 15 bytes of M4-L
+	const struct {
+		int length;
+		bool bytes;
+		QrCode::Ecc ecl;
+		int version;  // 0 if too long for M4
+	} capacities[] = {
+		{ 5, false, QrCode::Ecc::LOW   , 1}, { 6, false, QrCode::Ecc::LOW   , 2},
+		{23, false, QrCode::Ecc::LOW   , 3}, {24, false, QrCode::Ecc::LOW   , 4},
+		{18, false, QrCode::Ecc::MEDIUM, 3}, {19, false, QrCode::Ecc::MEDIUM, 4},
+		{35, false, QrCode::Ecc::LOW   , 4}, {36, false, QrCode::Ecc::LOW   , 0},
+		{15, true , QrCode::Ecc::LOW   , 4}, {16, true , QrCode::Ecc::LOW   , 0},
+	};
+	for (const auto &capacity : capacities) {
+		const std::string text(static_cast<std::size_t>(capacity.length), capacity.bytes ? 'a' : '7');
+		const QrSegment seg = capacity.bytes ? QrSegment::makeBytes(std::vector<uint8_t>(text.begin(), text.end()))
+			: QrSegment::makeNumeric(text.c_str());
+		int version = 0;
+		try {
+			version = MicroQrCode::encodeSegments({seg}, capacity.ecl, 1, 4, -1, false).getVersion();
+		} catch (const qrcodegen::data_too_long &) {}
+		check(version == capacity.version, "Micro QR capacity");
+	}
+}
+
+
+
 /*---- Utilities ----*/
 
 // Prints the given QrCode object to the console.
@@ -171,15 +636,136 @@ static void printQr(const QrCode &qr) {
 	std::cout << std::endl;
 }
 
-// main() for test
+// Exits with a failure after printing the message if the condition is false.
+static void check(bool condition, const char *message) {
+	if (!condition) {
+		std::cerr << "Test failed: " << message << std::endl;
+		std::exit(EXIT_FAILURE);
+	}
+}
 
-static const std::vector<QrCode::Ecc> ECC_LEVELS {
-    QrCode::Ecc::LOW,
-    QrCode::Ecc::MEDIUM,
-    QrCode::Ecc::QUARTILE,
-    QrCode::Ecc::HIGH,  
-};
+// Returns the modules of the given QrCode object in row major order.
+static std::vector<bool> getModules(const QrCode &qr) {
+	std::vector<bool> result;
+	for (int y = 0; y < qr.getSize(); y++) {
+		for (int x = 0; x < qr.getSize(); x++)
+			result.push_back(qr.getModule(x, y));
+	}
+	return result;
+}
 
+// Returns whether the segments have the same modes, character counts and data bits.
+static bool sameSegments(const std::vector<QrSegment> &a, const std::vector<QrSegment> &b) {
+	if (a.size() != b.size())
+		return false;
+	for (std::size_t i = 0; i < a.size(); i++) {
+		if (a[i].getMode().getModeBits() != b[i].getMode().getModeBits() || a[i].getNumChars() != b[i].getNumChars()
+				|| a[i].getData().size() != b[i].getData().size() || a[i].getData().getBytes() != b[i].getData().getBytes())
+			return false;
+	}
+	return true;
+}
+
+// Checks the chunks, CRCs, zlib stream and pixels of the PNG image of the given QrCode object.
+static void checkPng(const QrCode &qr, int scale, int border) {
+	std::vector<uint8_t> png(qr.toPng(nullptr, 0, scale, border));
+	check(qr.toPng(png.data(), png.size(), scale, border) == png.size(), "PNG length");
+	const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	check(std::memcmp(png.data(), signature, 8) == 0, "PNG signature");
+	
+	// IHDR, one IDAT and IEND, each checked by its CRC
+	const int width = (qr.getSize() + border * 2) * scale;
+	std::size_t chunk = 8;
+	std::vector<uint8_t> zlib;
+	for (const char *type : {"IHDR", "IDAT", "IEND"}) {
+		std::size_t length = getBigEndian(&png.at(chunk));
+		check(std::memcmp(&png.at(chunk + 4), type, 4) == 0, "PNG chunk type");
+		check(getBigEndian(&png.at(chunk + 8 + length)) == getCrc32(&png[chunk + 4], length + 4), "PNG chunk CRC");
+		if (std::strcmp(type, "IHDR") == 0) {
+			check(length == 13 && getBigEndian(&png[chunk + 8]) == static_cast<std::uint32_t>(width)
+				&& getBigEndian(&png[chunk + 12]) == static_cast<std::uint32_t>(width), "PNG width and height");
+			check(png[chunk + 16] == 1 && png[chunk + 17] == 0, "PNG 1-bit grayscale");
+		} else if (std::strcmp(type, "IDAT") == 0)
+			zlib.assign(png.begin() + static_cast<long>(chunk + 8), png.begin() + static_cast<long>(chunk + 8 + length));
+		chunk += 12 + length;
+	}
+	check(chunk == png.size(), "PNG ends with IEND");
+	
+	// Stored blocks up to the final one, then the Adler-32 of their data
+	check(zlib.size() >= 6 && zlib[0] == 0x78 && zlib[1] == 0x01, "zlib header");
+	std::vector<uint8_t> raw;
+	std::size_t pos = 2;
+	bool final = false;
+	while (!final) {
+		check(pos + 5 <= zlib.size() && (zlib[pos] & 0xFE) == 0, "stored block header");
+		final = zlib[pos] == 1;
+		std::size_t length = static_cast<std::size_t>(zlib[pos + 1] | zlib[pos + 2] << 8);
+		check((length ^ static_cast<std::size_t>(zlib[pos + 3] | zlib[pos + 4] << 8)) == 0xFFFF, "stored block length");
+		check(pos + 5 + length <= zlib.size(), "stored block inside the stream");
+		raw.insert(raw.end(), zlib.begin() + static_cast<long>(pos + 5), zlib.begin() + static_cast<long>(pos + 5 + length));
+		pos += 5 + length;
+	}
+	check(pos + 4 == zlib.size(), "zlib stream ends with Adler-32");
+	std::uint32_t adlerA = 1, adlerB = 0;
+	for (uint8_t b : raw) {
+		adlerA = (adlerA + b) % 65521;
+		adlerB = (adlerB + adlerA) % 65521;
+	}
+	check(getBigEndian(&zlib[pos]) == (adlerB << 16 | adlerA), "zlib Adler-32");
+	
+	// Each row a filter type byte 0, then the pixels with 1 for white
+	std::size_t rowBytes = (static_cast<std::size_t>(width) + 7) / 8;
+	check(raw.size() == static_cast<std::size_t>(width) * (1 + rowBytes), "PNG raw length");
+	for (int y = 0; y < width; y++) {
+		const uint8_t *row = &raw[static_cast<std::size_t>(y) * (1 + rowBytes)];
+		check(row[0] == 0, "PNG filter type 0");
+		for (int x = 0; x < width; x++) {
+			bool black = qr.getModule(x / scale - border, y / scale - border);
+			check(((row[1 + x / 8] >> (7 - x % 8) & 1) == 0) == black, "PNG pixels");
+		}
+	}
+}
+
+// Returns the CRC-32 of PNG chunks, computed bit by bit.
+static std::uint32_t getCrc32(const uint8_t *data, std::size_t length) {
+	std::uint32_t crc = 0xFFFFFFFF;
+	for (std::size_t i = 0; i < length; i++) {
+		crc ^= data[i];
+		for (int k = 0; k < 8; k++)
+			crc = (crc & 1) != 0 ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+	}
+	return ~crc;
+}
+
+// Returns the 32-bit big endian value at the given bytes.
+static std::uint32_t getBigEndian(const uint8_t *data) {
+	return static_cast<std::uint32_t>(data[0]) << 24 | static_cast<std::uint32_t>(data[1]) << 16
+		| static_cast<std::uint32_t>(data[2]) << 8 | data[3];
+}
+
+// Returns the mode bits, character count and data bits of each segment, as "2:7:39 1:15:50".
+static std::string describeSegments(const std::vector<QrSegment> &segs) {
+	std::string result;
+	for (const QrSegment &seg : segs) {
+		result += result.empty() ? "" : " ";
+		result += std::to_string(seg.getMode().getModeBits()) + ":" + std::to_string(seg.getNumChars())
+			+ ":" + std::to_string(seg.getData().size());
+	}
+	return result;
+}
+
+// Returns the text of the byte mode segments from index first on.
+static std::string getByteText(const std::vector<QrSegment> &segs, std::size_t first) {
+	std::string result;
+	for (std::size_t i = first; i < segs.size(); i++) {
+		check(segs[i].getMode().getModeBits() == 0x4, "byte mode segment");
+		const std::vector<uint8_t> &bytes = segs[i].getData().getBytes();
+		result.append(bytes.begin(), bytes.begin() + segs[i].getNumChars());
+	}
+	return result;
+}
+
+// main() for test
 
 // int main() {
 //     while (true) {